@@ -0,0 +1,205 @@
+// Throughput benchmark for the .obj number parsers in tiny_obj_loader.h.
+//
+// For every file it scans the `v`/`vn`/`vt` and `f` records twice, once with
+// the old per-character parser (tryParseDoubleLegacy/atoi) and once with the
+// current one (parseReal/parseDecimalInt), and reports MB/s for both. Every
+// float is also checked against strtof() to verify exact round-tripping.
+// Finally the whole file is loaded with tinyobj::LoadObj for reference.
+//
+// Usage: obj_parse_bench [repeats] file.obj...   (e.g. data/*.obj)
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#define TINYOBJLOADER_USE_MAPBOX_EARCUT
+#include "tiny_obj_loader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Result {
+    double seconds = 0.0;
+    double checksum = 0.0;
+};
+
+std::string readFile(const char *path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) return {};
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+float parseFloatLegacy(const char **token) {
+    (*token) += strspn((*token), " \t");
+    const char *end = (*token) + strcspn((*token), " \t\r\n");
+    double val = 0.0;
+    tinyobj::tryParseDoubleLegacy((*token), end, &val);
+    (*token) = end;
+    return static_cast<float>(val);
+}
+
+float parseFloatNew(const char **token) {
+    return tinyobj::parseReal(token);
+}
+
+int parseIntLegacy(const char *s) { return atoi(s); }
+
+int parseIntNew(const char *s) { return tinyobj::parseDecimalInt(s); }
+
+// Walks all vertex and face records of `buf` (NUL terminated), parsing every
+// number with the given functions. Returns a checksum so nothing is elided.
+template <float (*ParseFloat)(const char **), int (*ParseInt)(const char *)>
+double scan(const std::string &buf) {
+    double sum = 0.0;
+    const char *p = buf.c_str();
+    const char *end = p + buf.size();
+    while (p < end) {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        const char *token = p + strspn(p, " \t");
+        if (token[0] == 'v' && (token[1] == ' ' || token[1] == '\t' ||
+                                ((token[1] == 'n' || token[1] == 't') &&
+                                 (token[2] == ' ' || token[2] == '\t')))) {
+            token += (token[1] == ' ' || token[1] == '\t') ? 2 : 3;
+            token += strspn(token, " \t");
+            while (token < eol && *token != '\r') {
+                sum += ParseFloat(&token);
+                token += strspn(token, " \t");
+            }
+        } else if (token[0] == 'f' && (token[1] == ' ' || token[1] == '\t')) {
+            token += 2;
+            token += strspn(token, " \t");
+            while (token < eol && *token != '\r') {
+                sum += ParseInt(token);
+                token += strcspn(token, "/ \t\r\n");
+                if (*token == '/') token++;
+                token += strspn(token, " \t");
+            }
+        }
+        p = eol + 1;
+    }
+    return sum;
+}
+
+// Compares every float token of `buf` with strtof(). Returns the number of
+// values that differ from the correctly rounded result.
+template <float (*ParseFloat)(const char **)>
+size_t countMismatches(const std::string &buf, size_t *total) {
+    size_t bad = 0;
+    const char *p = buf.c_str();
+    const char *end = p + buf.size();
+    while (p < end) {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        const char *token = p + strspn(p, " \t");
+        if (token[0] == 'v' && (token[1] == ' ' || token[1] == 'n' || token[1] == 't')) {
+            token += strcspn(token, " \t");
+            token += strspn(token, " \t");
+            while (token < eol && *token != '\r') {
+                float expected = strtof(token, nullptr);
+                float got = ParseFloat(&token);
+                if (memcmp(&expected, &got, sizeof(float)) != 0) bad++;
+                (*total)++;
+                token += strspn(token, " \t");
+            }
+        }
+        p = eol + 1;
+    }
+    return bad;
+}
+
+template <float (*ParseFloat)(const char **), int (*ParseInt)(const char *)>
+Result time(const std::string &buf, int repeats) {
+    Result r;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) r.checksum += scan<ParseFloat, ParseInt>(buf);
+    auto t1 = std::chrono::steady_clock::now();
+    r.seconds = std::chrono::duration<double>(t1 - t0).count();
+    return r;
+}
+
+double loadSeconds(const char *path, bool mapped, int repeats) {
+    double best = 1e30;
+    for (int i = 0; i < repeats; i++) {
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string warn, err;
+        auto t0 = std::chrono::steady_clock::now();
+        if (mapped) {
+            tinyobj::LoadObjMapped(&attrib, &shapes, &materials, &warn, &err, path, nullptr,
+                                   true, true, 0);
+        } else {
+            tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+    }
+    return best;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int first = 1;
+    int repeats = 20;
+    if (argc > 1 && atoi(argv[1]) > 0) {
+        repeats = atoi(argv[1]);
+        first = 2;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "usage: %s [repeats] file.obj...\n", argv[0]);
+        return 1;
+    }
+
+    printf("number parser: %s\n\n", TINYOBJLOADER_NUMBER_PARSER);
+    printf("%-24s %9s %12s %12s %8s %10s %12s %12s\n", "file", "MB", "legacy MB/s",
+           "new MB/s", "speedup", "mismatch", "LoadObj MB/s", "mapped MB/s");
+
+    size_t total_bytes = 0, total_values = 0, total_bad = 0, total_bad_legacy = 0;
+    double total_legacy = 0.0, total_new = 0.0;
+    for (int i = first; i < argc; i++) {
+        std::string buf = readFile(argv[i]);
+        if (buf.empty()) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            continue;
+        }
+
+        const double mb = buf.size() / (1024.0 * 1024.0);
+        Result legacy = time<parseFloatLegacy, parseIntLegacy>(buf, repeats);
+        Result fast = time<parseFloatNew, parseIntNew>(buf, repeats);
+
+        size_t values = 0, legacy_values = 0;
+        size_t bad = countMismatches<parseFloatNew>(buf, &values);
+        total_bad_legacy += countMismatches<parseFloatLegacy>(buf, &legacy_values);
+
+        int load_repeats = std::max(1, repeats / 4);
+        double load = loadSeconds(argv[i], false, load_repeats);
+        double mapped = loadSeconds(argv[i], true, load_repeats);
+
+        const char *name = strrchr(argv[i], '/');
+        printf("%-24s %9.2f %12.1f %12.1f %7.2fx %5zu/%-4zu %12.1f %12.1f\n",
+               name ? name + 1 : argv[i], mb, mb * repeats / legacy.seconds,
+               mb * repeats / fast.seconds, legacy.seconds / fast.seconds, bad, values,
+               mb / load, mb / mapped);
+
+        total_bytes += buf.size();
+        total_values += values;
+        total_bad += bad;
+        total_legacy += legacy.seconds;
+        total_new += fast.seconds;
+    }
+
+    const double mb = total_bytes / (1024.0 * 1024.0);
+    printf("\ntotal %.2f MB: legacy %.1f MB/s, new %.1f MB/s (%.2fx)\n", mb,
+           mb * repeats / total_legacy, mb * repeats / total_new, total_legacy / total_new);
+    printf("round-trip vs strtof: new %zu / %zu mismatches, legacy %zu / %zu\n", total_bad,
+           total_values, total_bad_legacy, total_values);
+    return total_bad == 0 ? 0 : 1;
+}
@@ -11,18 +11,40 @@ uniform sampler2D u_diffuseTex;
 uniform sampler2D u_specularTex;
 uniform sampler2D u_specularHighTex;
 
+// Textures of meshes packed into texture arrays (TextureAtlas), selected by
+// the material's textureSlots
+uniform bool u_useTextureArrays;
+uniform sampler2DArray u_textureArrays[12];
+
 // Constants
 const int num_lights = 5;
+const int materials_per_range = 256;
 
 // Outputs
 out vec4 fragColor;
 
-// Uniforms
-uniform vec4 light_posn[num_lights];
-uniform vec4 light_col[num_lights];
+// Lights, shared by all programs (UniformBlocks)
+struct Light {
+    vec4 position;
+    vec4 color;     // a: 0 for off
+};
+
+layout (std140) uniform Lights {
+    Light lights[num_lights];
+};
+
+// The range of the mesh's material table holding the current material
+struct MaterialData {
+    vec4 ambient;       // w: shininess
+    ivec4 textureSlots; // One per texture type, array << 16 | layer, or -1 if the material has none
+};
+
+layout (std140) uniform Materials {
+    MaterialData materials[materials_per_range];
+};
 
-uniform vec3 ambient;
-uniform float shininess;
+// Into materials[]
+uniform int u_material;
 
 // Compute Phong Lighting
 vec4 compute_lighting(vec3 direction, vec4 lightcolor, vec3 normal, vec3 halfvec, vec4 mydiffuse, vec4 myspecular, float myshininess, float distance) {
@@ -39,13 +61,31 @@ vec4 compute_lighting(vec3 direction, vec4 lightcolor, vec3 normal, vec3 halfvec
     return vec4(lambert + phong, lightcolor.a);
 }
 
+vec4 sample_slot(int slot) {
+    // What an unbound sampler2D returns
+    if (slot < 0) return vec4(0.0, 0.0, 0.0, 1.0);
+    return texture(u_textureArrays[slot >> 16], vec3(m_texcoord, float(slot & 0xFFFF)));
+}
+
 void main() {
 
+    MaterialData material = materials[u_material];
+    vec3 ambient = material.ambient.xyz;
+    float shininess = material.ambient.w;
+
     // Sample textures
-    vec4 ambientColor = texture(u_ambientTex, m_texcoord);
-    vec4 diffuseColor = texture(u_diffuseTex, m_texcoord);
-    vec4 specularColor = texture(u_specularTex, m_texcoord);
-    vec4 specularHighlight = texture(u_specularHighTex, m_texcoord);
+    vec4 ambientColor, diffuseColor, specularColor, specularHighlight;
+    if (u_useTextureArrays) {
+        ambientColor = sample_slot(material.textureSlots.x);
+        diffuseColor = sample_slot(material.textureSlots.y);
+        specularColor = sample_slot(material.textureSlots.z);
+        specularHighlight = sample_slot(material.textureSlots.w);
+    } else {
+        ambientColor = texture(u_ambientTex, m_texcoord);
+        diffuseColor = texture(u_diffuseTex, m_texcoord);
+        specularColor = texture(u_specularTex, m_texcoord);
+        specularHighlight = texture(u_specularHighTex, m_texcoord);
+    }
 
     float ambient_light = 0.5;
     // Start with ambient color
@@ -60,13 +100,13 @@ void main() {
 
     // Loop through light sources
     for (int i = 0; i < num_lights; i++) {
-        vec3 position = light_posn[i].xyz;
+        vec3 position = lights[i].position.xyz;
         vec3 direction = normalize(position - mypos);
         float distance = length(position - mypos); // Calculate light distance
         vec3 half_i = normalize(direction + eyedirn);
         vec4 scaledSpecular = specularColor * specularHighlight.rgba;
-        if (light_col[i].a > 0.001) {
-            vec4 col = compute_lighting(direction, light_col[i], normal, half_i, diffuseColor, scaledSpecular, shininess, distance);
+        if (lights[i].color.a > 0.001) {
+            vec4 col = compute_lighting(direction, lights[i].color, normal, half_i, diffuseColor, scaledSpecular, shininess, distance);
             finalColor += col;
         }
     }
@@ -0,0 +1,86 @@
+#version 430 core
+
+// Inputs from the vertex shader
+in vec3 m_normal;
+in vec4 m_vertex;
+in vec2 m_texcoord;
+flat in vec4 m_material;        // xyz: ambient, w: shininess
+flat in ivec4 m_textureSlots;
+
+// Textures of all batched meshes, packed into texture arrays (TextureAtlas):
+// one slot per texture type, holding array << 16 | layer, or -1 if the
+// material has none. Meshes with other textures are not batched
+uniform sampler2DArray u_textureArrays[12];
+
+// Constants
+const int num_lights = 5;
+
+// Outputs
+out vec4 fragColor;
+
+// Lights, shared by all programs (UniformBlocks)
+struct Light {
+    vec4 position;
+    vec4 color;     // a: 0 for off
+};
+
+layout (std140) uniform Lights {
+    Light lights[num_lights];
+};
+
+// Compute Phong Lighting
+vec4 compute_lighting(vec3 direction, vec4 lightcolor, vec3 normal, vec3 halfvec, vec4 mydiffuse, vec4 myspecular, float myshininess, float distance) {
+    distance = distance / 100.0; // Scale distance for attenuation
+    float attenuation = 1.0 / (1.0 + distance + 0.02 * distance * distance);
+
+    vec3 corrected_light = lightcolor.rgb * attenuation; // Apply attenuation
+    float n_dot_l = max(dot(normal, direction), 0.0);
+    vec3 lambert = mydiffuse.rgb * corrected_light * n_dot_l;
+
+    float n_dot_h = max(dot(normal, halfvec), 0.0);
+    vec3 phong = myspecular.rgb * corrected_light * pow(n_dot_h, myshininess);
+
+    return vec4(lambert + phong, lightcolor.a);
+}
+
+vec4 sample_slot(int slot) {
+    // What an unbound sampler2D returns
+    if (slot < 0) return vec4(0.0, 0.0, 0.0, 1.0);
+    return texture(u_textureArrays[slot >> 16], vec3(m_texcoord, float(slot & 0xFFFF)));
+}
+
+void main() {
+
+    // Sample textures
+    vec4 ambientColor = sample_slot(m_textureSlots.x);
+    vec4 diffuseColor = sample_slot(m_textureSlots.y);
+    vec4 specularColor = sample_slot(m_textureSlots.z);
+    vec4 specularHighlight = sample_slot(m_textureSlots.w);
+    vec3 ambient = m_material.xyz;
+    float shininess = m_material.w;
+
+    float ambient_light = 0.5;
+    // Start with ambient color
+    vec4 finalColor = vec4((ambient * ambientColor.xyz) * ambient_light, 1.0);
+
+    // Normalize normal
+    vec3 normal = normalize(m_normal);
+
+    // Eye position is at (0,0,0) in eye space
+    vec3 mypos = m_vertex.xyz;  // No need for division by w
+    vec3 eyedirn = normalize(-mypos);
+
+    // Loop through light sources
+    for (int i = 0; i < num_lights; i++) {
+        vec3 position = lights[i].position.xyz;
+        vec3 direction = normalize(position - mypos);
+        float distance = length(position - mypos); // Calculate light distance
+        vec3 half_i = normalize(direction + eyedirn);
+        vec4 scaledSpecular = specularColor * specularHighlight.rgba;
+        if (lights[i].color.a > 0.001) {
+            vec4 col = compute_lighting(direction, lights[i].color, normal, half_i, diffuseColor, scaledSpecular, shininess, distance);
+            finalColor += col;
+        }
+    }
+    fragColor = finalColor;
+}
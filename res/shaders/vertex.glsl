@@ -5,17 +5,42 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texcoord;
 
-// Uniform (Matrix)
-uniform mat4 uMVP;
+// Model transform of the instance (Mesh::set_instances), the identity when not instanced
+layout (location = 3) in mat4 instanceModel;
+
+// Camera matrices, shared by all programs (UniformBlocks)
+layout (std140) uniform Camera {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+};
+
+// Transform of the mesh, before the instance's
+uniform mat4 uModel;
+
+// Quantized vertices: position = u_posOffset + u_posScale * position,
+// normal.xy holds an octahedral encoded normal
+uniform vec3 u_posOffset;
+uniform vec3 u_posScale;
+uniform bool u_octNormals;
 
 // Outputs for the fragment shader
 out vec3 m_normal;
 out vec4 m_vertex;
 out vec2 m_texcoord;
 
+vec3 oct_decode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
 void main() {
-	gl_Position = uMVP * vec4(position, 1.0);
-	m_normal = normal;
-	m_vertex = vec4(position, 1.0);
+	vec4 pos = instanceModel * vec4(u_posOffset + u_posScale * position, 1.0);
+	gl_Position = viewProjection * uModel * pos;
+	m_normal = mat3(instanceModel) * (u_octNormals ? oct_decode(normal.xy) : normal);
+	m_vertex = pos;
 	m_texcoord = texcoord;
 }
@@ -0,0 +1,61 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
+
+// Vertex attributes from the batch's VBO
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec2 texcoord;
+
+// Model transform of the instance, from the draw's base instance on
+layout (location = 3) in mat4 instanceModel;
+
+// Per-draw state of the multi-draw call (MultiDrawData), indexed by gl_DrawIDARB
+struct DrawData {
+	vec4 posOffset;     // xyz
+	vec4 posScale;      // xyz, w: octahedral normals
+	vec4 material;      // xyz: ambient, w: shininess
+	ivec4 textureSlots;
+	uvec4 mesh;         // x: into meshModel
+};
+
+layout (std430, binding = 0) readonly buffer Draws {
+	DrawData draws[];
+};
+
+// Camera matrices, shared by all programs (UniformBlocks)
+layout (std140) uniform Camera {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+};
+
+// uModel of each mesh
+layout (std430, binding = 1) readonly buffer Meshes {
+	mat4 meshModel[];
+};
+
+// Outputs for the fragment shader
+out vec3 m_normal;
+out vec4 m_vertex;
+out vec2 m_texcoord;
+flat out vec4 m_material;
+flat out ivec4 m_textureSlots;
+
+vec3 oct_decode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
+void main() {
+	DrawData draw = draws[gl_DrawIDARB];
+	vec4 pos = instanceModel * vec4(draw.posOffset.xyz + draw.posScale.xyz * position, 1.0);
+	gl_Position = viewProjection * meshModel[draw.mesh.x] * pos;
+	m_normal = mat3(instanceModel) * (draw.posScale.w > 0.5 ? oct_decode(normal.xy) : normal);
+	m_vertex = pos;
+	m_texcoord = texcoord;
+	m_material = draw.material;
+	m_textureSlots = draw.textureSlots;
+}
@@ -0,0 +1,182 @@
+#include "atlas.h"
+#include "glstate.h"
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <stb_image_resize2.h>
+#include <algorithm>
+#include <compare>
+#include <format>
+#include <iostream>
+
+namespace {
+
+// Textures can share an array when all of this matches
+struct LayerFormat {
+    GLenum compressedFormat;
+    int comp;                 // 0 for compressed textures: their format decides
+    int width;
+    int height;
+    size_t mips;
+
+    auto operator<=>(const LayerFormat&) const = default;
+};
+
+LayerFormat layer_format(const CpuTexture& t) {
+    return {t.compressedFormat, t.compressed() ? 0 : t.comp, t.width, t.height, t.mipSizes.size()};
+}
+
+void resize(CpuTexture& t, int width, int height) {
+    const stbir_pixel_layout layouts[] = {STBIR_1CHANNEL, STBIR_2CHANNEL, STBIR_RGB, STBIR_RGBA};
+    std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * t.comp);
+    stbir_resize_uint8_linear(t.pixels.data(), t.width, t.height, 0,
+                              pixels.data(), width, height, 0, layouts[t.comp - 1]);
+    std::cout << std::format("Resampled texture \"{}\" from {}x{} to {}x{} for its texture array\n",
+                             t.name, t.width, t.height, width, height);
+    t.pixels = std::move(pixels);
+    t.width = width;
+    t.height = height;
+}
+
+}
+
+bool TextureAtlas::pack(CpuMesh& mesh, bool resample) {
+    std::vector<LayerFormat> formats;
+    std::vector<CpuTextureArray> arrays;
+    for (uint32_t i = 0; i < mesh.textures.size(); i++) {
+        LayerFormat format = layer_format(mesh.textures[i]);
+        auto it = std::ranges::find(formats, format);
+        if (it == formats.end()) {
+            formats.push_back(format);
+            arrays.emplace_back();
+            it = formats.end() - 1;
+        }
+        arrays[it - formats.begin()].layers.push_back(i);
+    }
+
+    // A lone uncompressed layer joins the largest array of the same channel
+    // count. Only planned here, the textures are resized once packing succeeds
+    std::vector<std::pair<uint32_t, size_t>> moves;   // Texture, array
+    if (resample) {
+        for (size_t a = 0; a < arrays.size(); a++) {
+            if (arrays[a].layers.size() != 1 || formats[a].compressedFormat != 0) continue;
+
+            size_t target = a;
+            for (size_t b = 0; b < arrays.size(); b++) {
+                if (formats[b].compressedFormat != 0 || formats[b].comp != formats[a].comp) continue;
+                if (arrays[b].layers.size() < 2) continue;
+                if (target == a || arrays[b].layers.size() > arrays[target].layers.size()) target = b;
+            }
+            if (target != a) moves.emplace_back(arrays[a].layers[0], target);
+        }
+    }
+
+    if (arrays.size() - moves.size() > static_cast<size_t>(max_arrays)) {
+        std::cout << std::format("{} texture formats and sizes need more than {} texture arrays, "
+                                 "textures are bound per material\n", arrays.size() - moves.size(), max_arrays);
+        return false;
+    }
+
+    for (auto [texture, target] : moves) {
+        resize(mesh.textures[texture], formats[target].width, formats[target].height);
+        arrays[target].layers.push_back(texture);
+    }
+    std::erase_if(arrays, [&](const CpuTextureArray& array) {
+        return std::ranges::any_of(moves, [&](const auto& move) { return array.layers[0] == move.first; });
+    });
+
+    // Point the materials at their layers
+    std::unordered_map<std::string, int> slots;
+    for (size_t a = 0; a < arrays.size(); a++) {
+        for (size_t l = 0; l < arrays[a].layers.size(); l++) {
+            slots[mesh.textures[arrays[a].layers[l]].name] = slot(static_cast<int>(a), static_cast<int>(l));
+        }
+    }
+    assign_slots(mesh.materials, slots);
+
+    mesh.textureArrays = std::move(arrays);
+    mesh.textureSlots = std::move(slots);
+    return true;
+}
+
+void TextureAtlas::assign_slots(std::vector<Material>& materials, const std::unordered_map<std::string, int>& slots) {
+    for (Material& m : materials) {
+        const std::string* names[] = {&m.texNames.ambient_texname, &m.texNames.diffuse_texname,
+                                      &m.texNames.specular_texname, &m.texNames.specular_highlight_texname};
+        for (int i = 0; i < 4; i++) {
+            auto it = slots.find(*names[i]);
+            m.textureSlots[i] = (names[i]->empty() || it == slots.end()) ? -1 : it->second;
+        }
+    }
+}
+
+GLuint TextureAtlas::upload(const CpuMesh& mesh, const CpuTextureArray& array, bool fill) {
+    const CpuTexture& first = mesh.textures[array.layers[0]];
+    GLsizei layers = static_cast<GLsizei>(array.layers.size());
+
+    GLuint texture_id;
+    glGenTextures(1, &texture_id);
+    GLState::bind_texture(GL_TEXTURE_2D_ARRAY, texture_id);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Storage of all layers (and the cached mips of compressed ones)
+    if (first.compressed()) {
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(first.mipSizes.size()) - 1);
+        for (size_t level = 0; level < first.mipSizes.size(); level++) {
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level), first.compressedFormat,
+                                   std::max(1, first.width >> level), std::max(1, first.height >> level), layers, 0,
+                                   static_cast<GLsizei>(first.mipSizes[level] * layers), nullptr);
+        }
+    } else {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, first.format(), first.width, first.height, layers, 0,
+                     first.format(), GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    if (fill) {
+        // All layers are staged back to back in one pixel unpack buffer, and
+        // the sub-image calls source them from it by offset
+        size_t layer_bytes = first.pixels.size();
+        GLuint pbo;
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, layer_bytes * layers, nullptr, GL_STREAM_DRAW);
+        for (GLsizei l = 0; l < layers; l++) {
+            glBufferSubData(GL_PIXEL_UNPACK_BUFFER, l * layer_bytes, layer_bytes,
+                            mesh.textures[array.layers[l]].pixels.data());
+        }
+
+        if (first.compressed()) {
+            for (GLsizei l = 0; l < layers; l++) {
+                size_t offset = l * layer_bytes;
+                for (size_t level = 0; level < first.mipSizes.size(); level++) {
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level), 0, 0, l,
+                                              std::max(1, first.width >> level), std::max(1, first.height >> level), 1,
+                                              first.compressedFormat, static_cast<GLsizei>(first.mipSizes[level]),
+                                              reinterpret_cast<const void*>(offset));
+                    offset += first.mipSizes[level];
+                }
+            }
+        } else {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, first.width, first.height, layers,
+                            first.format(), GL_UNSIGNED_BYTE, nullptr);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+    }
+
+    GLState::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+    return texture_id;
+}
+
+void TextureAtlas::generate_mipmaps(const CpuMesh& mesh, const DataTex& data) {
+    for (size_t a = 0; a < mesh.textureArrays.size(); a++) {
+        if (mesh.textures[mesh.textureArrays[a].layers[0]].compressed()) continue;
+        GLState::bind_texture(GL_TEXTURE_2D_ARRAY, data.m_texture_arrays[a]);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+    GLState::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+}
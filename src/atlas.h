@@ -0,0 +1,34 @@
+#pragma once
+
+#include "mesh.h"
+
+// Packs the textures of a mesh into GL_TEXTURE_2D_ARRAYs of same-sized,
+// same-format layers. Drawing then binds each array once and a material
+// only selects layers (Material::textureSlots) instead of binding textures
+class TextureAtlas {
+public:
+
+    // Groups `mesh.textures` into `mesh.textureArrays` and sets the slots of
+    // `mesh.materials` and `mesh.textureSlots`. With `resample`, an uncompressed texture whose size
+    // no other one shares is resized to the most common size of its format.
+    // Leaves the mesh unpacked and returns false if it needs more than `max_arrays` arrays
+    static bool pack(CpuMesh& mesh, bool resample);
+
+    // Points the textures of `materials` at their slot in `slots`, by name
+    static void assign_slots(std::vector<Material>& materials, const std::unordered_map<std::string, int>& slots);
+
+    // Creates the array texture, only allocating its storage unless `fill`. GL thread only
+    static GLuint upload(const CpuMesh& mesh, const CpuTextureArray& array, bool fill);
+
+    // Builds the mip chains of the uncompressed arrays, once all their layers are filled
+    static void generate_mipmaps(const CpuMesh& mesh, const DataTex& data);
+
+    static int slot(int array, int layer) {
+        return array << 16 | layer;
+    }
+
+    // Units 0-3 hold the per-material textures of unpacked meshes, the arrays
+    // follow (u_textureArrays in fragment.glsl)
+    static constexpr int first_unit = 4;
+    static constexpr int max_arrays = 12;
+};
@@ -0,0 +1,549 @@
+#include "bvh.h"
+
+#include <imgui.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+bool BVH::enabled = true;
+bool BVH::cache_enabled = true;
+std::filesystem::path BVH::directory = "../cache/bvh";
+std::atomic<size_t> BVH::built{0};
+std::atomic<size_t> BVH::loaded{0};
+float BVH::last_query_ms = 0.0f;
+
+namespace {
+
+const char ENTRY_MAGIC[4] = {'V', 'B', 'H', '1'};
+const uint32_t ENTRY_VERSION = 1;
+
+// Followed by the positions, triangles and nodes
+struct EntryHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t positionCount;
+    uint64_t triangleCount;
+    uint64_t nodeCount;
+};
+
+constexpr int bin_count = 16;
+constexpr uint32_t max_leaf = 8;                // Larger nodes are always split
+constexpr uint32_t parallel_threshold = 1 << 15; // Smaller subtrees are built on the thread that reached them
+constexpr float traversal_cost = 1.0f;          // Relative to testing a triangle
+constexpr int max_sah_depth = 96;               // Deeper nodes are halved, so trees stay under stack_size levels
+constexpr int stack_size = 128;
+
+struct Box {
+    glm::vec3 lo = glm::vec3(FLT_MAX);
+    glm::vec3 hi = glm::vec3(-FLT_MAX);
+
+    void grow(const glm::vec3& p) {
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    void grow(const Box& b) {
+        lo = glm::min(lo, b.lo);
+        hi = glm::max(hi, b.hi);
+    }
+    // Half the surface area, all SAH needs
+    float area() const {
+        glm::vec3 e = glm::max(hi - lo, glm::vec3(0.0f));
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+// A triangle's box, moved around with it while the tree is split
+struct PrimRef {
+    Box box;
+    uint32_t triangle;
+
+    glm::vec3 centroid() const {
+        return 0.5f * (box.lo + box.hi);
+    }
+};
+
+// The triangles whose centroids fall into one bin of one axis
+struct Bin {
+    Box bounds;
+    uint32_t count = 0;
+};
+
+// Splits nodes top-down over `refs`, the triangles in leaf order once done.
+// Children are allocated in pairs from `next_node`, so threads building
+// different subtrees never write the same node
+struct Builder {
+    std::vector<PrimRef>& refs;
+    std::vector<BVHNode>& nodes;
+    std::atomic<uint32_t>& next_node;
+    std::atomic<int>& spare_threads;
+
+    void bounds_of(uint32_t begin, uint32_t end, Box& bounds, Box& centroids) const {
+        for (uint32_t i = begin; i < end; i++) {
+            bounds.grow(refs[i].box);
+            centroids.grow(refs[i].centroid());
+        }
+    }
+
+    void build(uint32_t node, uint32_t begin, uint32_t end, const Box& bounds, const Box& centroids, int depth) {
+        BVHNode& n = nodes[node];
+        n.bmin = bounds.lo;
+        n.bmax = bounds.hi;
+        n.first = begin;
+        n.count = end - begin;
+        if (n.count <= 1) return;
+
+        // The triangles binned by their centroids along all three axes in one
+        // pass, then the cheapest split between two bins
+        glm::vec3 extent = centroids.hi - centroids.lo;
+        int best_axis = -1;
+        int best_bin = 0;
+        float best_cost = FLT_MAX;
+        Bin bins[3][bin_count];
+        glm::vec3 scale;
+        for (int axis = 0; axis < 3; axis++) {
+            scale[axis] = extent[axis] > 0.0f ? bin_count / extent[axis] : 0.0f;
+        }
+        if (depth < max_sah_depth) {
+            for (uint32_t i = begin; i < end; i++) {
+                glm::vec3 c = refs[i].centroid();
+                for (int axis = 0; axis < 3; axis++) {
+                    Bin& bin = bins[axis][bin_index(c[axis], centroids.lo[axis], scale[axis])];
+                    bin.bounds.grow(refs[i].box);
+                    bin.count++;
+                }
+            }
+        }
+        for (int axis = 0; axis < 3 && depth < max_sah_depth; axis++) {
+            if (extent[axis] <= 0.0f) continue;
+
+            // Areas and counts left of each boundary, then the right side swept back
+            float left_area[bin_count - 1];
+            uint32_t left_count[bin_count - 1];
+            Box left;
+            uint32_t count = 0;
+            for (int b = 0; b < bin_count - 1; b++) {
+                left.grow(bins[axis][b].bounds);
+                count += bins[axis][b].count;
+                left_area[b] = left.area();
+                left_count[b] = count;
+            }
+            Box right;
+            count = 0;
+            for (int b = bin_count - 1; b > 0; b--) {
+                right.grow(bins[axis][b].bounds);
+                count += bins[axis][b].count;
+                if (left_count[b - 1] == 0 || count == 0) continue;
+                float cost = left_area[b - 1] * left_count[b - 1] + right.area() * count;
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        // A leaf unless splitting is cheaper, or it would be too large
+        uint32_t mid;
+        Box left_bounds, left_centroids, right_bounds, right_centroids;
+        if (best_axis >= 0) {
+            float area = bounds.area();
+            float split_cost = traversal_cost + (area > 0.0f ? best_cost / area : 0.0f);
+            if (split_cost >= n.count && n.count <= max_leaf) return;
+
+            // Partitioned in place, gathering the centroid bounds of both sides on the way
+            float lo = centroids.lo[best_axis];
+            float axis_scale = scale[best_axis];
+            uint32_t i = begin, j = end;
+            while (i < j) {
+                glm::vec3 c = refs[i].centroid();
+                if (bin_index(c[best_axis], lo, axis_scale) < best_bin) {
+                    left_centroids.grow(c);
+                    i++;
+                } else {
+                    right_centroids.grow(c);
+                    std::swap(refs[i], refs[--j]);
+                }
+            }
+            mid = i;
+            for (int b = 0; b < bin_count; b++) {
+                (b < best_bin ? left_bounds : right_bounds).grow(bins[best_axis][b].bounds);
+            }
+        } else {
+            // Halves along the longest axis: the centroids all coincide, or
+            // the tree is too deep to follow the SAH any further
+            if (n.count <= max_leaf) return;
+            int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+            mid = begin + n.count / 2;
+            std::nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+                             [&](const PrimRef& a, const PrimRef& b) { return a.centroid()[axis] < b.centroid()[axis]; });
+            bounds_of(begin, mid, left_bounds, left_centroids);
+            bounds_of(mid, end, right_bounds, right_centroids);
+        }
+
+        uint32_t child = next_node.fetch_add(2);
+        n.first = child;
+        n.count = 0;
+
+        // Large subtrees go to another thread while there are any to spare
+        auto build_left = [&]() { build(child, begin, mid, left_bounds, left_centroids, depth + 1); };
+        if (end - begin >= parallel_threshold && spare_threads.fetch_sub(1) > 0) {
+            std::thread left(build_left);
+            build(child + 1, mid, end, right_bounds, right_centroids, depth + 1);
+            left.join();
+            spare_threads++;
+        } else {
+            if (end - begin >= parallel_threshold) spare_threads++;
+            build_left();
+            build(child + 1, mid, end, right_bounds, right_centroids, depth + 1);
+        }
+    }
+
+    // Clamped, as rounding may put the largest centroid past the last bin
+    static int bin_index(float c, float lo, float scale) {
+        float bin = (c - lo) * scale;
+        return bin >= bin_count - 1 ? bin_count - 1 : (bin > 0.0f ? static_cast<int>(bin) : 0);
+    }
+};
+
+// Distance along the ray to the box, FLT_MAX if it misses it within (0, t)
+float intersect_box(const glm::vec3& bmin, const glm::vec3& bmax, const glm::vec3& origin,
+                    const glm::vec3& inv_direction, float t) {
+    glm::vec3 t0 = (bmin - origin) * inv_direction;
+    glm::vec3 t1 = (bmax - origin) * inv_direction;
+    glm::vec3 near = glm::min(t0, t1);
+    glm::vec3 far = glm::max(t0, t1);
+    float enter = std::max({near.x, near.y, near.z, 0.0f});
+    float exit = std::min({far.x, far.y, far.z, t});
+    return enter <= exit ? enter : FLT_MAX;
+}
+
+// Möller-Trumbore, both sides
+bool intersect_triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& origin,
+                        const glm::vec3& direction, float& t) {
+    glm::vec3 e1 = b - a;
+    glm::vec3 e2 = c - a;
+    glm::vec3 p = glm::cross(direction, e2);
+    float det = glm::dot(e1, p);
+    if (std::abs(det) < 1e-20f) return false;
+    float inv_det = 1.0f / det;
+    glm::vec3 s = origin - a;
+    float u = glm::dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f) return false;
+    glm::vec3 q = glm::cross(s, e1);
+    float v = glm::dot(direction, q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) return false;
+    float hit = glm::dot(e2, q) * inv_det;
+    if (hit <= 0.0f || hit >= t) return false;
+    t = hit;
+    return true;
+}
+
+}
+
+TriangleBVH BVH::build(const CpuDrawObject& o, std::atomic<int>& spare_threads) {
+    TriangleBVH bvh;
+    size_t vertex_count = o.numVertices();
+    bvh.positions.resize(vertex_count);
+    for (size_t i = 0; i < vertex_count; i++) {
+        if (o.vertexFormat == VertexFormat::Quantized) {
+            bvh.positions[i] = Quantize::decode_position(o.packed[i], o.posOffset, o.posOffset + o.posScale);
+        } else {
+            bvh.positions[i] = glm::vec3(o.vertices[i * 8], o.vertices[i * 8 + 1], o.vertices[i * 8 + 2]);
+        }
+    }
+
+    size_t triangle_count = o.index_count() / 3;
+    if (triangle_count == 0) return bvh;
+    std::vector<glm::uvec3> triangles(triangle_count);
+    std::vector<PrimRef> refs(triangle_count);
+    Box bounds, centroids;
+    for (size_t i = 0; i < triangle_count; i++) {
+        PrimRef& r = refs[i];
+        for (int k = 0; k < 3; k++) {
+            triangles[i][k] = o.shortIndices.empty() ? o.indices[3 * i + k] : o.shortIndices[3 * i + k];
+            r.box.grow(bvh.positions[triangles[i][k]]);
+        }
+        r.triangle = static_cast<uint32_t>(i);
+        bounds.grow(r.box);
+        centroids.grow(r.centroid());
+    }
+
+    bvh.nodes.resize(2 * triangle_count - 1);
+    std::atomic<uint32_t> next_node{1};
+    Builder{refs, bvh.nodes, next_node, spare_threads}.build(0, 0, static_cast<uint32_t>(triangle_count),
+                                                              bounds, centroids, 0);
+    bvh.nodes.resize(next_node);
+    bvh.nodes.shrink_to_fit();
+
+    bvh.triangles.resize(triangle_count);
+    for (size_t i = 0; i < triangle_count; i++) {
+        bvh.triangles[i] = triangles[refs[i].triangle];
+    }
+    return bvh;
+}
+
+void BVH::prepare(CpuMesh& mesh, const LoadOptions& options, LoadProgress* progress) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Largest objects first, so the small ones fill in around them
+    std::vector<size_t> order;
+    for (size_t i = 0; i < mesh.objects.size(); i++) {
+        if (mesh.objects[i].index_count() > 0) order.push_back(i);
+    }
+    std::ranges::sort(order, std::greater<>(), [&](size_t i) { return mesh.objects[i].index_count(); });
+
+    // One worker per core takes objects in turn, and those that finish early
+    // lend their thread to the subtrees of the large ones still building
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<int> spare_threads{0};
+    std::atomic<size_t> next_object{0};
+    std::atomic<size_t> from_cache{0};
+    auto worker = [&]() {
+        for (size_t i = next_object++; i < order.size(); i = next_object++) {
+            if (progress && progress->cancel) break;
+            CpuDrawObject& o = mesh.objects[order[i]];
+            auto bvh = std::make_shared<TriangleBVH>();
+            if (options.bvh_cache && load(o, *bvh)) {
+                from_cache++;
+            } else {
+                *bvh = build(o, spare_threads);
+                if (options.bvh_cache && !store(o.key, *bvh)) {
+                    std::cerr << "Unable to write BVH cache entry: " << entry_path(o.key) << "\n";
+                }
+            }
+            o.bvh = std::move(bvh);
+        }
+        spare_threads++;
+    };
+
+    size_t workers = std::min<size_t>(threads, order.size());
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < workers; i++) {
+        pool.emplace_back(worker);
+    }
+    if (!order.empty()) worker();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+    if (progress && progress->cancel) return;
+
+    size_t triangles = 0, nodes = 0;
+    for (const CpuDrawObject& o : mesh.objects) {
+        if (!o.bvh) continue;
+        triangles += o.bvh->triangles.size();
+        nodes += o.bvh->nodes.size();
+    }
+    built += order.size() - from_cache;
+    loaded += from_cache;
+    float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::format("BVHs of {} triangles: {} nodes, {} built, {} from the cache in {:.1f} ms\n",
+                             triangles, nodes, order.size() - from_cache, from_cache.load(), ms);
+}
+
+bool BVH::intersect(const TriangleBVH& bvh, const glm::vec3& origin, const glm::vec3& direction,
+                    float& t, uint32_t& triangle) {
+    if (bvh.nodes.empty()) return false;
+    glm::vec3 inv_direction = 1.0f / direction;
+    bool hit = false;
+
+    // Nearer child first, the other pushed with its distance so it can be
+    // skipped once something closer was hit
+    struct Entry {
+        uint32_t node;
+        float distance;
+    };
+    Entry stack[stack_size];
+    int size = 0;
+    float root = intersect_box(bvh.nodes[0].bmin, bvh.nodes[0].bmax, origin, inv_direction, t);
+    if (root == FLT_MAX) return false;
+    stack[size++] = {0, root};
+    while (size > 0) {
+        Entry e = stack[--size];
+        if (e.distance >= t) continue;
+        const BVHNode& n = bvh.nodes[e.node];
+        if (n.count > 0) {
+            for (uint32_t i = n.first; i < n.first + n.count; i++) {
+                const glm::uvec3& tri = bvh.triangles[i];
+                if (intersect_triangle(bvh.positions[tri.x], bvh.positions[tri.y], bvh.positions[tri.z],
+                                       origin, direction, t)) {
+                    triangle = i;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        uint32_t near_child = n.first, far_child = n.first + 1;
+        float near = intersect_box(bvh.nodes[near_child].bmin, bvh.nodes[near_child].bmax, origin, inv_direction, t);
+        float far = intersect_box(bvh.nodes[far_child].bmin, bvh.nodes[far_child].bmax, origin, inv_direction, t);
+        if (far < near) {
+            std::swap(near, far);
+            std::swap(near_child, far_child);
+        }
+        if (far != FLT_MAX) stack[size++] = {far_child, far};
+        if (near != FLT_MAX) stack[size++] = {near_child, near};
+    }
+    return hit;
+}
+
+RayHit BVH::raycast(const std::vector<DataTex>& meshes, const std::vector<glm::mat4>& models,
+                    const glm::vec3& origin, const glm::vec3& direction) {
+    auto start = std::chrono::steady_clock::now();
+    RayHit hit;
+    for (size_t m = 0; m < meshes.size() && m < models.size(); m++) {
+        const DataTex& data = meshes[m];
+        glm::mat4 inverse_model = glm::inverse(models[m]);
+        glm::vec3 mesh_origin = glm::vec3(inverse_model * glm::vec4(origin, 1.0f));
+        glm::vec3 mesh_direction = glm::vec3(inverse_model * glm::vec4(direction, 0.0f));
+
+        // The culling boxes cover all instances of an object, so most objects
+        // are passed over without looking at their instances
+        glm::vec3 inv_mesh_direction = 1.0f / mesh_direction;
+        const ObjectBounds& bounds = data.m_bounds;
+        bool boxes = bounds.instancesVersion == data.m_instances.version &&
+                     bounds.visible.size() == data.m_draw_objects.size();
+        std::vector<GLsizei> counts;
+        std::vector<glm::mat4> transforms = Mesh::instance_transforms(data, counts);
+        size_t first = 0;
+        for (size_t i = 0; i < data.m_draw_objects.size(); i++) {
+            const DrawObject& o = data.m_draw_objects[i];
+            size_t instances = counts.empty() ? 0 : static_cast<size_t>(counts[i]);
+            size_t next = first + instances;
+            if (!o.bvh || (boxes && intersect_box({bounds.minX[i], bounds.minY[i], bounds.minZ[i]},
+                                                  {bounds.maxX[i], bounds.maxY[i], bounds.maxZ[i]},
+                                                  mesh_origin, inv_mesh_direction, hit.t) == FLT_MAX)) {
+                first = next;
+                continue;
+            }
+
+            // The ray in the object's space at each instance: t is the same in all of them
+            for (size_t k = 0; k < std::max<size_t>(instances, 1); k++) {
+                glm::mat4 transform = instances == 0 ? glm::mat4(1.0f) : transforms[first + k];
+                glm::mat4 inverse = glm::inverse(transform);
+                glm::vec3 object_origin = glm::vec3(inverse * glm::vec4(mesh_origin, 1.0f));
+                glm::vec3 object_direction = glm::vec3(inverse * glm::vec4(mesh_direction, 0.0f));
+                uint32_t triangle;
+                if (!intersect(*o.bvh, object_origin, object_direction, hit.t, triangle)) continue;
+
+                const glm::uvec3& tri = o.bvh->triangles[triangle];
+                const std::vector<glm::vec3>& p = o.bvh->positions;
+                glm::vec3 normal = glm::cross(p[tri.y] - p[tri.x], p[tri.z] - p[tri.x]);
+                glm::mat4 to_world = models[m] * transform;
+                hit.mesh = m;
+                hit.object = i;
+                hit.instance = k;
+                hit.triangle = triangle;
+                hit.point = origin + hit.t * direction;
+                hit.meshPoint = mesh_origin + hit.t * mesh_direction;
+                hit.normal = glm::normalize(glm::vec3(glm::transpose(glm::inverse(to_world)) * glm::vec4(normal, 0.0f)));
+            }
+            first = next;
+        }
+    }
+    last_query_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return hit;
+}
+
+std::filesystem::path BVH::entry_path(uint64_t key) {
+    return directory / std::format("{:016x}.bvh", key);
+}
+
+bool BVH::load(const CpuDrawObject& o, TriangleBVH& bvh) {
+    std::ifstream in(entry_path(o.key), std::ios::binary);
+    if (!in) return false;
+
+    // The key hashes the geometry itself, so an entry never goes stale. Its
+    // counts must still match the object before anything is allocated, as a
+    // damaged or colliding entry could otherwise ask for any size
+    EntryHeader header;
+    size_t triangle_count = o.index_count() / 3;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) != 0 || header.version != ENTRY_VERSION ||
+        header.key != o.key || header.positionCount != o.numVertices() || header.triangleCount != triangle_count ||
+        triangle_count == 0 || header.nodeCount == 0 || header.nodeCount > 2 * triangle_count - 1) {
+        return false;
+    }
+
+    TriangleBVH entry;
+    entry.positions.resize(header.positionCount);
+    entry.triangles.resize(header.triangleCount);
+    entry.nodes.resize(header.nodeCount);
+    if (!in.read(reinterpret_cast<char*>(entry.positions.data()), entry.positions.size() * sizeof(glm::vec3)) ||
+        !in.read(reinterpret_cast<char*>(entry.triangles.data()), entry.triangles.size() * sizeof(glm::uvec3)) ||
+        !in.read(reinterpret_cast<char*>(entry.nodes.data()), entry.nodes.size() * sizeof(BVHNode))) {
+        return false;
+    }
+
+    // Nor may it index outside itself...
+    for (const glm::uvec3& tri : entry.triangles) {
+        if (tri.x >= header.positionCount || tri.y >= header.positionCount || tri.z >= header.positionCount) {
+            return false;
+        }
+    }
+    // ...or overflow the traversal stack, which trees built here stay under
+    // through max_sah_depth. Children always follow their parent, which keeps
+    // traversal from looping and makes each node's depth final once reached
+    std::vector<int> depth(entry.nodes.size(), 0);
+    for (size_t i = 0; i < entry.nodes.size(); i++) {
+        const BVHNode& node = entry.nodes[i];
+        bool valid = node.count > 0 ? node.first <= triangle_count && node.count <= triangle_count - node.first
+                                    : node.first > i && node.first + size_t(1) < entry.nodes.size() &&
+                                      depth[i] + 1 < stack_size;
+        if (!valid) return false;
+        if (node.count == 0) {
+            depth[node.first] = std::max(depth[node.first], depth[i] + 1);
+            depth[node.first + 1] = std::max(depth[node.first + 1], depth[i] + 1);
+        }
+    }
+    bvh = std::move(entry);
+    return true;
+}
+
+bool BVH::store(uint64_t key, const TriangleBVH& bvh) {
+    EntryHeader header;
+    std::memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    header.version = ENTRY_VERSION;
+    header.key = key;
+    header.positionCount = bvh.positions.size();
+    header.triangleCount = bvh.triangles.size();
+    header.nodeCount = bvh.nodes.size();
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec) return false;
+
+    // Written under a temporary name and renamed, as TextureCache does
+    std::filesystem::path entry = entry_path(key);
+    std::filesystem::path temp = entry;
+    temp += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(bvh.positions.data()), bvh.positions.size() * sizeof(glm::vec3));
+        out.write(reinterpret_cast<const char*>(bvh.triangles.data()), bvh.triangles.size() * sizeof(glm::uvec3));
+        out.write(reinterpret_cast<const char*>(bvh.nodes.data()), bvh.nodes.size() * sizeof(BVHNode));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(temp, entry, ec);
+    if (ec) {
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+void BVH::draw_stats() {
+    ImGui::Checkbox("Build BVHs on load (picking)", &enabled);
+    ImGui::Checkbox("Cache BVHs on disk", &cache_enabled);
+    ImGui::Text("BVHs built %zu, from the cache %zu, last pick %.3f ms", built.load(), loaded.load(), last_query_ms);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <glm/glm.hpp>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Node of a TriangleBVH, two to a cache line
+struct BVHNode {
+    glm::vec3 bmin;
+    uint32_t first;     // Leaf: its first triangle. Inner: its left child, the right one follows it
+    glm::vec3 bmax;
+    uint32_t count;     // Triangles of a leaf, 0 for inner nodes
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode must be tightly packed");
+
+// Bounding volume hierarchy over the triangles of one draw object, in its
+// own space (before placements, instances and the model transform)
+struct TriangleBVH {
+    std::vector<BVHNode> nodes;         // nodes[0] is the root
+    std::vector<glm::vec3> positions;   // As drawn, decoded from quantized vertices
+    std::vector<glm::uvec3> triangles;  // Into `positions`, in the order of the leaves
+};
+
+// The closest surface a ray hits
+struct RayHit {
+    float t = FLT_MAX;          // At origin + t * direction, FLT_MAX for none
+    size_t mesh = 0;            // Into the meshes given to raycast()
+    size_t object = 0;          // Into DataTex::m_draw_objects
+    size_t instance = 0;        // The object's instance, as in Mesh::instance_transforms
+    uint32_t triangle = 0;      // Into TriangleBVH::triangles
+    glm::vec3 point;            // In world space
+    glm::vec3 meshPoint;        // In the units of the mesh's file, before its model transform
+    glm::vec3 normal;           // Of the triangle, in world space
+
+    bool hit() const {
+        return t < FLT_MAX;
+    }
+};
+
+// Builds the TriangleBVH of each draw object while a mesh is parsed, with
+// binned SAH splits and the subtrees of large objects built on their own
+// threads, and casts rays against them for picking. Trees are cached on disk
+// by the content hash of their object's geometry (CpuDrawObject::key)
+class BVH {
+public:
+
+    // Gives every draw object of `mesh` its tree, from the cache when it has
+    // it or else built and stored there. Reentrant, like Mesh::parse
+    static void prepare(CpuMesh& mesh, const LoadOptions& options, LoadProgress* progress = nullptr);
+
+    // The tree of one draw object, building subtrees on up to `spare_threads` more threads
+    static TriangleBVH build(const CpuDrawObject& o, std::atomic<int>& spare_threads);
+
+    // Closest triangle of `bvh` hit by the ray within (0, t), in the tree's
+    // space. Both sides count. Lowers `t` to the hit
+    static bool intersect(const TriangleBVH& bvh, const glm::vec3& origin, const glm::vec3& direction,
+                          float& t, uint32_t& triangle);
+
+    // Closest surface of `meshes` hit by the ray in world space, meshes[i]
+    // drawn with `models[i]` and at all of its instances
+    static RayHit raycast(const std::vector<DataTex>& meshes, const std::vector<glm::mat4>& models,
+                          const glm::vec3& origin, const glm::vec3& direction);
+
+    // Reads the cached tree of `o`, false if there is none or it does not
+    // fit the object's vertex and triangle counts...
+    static bool load(const CpuDrawObject& o, TriangleBVH& bvh);
+    // ...and writes the tree of geometry `key`
+    static bool store(uint64_t key, const TriangleBVH& bvh);
+    static std::filesystem::path entry_path(uint64_t key);
+
+    static void draw_stats();
+
+    // Build trees on load, and keep them in the cache
+    static bool enabled;
+    static bool cache_enabled;
+
+    static std::filesystem::path directory;
+
+    // Counters
+    static std::atomic<size_t> built;       // Trees built since startup...
+    static std::atomic<size_t> loaded;      // ...and read from the cache
+    static float last_query_ms;             // Duration of the last raycast()
+};
@@ -0,0 +1,167 @@
+#include "culling.h"
+
+#include <imgui.h>
+#include <algorithm>
+#include <array>
+#include <cfloat>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+bool FrustumCuller::enabled = true;
+size_t FrustumCuller::visible = 0;
+size_t FrustumCuller::culled = 0;
+size_t FrustumCuller::s_visible = 0;
+size_t FrustumCuller::s_culled = 0;
+
+void FrustumCuller::build(DataTex& data) {
+    ObjectBounds& bounds = data.m_bounds;
+    size_t count = data.m_draw_objects.size();
+    size_t padded = (count + batch - 1) / batch * batch;
+
+    // Padding lanes are empty boxes, outside every plane
+    for (std::vector<float>* lane : {&bounds.minX, &bounds.minY, &bounds.minZ}) lane->assign(padded, FLT_MAX);
+    for (std::vector<float>* lane : {&bounds.maxX, &bounds.maxY, &bounds.maxZ}) lane->assign(padded, -FLT_MAX);
+    bounds.visible.assign(count, 1);
+    bounds.instancesVersion = data.m_instances.version;
+
+    std::vector<GLsizei> counts;
+    std::vector<glm::mat4> transforms = Mesh::instance_transforms(data, counts);
+    size_t first = 0;
+    for (size_t i = 0; i < count; i++) {
+        const DrawObject& o = data.m_draw_objects[i];
+        size_t instances = counts.empty() ? 0 : static_cast<size_t>(counts[i]);
+        if (o.numVertices == 0) {
+            bounds.visible[i] = 0;
+            first += instances;
+            continue;
+        }
+
+        // The corners of the box at each instance, or where it is when not instanced
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        for (size_t t = 0; t < std::max<size_t>(instances, 1); t++) {
+            glm::mat4 transform = instances == 0 ? glm::mat4(1.0f) : transforms[first + t];
+            for (int c = 0; c < 8; c++) {
+                glm::vec3 corner((c & 1) ? o.bmax.x : o.bmin.x, (c & 2) ? o.bmax.y : o.bmin.y,
+                                 (c & 4) ? o.bmax.z : o.bmin.z);
+                glm::vec3 p = glm::vec3(transform * glm::vec4(corner, 1.0f));
+                lo = glm::min(lo, p);
+                hi = glm::max(hi, p);
+            }
+        }
+        first += instances;
+
+        bounds.minX[i] = lo.x;
+        bounds.minY[i] = lo.y;
+        bounds.minZ[i] = lo.z;
+        bounds.maxX[i] = hi.x;
+        bounds.maxY[i] = hi.y;
+        bounds.maxZ[i] = hi.z;
+    }
+}
+
+void FrustumCuller::cull(DataTex& data, const glm::mat4& mvp) {
+    ObjectBounds& bounds = data.m_bounds;
+    if (bounds.instancesVersion != data.m_instances.version) build(data);
+    size_t count = bounds.visible.size();
+    // Objects without triangles have empty boxes and are never drawn, so are
+    // culled even when a plane's near-zero normal would let one through
+    auto empty = [&bounds](size_t i) { return bounds.minX[i] > bounds.maxX[i]; };
+    if (!enabled) {
+        for (size_t i = 0; i < count; i++) {
+            bounds.visible[i] = !empty(i);
+            if (bounds.visible[i]) {
+                s_visible++;
+            } else {
+                s_culled++;
+            }
+        }
+        return;
+    }
+
+    // Planes of the frustum in the mesh's space (Gribb & Hartmann), a point
+    // is inside when a x + b y + c z + d >= 0 for all six
+    std::array<glm::vec4, 6> planes;
+    glm::vec4 row[4];
+    for (int r = 0; r < 4; r++) {
+        row[r] = glm::vec4(mvp[0][r], mvp[1][r], mvp[2][r], mvp[3][r]);
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        planes[2 * axis] = row[3] + row[axis];
+        planes[2 * axis + 1] = row[3] - row[axis];
+    }
+
+    // A box is outside when its corner farthest along a plane's normal is
+    // behind it. The corner is picked per plane, by the signs of its normal
+    struct Plane {
+        const float* x;
+        const float* y;
+        const float* z;
+        glm::vec4 p;
+    };
+    std::array<Plane, 6> tests;
+    for (size_t k = 0; k < planes.size(); k++) {
+        const glm::vec4& p = planes[k];
+        tests[k] = {(p.x >= 0.0f ? bounds.maxX : bounds.minX).data(),
+                    (p.y >= 0.0f ? bounds.maxY : bounds.minY).data(),
+                    (p.z >= 0.0f ? bounds.maxZ : bounds.minZ).data(), p};
+    }
+
+    for (size_t i = 0; i < count; i += batch) {
+        uint32_t outside = 0;   // Bit j: box i + j is outside a plane
+#if defined(__AVX__)
+        __m256 out = _mm256_setzero_ps();
+        for (const Plane& t : tests) {
+            __m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.p.x), _mm256_loadu_ps(t.x + i)),
+                                     _mm256_mul_ps(_mm256_set1_ps(t.p.y), _mm256_loadu_ps(t.y + i)));
+            d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(t.p.z), _mm256_loadu_ps(t.z + i)));
+            d = _mm256_add_ps(d, _mm256_set1_ps(t.p.w));
+            out = _mm256_or_ps(out, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        outside = static_cast<uint32_t>(_mm256_movemask_ps(out));
+#elif defined(__SSE__) || defined(_M_X64)
+        for (size_t half = 0; half < batch; half += 4) {
+            __m128 out = _mm_setzero_ps();
+            for (const Plane& t : tests) {
+                __m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.p.x), _mm_loadu_ps(t.x + i + half)),
+                                      _mm_mul_ps(_mm_set1_ps(t.p.y), _mm_loadu_ps(t.y + i + half)));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(t.p.z), _mm_loadu_ps(t.z + i + half)));
+                d = _mm_add_ps(d, _mm_set1_ps(t.p.w));
+                out = _mm_or_ps(out, _mm_cmplt_ps(d, _mm_setzero_ps()));
+            }
+            outside |= static_cast<uint32_t>(_mm_movemask_ps(out)) << half;
+        }
+#else
+        for (size_t j = 0; j < batch; j++) {
+            for (const Plane& t : tests) {
+                float d = t.p.x * t.x[i + j] + t.p.y * t.y[i + j] + t.p.z * t.z[i + j] + t.p.w;
+                if (d < 0.0f) outside |= 1u << j;
+            }
+        }
+#endif
+        for (size_t j = 0; j < batch && i + j < count; j++) {
+            bool in = !(outside & (1u << j)) && !empty(i + j);
+            bounds.visible[i + j] = in;
+            if (in) {
+                s_visible++;
+            } else {
+                s_culled++;
+            }
+        }
+    }
+}
+
+void FrustumCuller::begin_frame() {
+    visible = s_visible;
+    culled = s_culled;
+    s_visible = 0;
+    s_culled = 0;
+}
+
+void FrustumCuller::draw_stats() {
+    ImGui::Checkbox("Frustum culling", &enabled);
+    ImGui::Text("Last frame: %zu draw objects visible, %zu culled", visible, culled);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "mesh.h"
+
+// Skips the draw objects outside the camera's view. Their boxes (DataTex::m_bounds)
+// are tested against the six planes of the frustum a batch of boxes at a time,
+// 8 with AVX, 4 with SSE, one by one elsewhere. An instanced object is drawn
+// with all of its instances when the box around them is in view
+class FrustumCuller {
+public:
+
+    // Sets the boxes of the draw objects of `data`, around each of their
+    // instances and placements, all visible. GL thread only
+    static void build(DataTex& data);
+
+    // Marks the draw objects of `data` inside the frustum of `mvp` visible,
+    // its model, view and projection. Rebuilds the boxes if the instances
+    // changed, and marks all visible while culling is off
+    static void cull(DataTex& data, const glm::mat4& mvp);
+
+    // Starts counting a new frame
+    static void begin_frame();
+
+    static void draw_stats();
+
+    static bool enabled;
+
+    // Counters of the draw objects of the last frame
+    static size_t visible;
+    static size_t culled;
+
+    // Lanes of a batch, the padding of ObjectBounds
+    static constexpr size_t batch = 8;
+
+private:
+    static size_t s_visible;
+    static size_t s_culled;
+};
@@ -0,0 +1,113 @@
+#include "glstate.h"
+
+#include <imgui.h>
+
+size_t GLState::issued = 0;
+size_t GLState::elided = 0;
+size_t GLState::s_issued = 0;
+size_t GLState::s_elided = 0;
+
+std::optional<GLuint> GLState::s_program;
+std::optional<GLuint> GLState::s_vao;
+std::optional<GLenum> GLState::s_activeUnit;
+std::array<std::optional<GLuint>, GLState::max_units> GLState::s_textures2D;
+std::array<std::optional<GLuint>, GLState::max_units> GLState::s_textureArrays;
+
+std::unordered_map<GLenum, std::optional<bool>> GLState::s_caps;
+std::optional<std::pair<GLenum, GLenum>> GLState::s_polygonMode;
+std::optional<std::pair<GLenum, GLenum>> GLState::s_blendFunc;
+std::optional<std::pair<GLfloat, GLfloat>> GLState::s_polygonOffset;
+std::optional<GLfloat> GLState::s_lineWidth;
+std::optional<GLfloat> GLState::s_pointSize;
+std::optional<std::array<GLint, 4>> GLState::s_viewport;
+std::optional<std::array<GLfloat, 4>> GLState::s_clearColor;
+
+template<class T>
+bool GLState::update(std::optional<T>& shadow, const T& value) {
+    if (shadow == value) {
+        s_elided++;
+        return false;
+    }
+    shadow = value;
+    s_issued++;
+    return true;
+}
+
+void GLState::begin_frame() {
+    issued = s_issued;
+    elided = s_elided;
+    s_issued = 0;
+    s_elided = 0;
+
+    s_program.reset();
+    s_vao.reset();
+    s_activeUnit.reset();
+    s_textures2D.fill(std::nullopt);
+    s_textureArrays.fill(std::nullopt);
+}
+
+void GLState::use_program(GLuint program) {
+    if (update(s_program, program)) glUseProgram(program);
+}
+
+void GLState::bind_vertex_array(GLuint vao) {
+    if (update(s_vao, vao)) glBindVertexArray(vao);
+}
+
+void GLState::active_texture(GLenum unit) {
+    if (update(s_activeUnit, unit)) glActiveTexture(unit);
+}
+
+void GLState::bind_texture(GLenum target, GLuint texture) {
+    // Bindings of an unknown unit cannot be told apart
+    int unit = s_activeUnit ? static_cast<int>(*s_activeUnit - GL_TEXTURE0) : -1;
+    bool cached = unit >= 0 && unit < max_units && (target == GL_TEXTURE_2D || target == GL_TEXTURE_2D_ARRAY);
+    if (!cached) {
+        glBindTexture(target, texture);
+        s_issued++;
+        return;
+    }
+    auto& shadow = target == GL_TEXTURE_2D ? s_textures2D[unit] : s_textureArrays[unit];
+    if (update(shadow, texture)) glBindTexture(target, texture);
+}
+
+void GLState::enable(GLenum cap) {
+    if (update(s_caps[cap], true)) glEnable(cap);
+}
+
+void GLState::disable(GLenum cap) {
+    if (update(s_caps[cap], false)) glDisable(cap);
+}
+
+void GLState::polygon_mode(GLenum face, GLenum mode) {
+    // Core profiles only have GL_FRONT_AND_BACK
+    if (update(s_polygonMode, {face, mode})) glPolygonMode(face, mode);
+}
+
+void GLState::blend_func(GLenum sfactor, GLenum dfactor) {
+    if (update(s_blendFunc, {sfactor, dfactor})) glBlendFunc(sfactor, dfactor);
+}
+
+void GLState::polygon_offset(GLfloat factor, GLfloat units) {
+    if (update(s_polygonOffset, {factor, units})) glPolygonOffset(factor, units);
+}
+
+void GLState::line_width(GLfloat width) {
+    if (update(s_lineWidth, width)) glLineWidth(width);
+}
+
+void GLState::point_size(GLfloat size) {
+    if (update(s_pointSize, size)) glPointSize(size);
+}
+
+void GLState::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    if (update(s_viewport, {x, y, width, height})) glViewport(x, y, width, height);
+}
+
+void GLState::clear_color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+    if (update(s_clearColor, {red, green, blue, alpha})) glClearColor(red, green, blue, alpha);
+}
+
+void GLState::draw_stats() {
+    ImGui::Text("GL state: %zu calls issued, %zu elided last frame", issued, elided);
+}
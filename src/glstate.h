@@ -0,0 +1,69 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+// Shadow copy of the GL state the viewer sets while drawing. Calls that
+// would set what is already set are dropped, so state set the same way for
+// every mesh, every frame, reaches GL once. Unknown state is always issued.
+// Texture and VAO bindings, uploads included, go through here too; they are
+// still forgotten by begin_frame() in case anything outside the viewer moved
+// them (ImGui restores what it changes). Buffer bindings and pixel store state
+// are set directly: the element buffer binding belongs to the bound VAO
+class GLState {
+public:
+
+    // Starts counting a new frame, before anything of it is drawn
+    static void begin_frame();
+
+    static void use_program(GLuint program);
+    static void bind_vertex_array(GLuint vao);
+    static void active_texture(GLenum unit);
+    // Binds to the active unit. Targets other than GL_TEXTURE_2D(_ARRAY) are not cached
+    static void bind_texture(GLenum target, GLuint texture);
+
+    static void enable(GLenum cap);
+    static void disable(GLenum cap);
+    static void polygon_mode(GLenum face, GLenum mode);
+    static void blend_func(GLenum sfactor, GLenum dfactor);
+    static void polygon_offset(GLfloat factor, GLfloat units);
+    static void line_width(GLfloat width);
+    static void point_size(GLfloat size);
+    static void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    static void clear_color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+
+    static void draw_stats();
+
+    // Counters of the last frame
+    static size_t issued;
+    static size_t elided;
+
+private:
+    // Whether `value` differs from `shadow`, which becomes it. Counts the call either way
+    template<class T>
+    static bool update(std::optional<T>& shadow, const T& value);
+
+    static constexpr int max_units = 32;
+
+    static size_t s_issued;
+    static size_t s_elided;
+
+    static std::optional<GLuint> s_program;
+    static std::optional<GLuint> s_vao;
+    static std::optional<GLenum> s_activeUnit;
+    static std::array<std::optional<GLuint>, max_units> s_textures2D;
+    static std::array<std::optional<GLuint>, max_units> s_textureArrays;
+
+    static std::unordered_map<GLenum, std::optional<bool>> s_caps;
+    static std::optional<std::pair<GLenum, GLenum>> s_polygonMode;
+    static std::optional<std::pair<GLenum, GLenum>> s_blendFunc;
+    static std::optional<std::pair<GLfloat, GLfloat>> s_polygonOffset;
+    static std::optional<GLfloat> s_lineWidth;
+    static std::optional<GLfloat> s_pointSize;
+    static std::optional<std::array<GLint, 4>> s_viewport;
+    static std::optional<std::array<GLfloat, 4>> s_clearColor;
+};
@@ -0,0 +1,202 @@
+#include "instancer.h"
+
+#include "mesh.h"
+#include "quantize.h"
+#include "texcache.h"
+
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    constexpr size_t kFloatsPerVertex = 3 + 3 + 2;
+
+    // Candidates for the frame's axes within this fraction of the farthest
+    // resolve to the first in vertex order, which repeats share, so float
+    // noise does not pick different vertices in different copies
+    constexpr float kTie = 1e-3f;
+
+    // Rounding of a normal by Quantize, which two compared vertices may both add
+    constexpr float kNormalSlack = 1e-4f;
+
+    // Maps vertices into a shape's frame. The frame is a rotation and a
+    // translation: its inverse rotation is the transpose
+    struct ToFrame {
+        glm::mat3 rotation;
+        glm::vec3 origin;
+
+        explicit ToFrame(const glm::mat4& frame) : rotation(glm::transpose(glm::mat3(frame))), origin(frame[3]) {}
+
+        void operator()(const float* v, float* out) const {
+            glm::vec3 p = rotation * (glm::vec3(v[0], v[1], v[2]) - origin);
+            glm::vec3 n = rotation * glm::vec3(v[3], v[4], v[5]);
+            out[0] = p.x; out[1] = p.y; out[2] = p.z;
+            out[3] = n.x; out[4] = n.y; out[5] = n.z;
+            out[6] = v[6];
+            out[7] = v[7];
+        }
+    };
+
+    // Vertex `i` of a prepared draw object as it is drawn
+    void decode(const CpuDrawObject& o, size_t i, float* out) {
+        if (o.vertexFormat != VertexFormat::Quantized) {
+            std::copy_n(&o.vertices[i * kFloatsPerVertex], kFloatsPerVertex, out);
+            return;
+        }
+        const QuantizedVertex& q = o.packed[i];
+        glm::vec3 p = Quantize::decode_position(q, o.posOffset, o.posOffset + o.posScale);
+        glm::vec3 n = Quantize::decode_normal(q);
+        out[0] = p.x; out[1] = p.y; out[2] = p.z;
+        out[3] = n.x; out[4] = n.y; out[5] = n.z;
+        out[6] = glm::unpackHalf1x16(q.texcoord[0]);
+        out[7] = glm::unpackHalf1x16(q.texcoord[1]);
+    }
+
+    // Largest rounding of a position by Quantize
+    float position_step(const CpuDrawObject& o) {
+        return o.vertexFormat == VertexFormat::Quantized ? glm::length(o.posScale) / 65535.0f : 0.0f;
+    }
+}
+
+int ShapeInstancer::match(CpuDrawObject& o, const std::vector<CpuDrawObject>& objects,
+                          const std::function<void(CpuDrawObject&)>& prepare, glm::mat4& placement) {
+    glm::mat4 f;
+    float radius;
+    if (o.vertexFormat != VertexFormat::Float || !frame(o.vertices, f, radius)) {
+        prepare(o);
+        return -1;
+    }
+
+    // Repeats share the indices and the material ranges exactly
+    uint64_t layout[] = {o.vertices.size(), o.indices.size(), o.subDraws.size()};
+    uint64_t key = TextureCache::hash_bytes(layout, sizeof(layout));
+    key = TextureCache::hash_bytes(o.indices.data(), o.indices.size() * sizeof(uint32_t), key);
+    for (const SubDraw& sd : o.subDraws) {
+        uint64_t range[] = {sd.indexOffset, sd.indexCount, static_cast<uint64_t>(sd.material_id)};
+        key = TextureCache::hash_bytes(range, sizeof(range), key);
+    }
+
+    Samples samples = sample(o.vertices, f);
+    std::vector<Shape>& shapes = m_shapes[key];
+    bool prepared = false;
+    for (const Shape& shape : shapes) {
+        if (std::abs(shape.radius - radius) > tolerance * radius) continue;
+        bool close = true;
+        for (size_t v = 0; v < samples.size() && close; v += kFloatsPerVertex) {
+            close = same(&shape.samples[v], &samples[v], shape.radius);
+        }
+        if (!close) continue;
+
+        // The full comparison is against the original as prepared, so `o` is
+        // prepared too. That only depends on the indices and sub-draws, which
+        // repeats share, so their vertices stay in the same order
+        if (!prepared) {
+            prepare(o);
+            prepared = true;
+        }
+        if (!same(objects[shape.index], shape, o, f)) continue;
+        placement = f * glm::inverse(shape.frame);
+        m_repeats++;
+        return static_cast<int>(shape.index);
+    }
+    if (!prepared) prepare(o);
+    shapes.push_back({objects.size(), f, radius, samples});
+    return -1;
+}
+
+bool ShapeInstancer::frame(const std::vector<float>& vertices, glm::mat4& frame, float& radius) {
+    size_t n = vertices.size() / kFloatsPerVertex;
+    if (n < 3) return false;
+    auto position = [&vertices](size_t i) {
+        const float* v = &vertices[i * kFloatsPerVertex];
+        return glm::vec3(v[0], v[1], v[2]);
+    };
+
+    glm::vec3 centroid(0.0f);
+    for (size_t i = 0; i < n; i++) centroid += position(i);
+    centroid /= static_cast<float>(n);
+
+    // First axis: towards the farthest vertex
+    float farthest = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        glm::vec3 d = position(i) - centroid;
+        farthest = std::max(farthest, glm::dot(d, d));
+    }
+    if (farthest <= 0.0f) return false;
+    size_t a = 0;
+    while (glm::dot(position(a) - centroid, position(a) - centroid) < farthest * (1.0f - kTie)) a++;
+    glm::vec3 x = glm::normalize(position(a) - centroid);
+
+    // Second axis: towards the vertex farthest off the first
+    auto off_axis = [&](size_t i) {
+        glm::vec3 d = position(i) - centroid;
+        return d - glm::dot(d, x) * x;
+    };
+    float off = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        glm::vec3 d = off_axis(i);
+        off = std::max(off, glm::dot(d, d));
+    }
+    if (off <= farthest * kTie * kTie) return false;
+    size_t b = 0;
+    while (glm::dot(off_axis(b), off_axis(b)) < off * (1.0f - kTie)) b++;
+    glm::vec3 y = glm::normalize(off_axis(b));
+
+    frame = glm::mat4(glm::vec4(x, 0.0f), glm::vec4(y, 0.0f), glm::vec4(glm::cross(x, y), 0.0f),
+                      glm::vec4(centroid, 1.0f));
+    radius = std::sqrt(farthest);
+    return true;
+}
+
+ShapeInstancer::Samples ShapeInstancer::sample(const std::vector<float>& vertices, const glm::mat4& frame) {
+    ToFrame to_frame(frame);
+    size_t n = vertices.size() / kFloatsPerVertex;
+    Samples result;
+    for (size_t i = 0; i < sample_count; i++) {
+        size_t v = i * (n - 1) / (sample_count - 1);
+        to_frame(&vertices[v * kFloatsPerVertex], &result[i * kFloatsPerVertex]);
+    }
+    return result;
+}
+
+bool ShapeInstancer::same(const float* a, const float* b, float radius, const float* slack) {
+    for (size_t c = 0; c < kFloatsPerVertex; c++) {
+        float limit = c < 3 ? tolerance * radius : attribute_tolerance;
+        if (slack) limit += slack[c];
+        if (std::abs(a[c] - b[c]) > limit) return false;
+    }
+    return true;
+}
+
+bool ShapeInstancer::same(const CpuDrawObject& original, const Shape& shape,
+                          const CpuDrawObject& o, const glm::mat4& frame) {
+    size_t n = o.numVertices();
+    if (original.numVertices() != n) return false;
+
+    // Quantized vertices may differ by their rounding as well
+    bool quantized = original.vertexFormat == VertexFormat::Quantized;
+    float slack[kFloatsPerVertex] = {};
+    std::fill_n(slack, 3, position_step(original) + position_step(o));
+    std::fill_n(slack + 3, 3, quantized ? 2.0f * kNormalSlack : 0.0f);
+
+    ToFrame original_to_frame(shape.frame), to_frame(frame);
+    float vertex[kFloatsPerVertex], a[kFloatsPerVertex], b[kFloatsPerVertex];
+    for (size_t i = 0; i < n; i++) {
+        decode(original, i, vertex);
+        original_to_frame(vertex, a);
+        decode(o, i, vertex);
+        to_frame(vertex, b);
+
+        // Quantize stores a missing normal as +Z whichever way the shape is
+        // turned. Where both are +Z, they are missing or agree regardless
+        if (quantized && original.packed[i].normal[0] == 0 && original.packed[i].normal[1] == 0 &&
+            o.packed[i].normal[0] == 0 && o.packed[i].normal[1] == 0) {
+            std::copy_n(a + 3, 3, b + 3);
+        }
+        for (size_t c = 6; c < 8 && quantized; c++) {
+            slack[c] = std::max(std::abs(a[c]), std::abs(b[c])) / 1024.0f;  // A half's 10-bit mantissa
+        }
+        if (!same(a, b, shape.radius, slack)) return false;
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+struct CpuDrawObject;
+
+// Recognizes shapes of one file that repeat an earlier shape, moved and
+// turned, as CAD exports do with every bolt and chair. Each shape gets a
+// frame of its own from its centroid and two of its vertices; repeats have
+// the same topology and, in their frames, the same vertices. Mirrored or
+// scaled repeats are not recognized. Only a few vertices of each shape are
+// kept: candidates that agree on those are compared in full against the
+// original as it was prepared for drawing
+class ShapeInstancer {
+public:
+
+    // Largest difference of a repeat's positions, relative to the size of the shape
+    static constexpr float tolerance = 1e-3f;
+
+    // Largest difference of a repeat's normals and texture coordinates
+    static constexpr float attribute_tolerance = 1e-3f;
+
+    // Index of the earlier shape `o` repeats, with `placement` set to the
+    // transform from that shape onto `o`, or -1 when it repeats none: it is
+    // then remembered as shape `objects.size()`. `o` comes with
+    // VertexFormat::Float vertices and leaves prepared by `prepare` either
+    // way. `objects` holds the shapes so far, all prepared the same way
+    int match(CpuDrawObject& o, const std::vector<CpuDrawObject>& objects,
+              const std::function<void(CpuDrawObject&)>& prepare, glm::mat4& placement);
+
+    size_t repeats() const { return m_repeats; }
+
+private:
+    static constexpr size_t sample_count = 4;
+    using Samples = std::array<float, sample_count * (3 + 3 + 2)>;
+
+    struct Shape {
+        size_t index;
+        glm::mat4 frame;
+        float radius;
+        Samples samples;    // Vertices spread over the shape, in `frame`
+    };
+
+    // Origin at the centroid, x towards the farthest vertex and y towards the
+    // farthest off that axis. False when the shape is flat along a line
+    static bool frame(const std::vector<float>& vertices, glm::mat4& frame, float& radius);
+    static Samples sample(const std::vector<float>& vertices, const glm::mat4& frame);
+    static bool same(const float* a, const float* b, float radius, const float* slack = nullptr);
+
+    // Whether prepared `o` in `frame` matches prepared `original` in its own, vertex for vertex
+    static bool same(const CpuDrawObject& original, const Shape& shape,
+                     const CpuDrawObject& o, const glm::mat4& frame);
+
+    std::unordered_map<uint64_t, std::vector<Shape>> m_shapes;  // By hash of their indices and sub-draws
+    size_t m_repeats = 0;
+};
@@ -0,0 +1,121 @@
+#include "loader.h"
+#include "upload.h"
+
+#include <imgui.h>
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <iostream>
+
+std::vector<std::unique_ptr<LoadJob>> AsyncLoader::s_jobs;
+CompletionQueue AsyncLoader::s_finished;
+std::vector<std::string> AsyncLoader::s_failures;
+int AsyncLoader::max_parses = 2;
+
+void AsyncLoader::load(const std::string& filename, const LoadOptions& options, std::vector<glm::mat4> instances) {
+    auto job = std::make_unique<LoadJob>();
+    job->filename = filename;
+    job->options = options;
+    job->instances = std::move(instances);
+
+    s_jobs.push_back(std::move(job));
+    start_waiting();
+}
+
+void AsyncLoader::start_waiting() {
+    // Jobs cancelled before they started are dropped without a thread
+    std::erase_if(s_jobs, [](const std::unique_ptr<LoadJob>& job) {
+        if (job->worker.joinable() || !job->progress.cancel) return false;
+        std::cout << "Cancelled loading " << job->filename << std::endl;
+        return true;
+    });
+
+    // Oldest first
+    int running = static_cast<int>(std::ranges::count_if(s_jobs, [](const std::unique_ptr<LoadJob>& job) {
+        return job->worker.joinable();
+    }));
+    for (auto& job : s_jobs) {
+        if (running >= std::max(1, max_parses)) break;
+        if (job->worker.joinable()) continue;
+        LoadJob* raw = job.get();
+        raw->worker = std::thread([raw]() {
+            raw->mesh = Mesh::parse(raw->filename, raw->options, &raw->progress);
+            raw->mesh.instances = std::move(raw->instances);
+            s_finished.push(raw);
+        });
+        running++;
+    }
+}
+
+void AsyncLoader::collect_finished() {
+    for (LoadJob* job = s_finished.pop_all(); job != nullptr; ) {
+        LoadJob* next = job->next;
+        job->worker.join();
+
+        if (job->progress.cancel) {
+            std::cout << "Cancelled loading " << job->filename << std::endl;
+        } else if (job->mesh.objects.empty()) {
+            std::cerr << "Warning: Failed to load mesh from " << job->filename << std::endl;
+            s_failures.push_back(std::format("Failed to load {}", job->filename));
+        } else {
+            // Loaded without the textures it could not read
+            if (size_t failed = job->mesh.failedTextures.size()) {
+                std::string message = std::format("{}: {} texture(s) missing or unreadable", job->filename, failed);
+                std::cerr << "Warning: " << message << std::endl;
+                s_failures.push_back(std::move(message));
+            }
+            UploadScheduler::enqueue(std::move(job->mesh));
+        }
+
+        std::erase_if(s_jobs, [job](const std::unique_ptr<LoadJob>& j) { return j.get() == job; });
+        job = next;
+    }
+    start_waiting();
+}
+
+void AsyncLoader::draw_progress() {
+    if (s_jobs.empty()) {
+        ImGui::Text("No files loading");
+    }
+    for (size_t i = 0; i < s_jobs.size(); i++) {
+        LoadProgress& progress = s_jobs[i]->progress;
+        size_t bytes = progress.bytesParsed;
+        size_t total = progress.totalBytes;
+
+        ImGui::PushID(static_cast<int>(i));
+        ImGui::Text("%s", std::filesystem::path(s_jobs[i]->filename).filename().string().c_str());
+        std::string overlay = std::format("{:.1f} / {:.1f} MB, {} triangles",
+                                          bytes / 1048576.0, total / 1048576.0, progress.triangles.load());
+        ImGui::ProgressBar(total > 0 ? static_cast<float>(bytes) / total : 0.0f, ImVec2(-1.0f, 0.0f), overlay.c_str());
+        if (size_t textures = progress.texturesTotal) {
+            ImGui::Text("Textures: %zu / %zu decoded", progress.texturesDecoded.load(), textures);
+        }
+        if (!s_jobs[i]->worker.joinable() && !progress.cancel) {
+            ImGui::Text("Waiting for a free parse");
+        }
+        if (progress.cancel) {
+            ImGui::Text("Cancelling...");
+        } else if (ImGui::Button("Cancel")) {
+            progress.cancel = true;
+        }
+        ImGui::PopID();
+    }
+
+    for (const std::string& failure : s_failures) {
+        ImGui::TextColored({1.0f, 0.4f, 0.4f, 1.0f}, "%s", failure.c_str());
+    }
+    if (!s_failures.empty() && ImGui::Button("Clear errors")) {
+        s_failures.clear();
+    }
+}
+
+void AsyncLoader::shutdown() {
+    for (auto& job : s_jobs) {
+        job->progress.cancel = true;
+    }
+    for (auto& job : s_jobs) {
+        if (job->worker.joinable()) job->worker.join();
+    }
+    s_finished.pop_all();
+    s_jobs.clear();
+}
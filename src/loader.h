@@ -0,0 +1,80 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A file parsed on a background thread
+struct LoadJob {
+    std::string filename;
+    LoadOptions options;
+    std::vector<glm::mat4> instances;  // Copies to draw, from a scene file
+    LoadProgress progress;
+    CpuMesh mesh;              // Written by the worker, read once the job is queued
+    std::thread worker;        // Not started while the job waits for a free parse
+    LoadJob* next = nullptr;   // Link in the CompletionQueue
+};
+
+// Multi-producer, single-consumer lock-free queue: workers push finished
+// jobs onto an intrusive stack, the GL thread takes them all at once
+class CompletionQueue {
+public:
+    void push(LoadJob* job) {
+        job->next = m_head.load(std::memory_order_relaxed);
+        while (!m_head.compare_exchange_weak(job->next, job, std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+        }
+    }
+
+    // Takes every queued job, oldest first
+    LoadJob* pop_all() {
+        LoadJob* list = m_head.exchange(nullptr, std::memory_order_acquire);
+        LoadJob* ordered = nullptr;
+        while (list) {
+            LoadJob* next = list->next;
+            list->next = ordered;
+            ordered = list;
+            list = next;
+        }
+        return ordered;
+    }
+
+private:
+    std::atomic<LoadJob*> m_head{nullptr};
+};
+
+// Parses files on background threads and hands them to the UploadScheduler
+// on the GL thread, so loading never blocks a frame. Each parse already uses
+// every core for its chunks and textures, so only `max_parses` run at once
+// and further files wait their turn
+class AsyncLoader {
+public:
+
+    // Queues `filename` to be parsed on its own thread, started right away if
+    // fewer than `max_parses` are running. It is drawn once per transform in `instances`, if any
+    static void load(const std::string& filename, const LoadOptions& options,
+                     std::vector<glm::mat4> instances = {});
+
+    // Queues every finished parse for upload, and starts waiting ones in
+    // their place. GL thread only
+    static void collect_finished();
+
+    // ImGui progress bar and cancel button per load in flight, and the loads that failed
+    static void draw_progress();
+
+    // Cancels all loads, waiting ones included, and waits for the running threads
+    static void shutdown();
+
+    static int max_parses;
+
+private:
+    static void start_waiting();
+
+    static std::vector<std::unique_ptr<LoadJob>> s_jobs;   // Owned by the GL thread
+    static CompletionQueue s_finished;
+    static std::vector<std::string> s_failures;    // Shown until cleared
+};
@@ -1,5 +1,15 @@
 #include "mesh.h"
 #include "transform.h"
+#include "vcache.h"
+#include "quantize.h"
+#include "texcache.h"
+#include "atlas.h"
+#include "stream.h"
+#include "instancer.h"
+#include "ubo.h"
+#include "glstate.h"
+#include "culling.h"
+#include "bvh.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #define TINYOBJLOADER_USE_MAPBOX_EARCUT
@@ -9,9 +19,364 @@
 #include <stb_image.h>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
+#include <functional>
+#include <mutex>
+#include <thread>
 
+bool Mesh::optimize_vertex_cache = true;
+VertexFormat Mesh::vertex_format = VertexFormat::Float;
+bool Mesh::report_quantization_error = false;
+bool Mesh::streaming_import = false;
+bool Mesh::instance_duplicates = true;
+bool Mesh::texture_arrays = true;
+bool Mesh::resample_texture_arrays = false;
+DrawUniforms Mesh::s_uniforms;
+int Mesh::texture_decode_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
 
-std::vector<tinyobj::material_t> materials;
+// Open addressing hash map from an obj (v, vn, vt) index triple to the
+// vertex it was assigned in the draw object's vertex buffer.
+class VertexDedupMap {
+public:
+    explicit VertexDedupMap(size_t expected = 0) {
+        reserve(expected);
+    }
+
+    // Sizes the table so `expected` vertices fit without rehashing
+    void reserve(size_t expected) {
+        size_t capacity = 16;
+        while (capacity < expected * 2) capacity <<= 1;
+        if (capacity > m_slots.size()) rehash(capacity);
+    }
+
+    // Returns the vertex of `idx`, or assigns it `next` if it is new.
+    uint32_t find_or_insert(const tinyobj::index_t& idx, uint32_t next, bool& inserted) {
+        // Keep the load factor at or below 1/2
+        if (2 * (m_size + 1) > m_slots.size()) {
+            rehash(std::max<size_t>(16, 2 * m_slots.size()));
+        }
+
+        size_t i = hash(idx.vertex_index, idx.normal_index, idx.texcoord_index) & m_mask;
+        while (true) {
+            Slot& slot = m_slots[i];
+            if (slot.vertex == kEmpty) {
+                slot = {idx.vertex_index, idx.normal_index, idx.texcoord_index, next};
+                m_size++;
+                inserted = true;
+                return next;
+            }
+            if (slot.v == idx.vertex_index && slot.vn == idx.normal_index && slot.vt == idx.texcoord_index) {
+                inserted = false;
+                return slot.vertex;
+            }
+            i = (i + 1) & m_mask;
+        }
+    }
+
+private:
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+
+    struct Slot {
+        int v = 0, vn = 0, vt = 0;
+        uint32_t vertex = kEmpty;
+    };
+
+    static size_t hash(int v, int vn, int vt) {
+        uint64_t h = static_cast<uint32_t>(v) * 0x9E3779B97F4A7C15ull;
+        h ^= static_cast<uint32_t>(vn) * 0xC2B2AE3D27D4EB4Full;
+        h ^= static_cast<uint32_t>(vt) * 0x165667B19E3779F9ull;
+        return static_cast<size_t>(h ^ (h >> 29));
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old = std::move(m_slots);
+        m_slots.assign(capacity, Slot{});
+        m_mask = capacity - 1;
+        for (const Slot& slot : old) {
+            if (slot.vertex == kEmpty) continue;
+            size_t i = hash(slot.v, slot.vn, slot.vt) & m_mask;
+            while (m_slots[i].vertex != kEmpty) i = (i + 1) & m_mask;
+            m_slots[i] = slot;
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    size_t m_mask = 0;
+    size_t m_size = 0;
+};
+
+// Builds the interleaved vertices, pos(3), normal(3), tex(2), and the
+// per-material index buckets of one draw object as its triangles arrive.
+class ShapeBuilder {
+public:
+    static constexpr size_t kFloatsPerVertex = 3 + 3 + 2;
+
+    ShapeBuilder(const std::vector<float>& positions, const std::vector<float>& normals,
+                 const std::vector<float>& texcoords)
+        : m_positions(positions), m_normals(normals), m_texcoords(texcoords) {}
+
+    // Pre-sizes the storage for about `vertices` unique vertices, and the
+    // first material's bucket for `indices` indices
+    void reserve(size_t vertices, size_t indices) {
+        m_buffer.reserve(vertices * kFloatsPerVertex);
+        m_vertex_map.reserve(vertices);
+        m_index_hint = indices;
+    }
+
+    // `idx` are 0-based, -1 for a missing normal or texcoord. A `material`
+    // of -1 is the default material
+    void add_triangle(const tinyobj::index_t* idx, int material) {
+        size_t bucket = static_cast<size_t>(material + 1);
+        if (bucket >= m_buckets.size()) m_buckets.resize(bucket + 1);
+        std::vector<uint32_t>& indices = m_buckets[bucket];
+        if (indices.empty() && m_index_hint > 0) {
+            indices.reserve(m_index_hint);
+            m_index_hint = 0;
+        }
+
+        for (int k = 0; k < 3; k++) {
+            // Each unique (v, vn, vt) triple is stored once
+            bool inserted;
+            uint32_t vertex = static_cast<uint32_t>(m_buffer.size() / kFloatsPerVertex);
+            vertex = m_vertex_map.find_or_insert(idx[k], vertex, inserted);
+            indices.push_back(vertex);
+            if (inserted) append_vertex(idx[k]);
+        }
+        m_numIndices += 3;
+    }
+
+    bool empty() const { return m_numIndices == 0; }
+
+    // Moves the vertices and the indices, one contiguous range (sub-draw) per
+    // material, into `o`, and empties the builder. Sub-draws of the default
+    // material get material_id -1
+    void finish(CpuDrawObject& o) {
+        std::vector<uint32_t>& indices = o.indices;
+        o.subDraws.clear();
+        o.bmin = m_bmin;
+        o.bmax = m_bmax;
+
+        // Default material last
+        size_t n = m_buckets.size();
+        size_t used = std::ranges::count_if(m_buckets, [](const auto& b) { return !b.empty(); });
+        indices.clear();
+        if (used > 1) indices.reserve(m_numIndices);
+        for (size_t i = 1; i <= n; i++) {
+            std::vector<uint32_t>& bucket = m_buckets[i % n];
+            if (bucket.empty()) continue;
+            o.subDraws.push_back({indices.size(), bucket.size(), static_cast<int>(i % n) - 1});
+            if (used == 1) {
+                indices = std::move(bucket);
+            } else {
+                indices.insert(indices.end(), bucket.begin(), bucket.end());
+            }
+            std::vector<uint32_t>().swap(bucket);
+        }
+
+        // The parsed mesh outlives the builder: drop the reserve slack
+        o.vertices = std::move(m_buffer);
+        o.vertices.shrink_to_fit();
+        indices.shrink_to_fit();
+        m_buffer = {};
+        m_vertex_map = VertexDedupMap();
+        m_buckets.clear();
+        m_numIndices = 0;
+        m_index_hint = 0;
+        m_bmin = glm::vec3(FLT_MAX);
+        m_bmax = glm::vec3(-FLT_MAX);
+    }
+
+private:
+    void append_vertex(const tinyobj::index_t& idx) {
+        glm::vec3 v;
+        for (int c = 0; c < 3; c++) {
+            v[c] = m_positions[3 * idx.vertex_index + c];
+        }
+        m_bmin = glm::min(m_bmin, v);
+        m_bmax = glm::max(m_bmax, v);
+
+        glm::vec3 n(0.0f);
+        if (idx.normal_index >= 0) {
+            for (int c = 0; c < 3; c++) {
+                n[c] = m_normals[3 * idx.normal_index + c];
+            }
+        }
+
+        glm::vec2 tc(0.0f);
+        if (idx.texcoord_index >= 0) {
+            tc[0] = m_texcoords[2 * idx.texcoord_index];
+            tc[1] = 1.0f - m_texcoords[2 * idx.texcoord_index + 1];
+        }
+
+        // Store vertex data: position(3), normal(3), texcoords(2)
+        m_buffer.insert(m_buffer.end(), {
+                v[0], v[1], v[2],
+                n[0], n[1], n[2],
+                tc[0], tc[1]
+        });
+    }
+
+    const std::vector<float>& m_positions;
+    const std::vector<float>& m_normals;
+    const std::vector<float>& m_texcoords;
+
+    std::vector<float> m_buffer;
+    VertexDedupMap m_vertex_map;
+    std::vector<std::vector<uint32_t>> m_buckets; // [material + 1]
+    size_t m_numIndices = 0;
+    size_t m_index_hint = 0;
+    glm::vec3 m_bmin = glm::vec3(FLT_MAX);
+    glm::vec3 m_bmax = glm::vec3(-FLT_MAX);
+};
+
+using ShapeSink = std::function<void(ShapeBuilder&, const std::string&)>;
+
+// State of a streaming import. Only the vertex attributes are kept: faces
+// go straight into the current shape, which is handed to the sink as soon
+// as the next one starts.
+struct StreamingImport {
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> texcoords;  // (u, v) per `vt`
+    std::vector<tinyobj::material_t> materials;
+
+    ShapeBuilder shape{positions, normals, texcoords};
+    std::string name;
+    int material = -1;
+    ShapeSink sink;
+
+    // Records counted ahead, minus the ones parsed so far
+    tinyobj::record_counts_t counts;
+    size_t facesLeft = 0;
+    size_t faceVerticesLeft = 0;
+
+    std::vector<tinyobj::index_t> polygon;
+    std::vector<tinyobj::index_t> triangles;
+    size_t skippedFaces = 0;
+    size_t numTriangles = 0;
+
+    LoadProgress* progress = nullptr;
+
+    // 1-based or negative (relative) obj index to 0-based, -1 if missing or out of range
+    static int resolve(int idx, size_t count) {
+        long long i = (idx > 0) ? idx - 1 : static_cast<long long>(count) + idx;
+        return (idx == 0 || i < 0 || i >= static_cast<long long>(count)) ? -1 : static_cast<int>(i);
+    }
+
+    void start_shape(const std::string& shapeName) {
+        if (!shape.empty()) sink(shape, name);
+        name = shapeName;
+    }
+
+    void add_face(const tinyobj::index_t* indices, int num) {
+        facesLeft -= std::min<size_t>(facesLeft, 1);
+        faceVerticesLeft -= std::min<size_t>(faceVerticesLeft, num);
+
+        polygon.resize(num);
+        for (int k = 0; k < num; k++) {
+            polygon[k].vertex_index = resolve(indices[k].vertex_index, positions.size() / 3);
+            polygon[k].normal_index = resolve(indices[k].normal_index, normals.size() / 3);
+            polygon[k].texcoord_index = resolve(indices[k].texcoord_index, texcoords.size() / 2);
+            if (polygon[k].vertex_index < 0) {
+                skippedFaces++;
+                return;
+            }
+        }
+
+        triangles.clear();
+        if (!tinyobj::TriangulatePolygon(polygon.data(), num, positions, &triangles)) {
+            skippedFaces++;
+            return;
+        }
+
+        if (shape.empty()) {
+            // A shape has at most as many vertices as face vertices are left,
+            // and rarely more than the largest attribute count
+            size_t vertices = std::max({counts.num_vertices, counts.num_normals, counts.num_texcoords});
+            size_t faceVertices = faceVerticesLeft + num;
+            size_t faces = facesLeft + 1;
+            size_t triangles_left = (faceVertices > 2 * faces) ? faceVertices - 2 * faces : 0;
+            shape.reserve(std::min(vertices, faceVertices), 3 * triangles_left);
+        }
+        for (size_t t = 0; t < triangles.size(); t += 3) {
+            shape.add_triangle(&triangles[t], material);
+        }
+        numTriangles += triangles.size() / 3;
+    }
+};
+
+// Parses `filename` through tinyobj's callback API straight into shapes
+static bool import_obj_streaming(const std::string& filename, StreamingImport& import) {
+    tinyobj::callback_t cb;
+    cb.counts_cb = [](void* user, const tinyobj::record_counts_t& counts) {
+        auto& s = *static_cast<StreamingImport*>(user);
+        s.counts = counts;
+        s.facesLeft = counts.num_faces;
+        s.faceVerticesLeft = counts.num_face_vertices;
+        s.positions.reserve(3 * counts.num_vertices);
+        s.normals.reserve(3 * counts.num_normals);
+        s.texcoords.reserve(2 * counts.num_texcoords);
+    };
+    cb.vertex_cb = [](void* user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t) {
+        auto& s = *static_cast<StreamingImport*>(user);
+        s.positions.insert(s.positions.end(), {x, y, z});
+    };
+    cb.normal_cb = [](void* user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z) {
+        auto& s = *static_cast<StreamingImport*>(user);
+        s.normals.insert(s.normals.end(), {x, y, z});
+    };
+    cb.texcoord_cb = [](void* user, tinyobj::real_t u, tinyobj::real_t v, tinyobj::real_t) {
+        auto& s = *static_cast<StreamingImport*>(user);
+        s.texcoords.insert(s.texcoords.end(), {u, v});
+    };
+    cb.index_cb = [](void* user, tinyobj::index_t* indices, int num) {
+        static_cast<StreamingImport*>(user)->add_face(indices, num);
+    };
+    cb.usemtl_cb = [](void* user, const char*, int material_id) {
+        static_cast<StreamingImport*>(user)->material = material_id;
+    };
+    cb.mtllib_cb = [](void* user, const tinyobj::material_t* materials, int num) {
+        static_cast<StreamingImport*>(user)->materials.assign(materials, materials + num);
+    };
+    cb.group_cb = [](void* user, const char** names, int num) {
+        std::string name;
+        for (int i = 0; i < num; i++) {
+            if (i > 0) name += ' ';
+            name += names[i];
+        }
+        static_cast<StreamingImport*>(user)->start_shape(name);
+    };
+    cb.object_cb = [](void* user, const char* name) {
+        static_cast<StreamingImport*>(user)->start_shape(name);
+    };
+    if (import.progress) {
+        cb.progress_cb = [](void* user, size_t bytes, size_t total) {
+            auto& s = *static_cast<StreamingImport*>(user);
+            s.progress->bytesParsed = bytes;
+            s.progress->totalBytes = total;
+            s.progress->triangles = s.numTriangles;
+            return !s.progress->cancel.load();
+        };
+    }
+
+    std::string warn;
+    std::string err;
+    std::string base_dir = std::filesystem::path(filename).parent_path().string();
+    bool ok = tinyobj::LoadObjWithCallbackMapped(filename.c_str(), cb, &import, base_dir.c_str(), &warn, &err);
+    if (!err.empty()) {
+        std::cerr << "TinyObjReader Error: " << err << '\n';
+    }
+    if (!ok) return false;
+
+    if (!warn.empty()) {
+        std::cout << "TinyObjReader Warning: " << warn << '\n';
+    }
+    if (import.skippedFaces > 0) {
+        std::cout << std::format("Skipped {} degenerate or invalid faces\n", import.skippedFaces);
+    }
+
+    import.start_shape({});
+    return true;
+}
 
     std::string Mesh::get_base_dir(std::string_view filepath) {
         size_t pos = filepath.find_last_of("/\\");
@@ -37,12 +402,10 @@ std::vector<tinyobj::material_t> materials;
         }
     }
 
-    void Mesh::load_texture (std::string filename, const std::string& texname, DataTex& data) {
+    std::filesystem::path Mesh::resolve_texture_path(std::string filename, const std::string& texname) {
         fix_path(filename);
         std::filesystem::path texName = texname;
 
-        if (texName.empty() || data.textures.contains(texName)) return;
-
         std::filesystem::path base_dir = get_base_dir(filename);
         if (base_dir.empty()) {
             base_dir = ".";
@@ -55,244 +418,743 @@ std::vector<tinyobj::material_t> materials;
             texName = newTexPath;
             if (!std::filesystem::exists(newTexPath)) {
                 std::cerr << "Unable to find file: " << newTexPath << "\n";
-                exit(1);
+                return {};
             }
         }
+        return texName;
+    }
+
+    CpuTexture Mesh::decode_texture(const std::filesystem::path& path, const std::string& texname,
+                                    const LoadOptions& options) {
+        CpuTexture texture;
+        texture.name = texname;
+        if (options.texture_cache && TextureCache::load(path, texture)) {
+            std::cout << std::format("Loaded cached texture: \"{}\", w = {}, h = {}, {} mips\n",
+                                     path.string(), texture.width, texture.height, texture.mipSizes.size());
+            return texture;
+        }
 
-        GLuint texture_id;
         int w, h, comp;
-        unsigned char* image = stbi_load(texName.string().c_str(), &w, &h, &comp, STBI_default);
+        unsigned char* image = stbi_load(path.string().c_str(), &w, &h, &comp, STBI_default);
         if (!image) {
-            std::cerr << "Unable to load texture: " << texName << std::endl;
-            exit(1);
+            std::cerr << "Unable to load texture: " << path << std::endl;
+            return texture;
+        }
+        if (comp < 1 || comp > 4) {
+            std::cerr << "Unsupported texture format: " << path << std::endl;
+            stbi_image_free(image);
+            return texture;
         }
 
-        std::cout << "Loaded texture: " << texName << ", w = " << w
-                  << ", h = " << h << ", comp = " << comp << std::endl;
+        // One write, so lines from concurrent decodes do not interleave
+        std::cout << std::format("Loaded texture: \"{}\", w = {}, h = {}, comp = {}\n",
+                                 path.string(), w, h, comp);
 
+        texture.width = w;
+        texture.height = h;
+        texture.comp = comp;
+        texture.pixels.assign(image, image + static_cast<size_t>(w) * h * comp);
+        stbi_image_free(image);
+
+        if (options.texture_cache && options.bake_textures) {
+            TextureCache::compress(texture, TextureCache::is_normal_map(path));
+            if (!TextureCache::store(path, texture)) {
+                std::cerr << "Unable to write texture cache entry: " << TextureCache::entry_path(path) << "\n";
+            }
+        }
+        return texture;
+    }
+
+    void Mesh::decode_textures(const std::string& filename, const LoadOptions& options,
+                               CpuMesh& mesh, LoadProgress* progress) {
+        // Each texture once, in the order the materials reference it
+        std::vector<std::string> names;
+        for (const Material& m : mesh.materials) {
+            const texture_names& t = m.texNames;
+            for (const std::string* name : {&t.ambient_texname, &t.diffuse_texname,
+                                            &t.specular_texname, &t.specular_highlight_texname}) {
+                if (!name->empty() && std::ranges::find(names, *name) == names.end()) {
+                    names.push_back(*name);
+                }
+            }
+        }
+        // Missing files are left out, the materials using them go without
+        std::vector<std::filesystem::path> paths;
+        std::erase_if(names, [&](const std::string& name) {
+            std::filesystem::path path = resolve_texture_path(filename, name);
+            if (path.empty()) {
+                mesh.failedTextures.push_back(name);
+                return true;
+            }
+            paths.push_back(std::move(path));
+            return false;
+        });
+        if (names.empty()) return;
+        if (progress) progress->texturesTotal = names.size();
+
+        // stbi_load is reentrant, so the files are hashed and the images decoded
+        // on a pool of at most `texture_threads` threads (this one included)
+        auto for_each_texture = [&](const std::function<void(size_t)>& work) {
+            std::atomic<size_t> next_texture{0};
+            auto worker = [&]() {
+                for (size_t i = next_texture++; i < names.size(); i = next_texture++) {
+                    if (progress && progress->cancel) return;
+                    work(i);
+                }
+            };
+
+            size_t threads = std::min<size_t>(std::max(1, options.texture_threads), names.size());
+            std::vector<std::thread> pool;
+            for (size_t i = 1; i < threads; i++) {
+                pool.emplace_back(worker);
+            }
+            worker();
+            for (std::thread& t : pool) {
+                t.join();
+            }
+        };
+
+        // Textures already on the GPU are shared rather than decoded again:
+        // packed ones only as the whole set, as the arrays hold them together.
+        // Only with loads that upload them alike, streamed (managed by the
+        // TextureStreamer) or not, and block-compressed from the cache or not
+        bool variant[] = {options.texture_streaming, options.texture_cache, options.bake_textures};
+        std::vector<uint64_t> keys(names.size());
+        for_each_texture([&](size_t i) {
+            keys[i] = TextureCache::hash_bytes(variant, sizeof(variant), TextureCache::source_hash(paths[i]));
+        });
+        if (progress && progress->cancel) return;
+
+        std::vector<bool> shared(names.size(), false);
+        if (options.texture_arrays && !options.texture_streaming) {
+            uint64_t key = TextureCache::hash_bytes(&options.resample_textures, sizeof(bool));
+            for (size_t i = 0; i < names.size(); i++) {
+                key = TextureCache::hash_bytes(names[i].data(), names[i].size() + 1, key);
+                key = TextureCache::hash_bytes(&keys[i], sizeof(uint64_t), key);
+            }
+            mesh.textureSetKey = key;
+            if (ResourceRef set = ResourceCache::acquire(key)) {
+                mesh.shared.push_back(std::move(set));
+                shared.assign(names.size(), true);
+            }
+        } else {
+            for (size_t i = 0; i < names.size(); i++) {
+                if (ResourceRef texture = ResourceCache::acquire(keys[i])) {
+                    mesh.shared.push_back(std::move(texture));
+                    shared[i] = true;
+                }
+            }
+        }
+
+        // Appended in completion order, which is also the order they are uploaded in.
+        // Those that fail to decode are left out, like missing ones
+        std::mutex textures_mutex;
+        for_each_texture([&](size_t i) {
+            CpuTexture texture;
+            texture.name = names[i];
+            bool failed = false;
+            if (!shared[i]) {
+                texture = decode_texture(paths[i], names[i], options);
+                failed = texture.pixels.empty();
+                if (!failed && options.texture_streaming) TextureStreamer::build_mips(texture);
+            }
+            texture.key = keys[i];
+            std::lock_guard<std::mutex> lock(textures_mutex);
+            if (failed) {
+                mesh.failedTextures.push_back(names[i]);
+            } else {
+                mesh.textures.push_back(std::move(texture));
+            }
+            if (progress) progress->texturesDecoded++;
+        });
+    }
+
+    GLuint Mesh::upload_texture(const CpuTexture& texture, bool fill) {
+        GLuint texture_id;
         glGenTextures(1, &texture_id);
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        GLState::bind_texture(GL_TEXTURE_2D, texture_id);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        GLint format;
-        if (comp == 1) format = GL_RED;
-        else if (comp == 2) format = GL_RG;
-        else if (comp == 3) format = GL_RGB;
-        else if (comp == 4) format = GL_RGBA;
-        else {
-            std::cerr << "Unsupported texture format\n";
-            std::exit(1);
+        // With `fill`, the pixels are staged in a pixel unpack buffer and the
+        // calls below source them from it (the null pointers are offsets into
+        // it), so the copy into the texture is done by the driver. Without it
+        // they only allocate the texture's storage
+        GLuint pbo = 0;
+        if (fill) {
+            glGenBuffers(1, &pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, texture.pixels.size(), texture.pixels.data(), GL_STREAM_DRAW);
         }
 
-        glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, image);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        if (texture.compressed()) {
+            // The cached mip chain takes the place of glGenerateMipmap
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(texture.mipSizes.size()) - 1);
+            size_t offset = 0;
+            for (size_t level = 0; level < texture.mipSizes.size(); level++) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), texture.compressedFormat,
+                                       std::max(1, texture.width >> level), std::max(1, texture.height >> level), 0,
+                                       static_cast<GLsizei>(texture.mipSizes[level]),
+                                       fill ? reinterpret_cast<const void*>(offset) : nullptr);
+                offset += texture.mipSizes[level];
+            }
+        } else {
+            // Rows of 1 and 3 channel images are not 4 byte aligned
+            GLenum format = texture.format();
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, texture.width, texture.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            if (fill) glGenerateMipmap(GL_TEXTURE_2D);
+        }
 
-        glBindTexture(GL_TEXTURE_2D, 0);
-        stbi_image_free(image);
+        if (fill) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &pbo);
+        }
+        GLState::bind_texture(GL_TEXTURE_2D, 0);
+        return texture_id;
+    }
+
+    void Mesh::bind_material(const DataTex& data, int material, bool texture_arrays) {
+        // The rest of the material is in the table, read by index. Packed
+        // meshes bind their arrays once per draw() and only select layers
+        // through its textureSlots
+        s_uniforms.material.set(material % UniformBlocks::materials_per_range);
+        if (texture_arrays) return;
 
-        data.textures.try_emplace(texname, texture_id);
+        // Bind each texture type (Ambient, Diffuse, Specular, Specular highlight)
+        // to its own texture unit; the samplers are set up once per draw()
+        const Material& mat = data.m_materials[material];
+        for (int unit = 0; unit < 4; unit++) {
+            GLState::active_texture(GL_TEXTURE0 + unit);
+            GLState::bind_texture(GL_TEXTURE_2D, mat.textures[unit]);
+        }
     }
 
-    void Mesh::bind_material_textures(const texture_names& mat, GLuint programId, DataTex& data) {
-        // Activate and bind each texture type you care about
-        // (Ambient, Diffuse, Specular, etc.) to different texture units.
-        // Then set the appropriate uniform sampler in the shader.
+    void Mesh::resolve_uniforms(GLuint program) {
+        s_uniforms = {program,
+                      {program, "u_posOffset"}, {program, "u_posScale"}, {program, "u_octNormals"},
+                      {program, "u_useTextureArrays"}, {program, "u_material"}};
+
+        // Each texture type keeps its unit, and the array samplers get units
+        // of their own even when unused, as samplers of different types must
+        // not share a unit
+        Uniform<int>(program, "u_ambientTex").set(0);
+        Uniform<int>(program, "u_diffuseTex").set(1);
+        Uniform<int>(program, "u_specularTex").set(2);
+        Uniform<int>(program, "u_specularHighTex").set(3);
+        GLint array_units[TextureAtlas::max_arrays];
+        for (int i = 0; i < TextureAtlas::max_arrays; i++) {
+            array_units[i] = TextureAtlas::first_unit + i;
+        }
+        Uniform<int>(program, "u_textureArrays").set(array_units, TextureAtlas::max_arrays);
+    }
 
-        auto try_bind = [&programId, &data](const std::string& texName, const std::string &uniformName, int unit) {
-            if (!texName.empty() && data.textures.contains(texName)) {
-                glActiveTexture(GL_TEXTURE0 + unit);
-                glBindTexture(GL_TEXTURE_2D, data.textures[texName]);
-                glUniform1i(glGetUniformLocation(programId, uniformName.c_str()), unit);
+    void Mesh::prepare_draw_object(CpuDrawObject& o, const LoadOptions& options) {
+        std::vector<float>& buffer = o.vertices;
+        std::vector<uint32_t>& indices = o.indices;
+
+        if (options.optimize_vertex_cache && !indices.empty()) {
+            size_t numVertices = buffer.size() / (3 + 3 + 2);
+            float acmr = VertexCache::acmr(indices, numVertices);
+            float atvr = VertexCache::atvr(indices, numVertices);
+
+            // Triangles are reordered within each sub-draw only
+            for (const SubDraw& sd : o.subDraws) {
+                std::vector<uint32_t> range(indices.begin() + sd.indexOffset,
+                                            indices.begin() + sd.indexOffset + sd.indexCount);
+                VertexCache::optimize(range, numVertices);
+                std::ranges::copy(range, indices.begin() + sd.indexOffset);
             }
-        };
+            VertexCache::reorder_vertices(indices, buffer, 3 + 3 + 2);
 
-        try_bind(mat.ambient_texname,            "u_ambientTex",         0);
-        try_bind(mat.diffuse_texname,            "u_diffuseTex",         1);
-        try_bind(mat.specular_texname,           "u_specularTex",        2);
-        try_bind(mat.specular_highlight_texname, "u_specularHighTex",    3);
-    }
+            std::cout << std::format("Vertex cache ({} entries) for shape \"{}\": ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}\n",
+                                     VertexCache::cache_size, o.name,
+                                     acmr, VertexCache::acmr(indices, numVertices),
+                                     atvr, VertexCache::atvr(indices, numVertices));
+        }
 
-    DataTex Mesh::load_obj(const std::string &filename) {
+        // How often the textures repeat across the object
+        glm::vec2 uvmin(FLT_MAX), uvmax(-FLT_MAX);
+        for (size_t i = 0; i < buffer.size(); i += 3 + 3 + 2) {
+            glm::vec2 uv(buffer[i + 6], buffer[i + 7]);
+            uvmin = glm::min(uvmin, uv);
+            uvmax = glm::max(uvmax, uv);
+        }
+        o.uvSpan = buffer.empty() ? 0.0f : std::max(uvmax.x - uvmin.x, uvmax.y - uvmin.y);
 
-        tinyobj::ObjReaderConfig config;
-        config.triangulation_method = "earcut";
-        config.triangulate = true;
-        config.vertex_color = false;
+        o.vertexFormat = options.vertex_format;
+        if (options.vertex_format == VertexFormat::Quantized) {
+            // Positions are stored relative to the bounds of this object
+            glm::vec3 qmin(FLT_MAX);
+            glm::vec3 qmax(-FLT_MAX);
+            for (size_t i = 0; i < buffer.size(); i += 3 + 3 + 2) {
+                glm::vec3 p(buffer[i], buffer[i + 1], buffer[i + 2]);
+                qmin = glm::min(qmin, p);
+                qmax = glm::max(qmax, p);
+            }
 
-        DataTex data = DataTex();
-        // Each vertex is 8 floats: pos(3), normal(3), tex(2)
-        GLsizei stride = (3 + 3 + 2) * sizeof(float);
-        tinyobj::ObjReader reader;
-        if (!reader.ParseFromFile(filename, config)) {
-            if (!reader.Error().empty()) {
-                std::cerr << "TinyObjReader Error: " << reader.Error() << '\n';
+            o.packed = Quantize::encode(buffer, qmin, qmax);
+
+            if (options.report_quantization_error) {
+                QuantizationError e = Quantize::measure(buffer, o.packed, qmin, qmax);
+                std::cout << std::format("Quantization error for shape \"{}\": position max {:.3g} (rms {:.3g}), "
+                                         "normal max {:.3f} deg, texcoord max {:.3g}\n",
+                                         o.name, e.maxPosition, e.rmsPosition,
+                                         e.maxNormalDegrees, e.maxTexcoord);
             }
-            return {};
+
+            o.posOffset = qmin;
+            o.posScale = qmax - qmin;
+            std::vector<float>().swap(buffer);
         }
 
-        if (!reader.Warning().empty()) {
-            std::cout << "TinyObjReader Warning: " << reader.Warning() << '\n';
+        // 16-bit indices whenever they fit
+        if (o.numVertices() <= 65536) {
+            o.shortIndices.assign(indices.begin(), indices.end());
+            std::vector<uint32_t>().swap(indices);
         }
 
-        auto& inattrib = reader.GetAttrib();
-        auto& inshapes = reader.GetShapes();
-        materials = reader.GetMaterials();
+        // Identical geometry gets the same key, whatever file it came from
+        uint64_t layout[] = {static_cast<uint64_t>(o.vertexFormat), o.vertex_bytes(), o.index_bytes()};
+        o.key = TextureCache::hash_bytes(layout, sizeof(layout));
+        o.key = TextureCache::hash_bytes(o.vertex_data(), o.vertex_bytes(), o.key);
+        o.key = TextureCache::hash_bytes(o.index_data(), o.index_bytes(), o.key);
+    }
 
-        // Append a default material
-        materials.emplace_back();
+    DrawObject Mesh::upload_draw_object(const CpuDrawObject& c, bool fill, std::vector<ResourceRef>& resources) {
+        DrawObject o{};
+        o.subDraws = c.subDraws;
+        o.bmin = c.bmin;
+        o.bmax = c.bmax;
+        o.uvSpan = c.uvSpan;
+        o.placements = c.placements;
+        o.bvh = c.bvh;
+        o.numVertices = c.numVertices();
+        if (o.numVertices == 0) return o;
 
-        // Load textures
-        for (const tinyobj::material_t& mat : materials) {
-            if(!mat.ambient_texname.empty()) load_texture(filename, mat.ambient_texname, data);
-            if(!mat.diffuse_texname.empty()) load_texture(filename, mat.diffuse_texname, data);
-            if(!mat.specular_texname.empty()) load_texture(filename, mat.specular_texname, data);
-            if(!mat.specular_highlight_texname.empty()) load_texture(filename, mat.specular_highlight_texname, data);
+        o.vertexFormat = c.vertexFormat;
+        o.posOffset = c.posOffset;
+        o.posScale = c.posScale;
+        o.indexType = c.shortIndices.empty() ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+        o.numTriangles = c.index_count() / 3;
+
+        // The same geometry loaded before shares its buffers
+        ResourceRef buffers = ResourceCache::acquire(c.key);
+        if (!buffers) {
+            GLuint vao;
+            GLuint vbo;
+            glGenVertexArrays(1, &vao);
+            GLState::bind_vertex_array(vao);
+            glGenBuffers(1, &vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+            glBufferData(GL_ARRAY_BUFFER, c.vertex_bytes(), fill ? c.vertex_data() : nullptr, GL_STATIC_DRAW);
+            set_vertex_attributes(c.vertexFormat);
+
+            // Element buffer, bound to the VAO
+            GLuint ebo;
+            glGenBuffers(1, &ebo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, c.index_bytes(), fill ? c.index_data() : nullptr, GL_STATIC_DRAW);
+
+            GLState::bind_vertex_array(0);
+            SharedResource resource{.texture = 0, .arrays = {}, .slots = {}, .vao = vao, .vbo = vbo, .ebo = ebo};
+            buffers = ResourceCache::insert(c.key, std::move(resource), c.vertex_bytes() + c.index_bytes());
         }
 
-        glm::vec3 bmin(FLT_MAX);
-        glm::vec3 bmax(-FLT_MAX);
+        o.vao = buffers->vao;
+        o.vbo = buffers->vbo;
+        o.ebo = buffers->ebo;
+        resources.push_back(std::move(buffers));
+        return o;
+    }
 
-        for (int s = 0; s < inshapes.size(); s++) {
-            DrawObject o{};
-            std::vector<float> buffer;  // pos(3), normal(3), tex(2)
+    void Mesh::set_vertex_attributes(VertexFormat format) {
+        glEnableVertexAttribArray(0); // pos
+        glEnableVertexAttribArray(1); // normal
+        glEnableVertexAttribArray(2); // texcoord
 
-            for (size_t f = 0; f < inshapes[s].mesh.indices.size() / 3; f++) {
-                tinyobj::index_t idx0 = inshapes[s].mesh.indices[3 * f + 0];
-                tinyobj::index_t idx1 = inshapes[s].mesh.indices[3 * f + 1];
-                tinyobj::index_t idx2 = inshapes[s].mesh.indices[3 * f + 2];
+        if (format == VertexFormat::Quantized) {
+            GLsizei qstride = sizeof(QuantizedVertex);
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, qstride, (void*)offsetof(QuantizedVertex, position));
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, qstride, (void*)offsetof(QuantizedVertex, normal));
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, qstride, (void*)offsetof(QuantizedVertex, texcoord));
+        } else {
+            // Each vertex is 8 floats: pos(3), normal(3), tex(2)
+            GLsizei stride = (3 + 3 + 2) * sizeof(float);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
+        }
+    }
 
-                int current_material_id = inshapes[s].mesh.material_ids[f];
-                if ((current_material_id < 0) ||
-                    (current_material_id >= static_cast<int>(materials.size()))) {
-                    current_material_id = static_cast<int>(materials.size()) - 1;
-                }
+    void Mesh::set_instances(DataTex& data, std::vector<glm::mat4> transforms) {
+        data.m_instances.transforms = std::move(transforms);
+        data.m_instances.dirty = true;
+        data.m_instances.version++;
+    }
+
+    std::vector<glm::mat4> Mesh::instance_transforms(const DataTex& data, std::vector<GLsizei>& counts) {
+        counts.clear();
+        const Instances& instances = data.m_instances;
+        bool placed = std::ranges::any_of(data.m_draw_objects, [](const DrawObject& o) { return !o.placements.empty(); });
+        if (instances.transforms.empty() && !placed) return {};
+
+        std::vector<glm::mat4> copies = instances.transforms;
+        if (copies.empty()) copies.push_back(glm::mat4(1.0f));
+        std::vector<glm::mat4> combined;
+        for (const DrawObject& o : data.m_draw_objects) {
+            size_t first = combined.size();
+            for (const glm::mat4& copy : copies) {
+                if (o.placements.empty()) combined.push_back(copy);
+                for (const glm::mat4& placement : o.placements) combined.push_back(copy * placement);
+            }
+            counts.push_back(static_cast<GLsizei>(combined.size() - first));
+        }
+        return combined;
+    }
+
+    void Mesh::upload_instances(DataTex& data) {
+        Instances& instances = data.m_instances;
+        instances.dirty = false;
+        std::vector<glm::mat4> combined = instance_transforms(data, instances.counts);
+        if (combined.empty()) return;
+
+        if (instances.buffer == 0) glGenBuffers(1, &instances.buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, instances.buffer);
+        glBufferData(GL_ARRAY_BUFFER, combined.size() * sizeof(glm::mat4), combined.data(), GL_DYNAMIC_DRAW);
+
+        // The draw objects' VAOs may be shared with other DataTex, so the
+        // instance attributes go into VAOs of this DataTex's own
+        if (instances.vaos.empty()) {
+            for (const DrawObject& o : data.m_draw_objects) {
+                GLuint vao = 0;
+                if (o.vao != 0) {
+                    glGenVertexArrays(1, &vao);
+                    GLState::bind_vertex_array(vao);
+                    glBindBuffer(GL_ARRAY_BUFFER, o.vbo);
+                    set_vertex_attributes(o.vertexFormat);
+                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, o.ebo);
 
-                o.ambient = {
-                        materials[current_material_id].ambient[0],
-                        materials[current_material_id].ambient[1],
-                        materials[current_material_id].ambient[2]
-                };
-                o.shininess = materials[current_material_id].shininess;
-
-                glm::mat3x2 tc(0.0f);
-                if (!inattrib.texcoords.empty() && ((idx0.texcoord_index >= 0) ||
-                                                    (idx1.texcoord_index >= 0) ||
-                                                    (idx2.texcoord_index >= 0))) {
-                    tc[0][0] = inattrib.texcoords[2 * idx0.texcoord_index];
-                    tc[0][1] = 1.0f - inattrib.texcoords[2 * idx0.texcoord_index + 1];
-                    tc[1][0] = inattrib.texcoords[2 * idx1.texcoord_index];
-                    tc[1][1] = 1.0f - inattrib.texcoords[2 * idx1.texcoord_index + 1];
-                    tc[2][0] = inattrib.texcoords[2 * idx2.texcoord_index];
-                    tc[2][1] = 1.0f - inattrib.texcoords[2 * idx2.texcoord_index + 1];
+                    for (GLuint c = 0; c < 4; c++) {
+                        glEnableVertexAttribArray(3 + c);
+                        glVertexAttribDivisor(3 + c, 1);
+                    }
+                    GLState::bind_vertex_array(0);
                 }
+                instances.vaos.push_back(vao);
+            }
+        }
 
-                glm::mat3 v(0.0f);
-                for (int k = 0; k < 3; k++) {
-                    int f0 = idx0.vertex_index;
-                    int f1 = idx1.vertex_index;
-                    int f2 = idx2.vertex_index;
-                    v[0][k] = inattrib.vertices[3 * f0 + k];
-                    v[1][k] = inattrib.vertices[3 * f1 + k];
-                    v[2][k] = inattrib.vertices[3 * f2 + k];
-
-                    bmin[k] = std::min({bmin[k], v[0][k], v[1][k], v[2][k]});
-                    bmax[k] = std::max({bmax[k], v[0][k], v[1][k], v[2][k]});
+        // One mat4 per instance, a column per attribute, starting at the draw
+        // object's part of the buffer (no base instance before GL 4.2)
+        glBindBuffer(GL_ARRAY_BUFFER, instances.buffer);
+        size_t offset = 0;
+        for (size_t i = 0; i < instances.vaos.size(); i++) {
+            if (instances.vaos[i] != 0) {
+                GLState::bind_vertex_array(instances.vaos[i]);
+                for (GLuint c = 0; c < 4; c++) {
+                    glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                          (void*)(offset + c * sizeof(glm::vec4)));
                 }
+            }
+            offset += instances.counts[i] * sizeof(glm::mat4);
+        }
+        GLState::bind_vertex_array(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
 
-                glm::mat3 n(0.0f);
-                if (!inattrib.normals.empty()) {
-                    int nf0 = idx0.normal_index;
-                    int nf1 = idx1.normal_index;
-                    int nf2 = idx2.normal_index;
-                    if ((nf0 >= 0) || (nf1 >= 0) || (nf2 >= 0)) {
-                        for (int k = 0; k < 3; k++) {
-                            n[0][k] = inattrib.normals[3 * nf0 + k];
-                            n[1][k] = inattrib.normals[3 * nf1 + k];
-                            n[2][k] = inattrib.normals[3 * nf2 + k];
-                        }
-                    }
+    LoadOptions Mesh::load_options() {
+        return {streaming_import, optimize_vertex_cache, vertex_format, report_quantization_error,
+                texture_decode_threads, TextureCache::enabled && TextureCache::supported,
+                TextureCache::bake_on_miss, texture_arrays, resample_texture_arrays,
+                TextureStreamer::enabled, instance_duplicates, BVH::enabled, BVH::cache_enabled};
+    }
+
+    CpuMesh Mesh::parse(const std::string &filename, const LoadOptions& options, LoadProgress* progress) {
+
+        CpuMesh mesh;
+        std::vector<tinyobj::material_t> materials;
+
+        // Finishes each shape right away, so the builder only ever holds one.
+        // A repeat of an earlier shape only adds a placement to it
+        ShapeInstancer instancer;
+        ShapeSink sink = [&](ShapeBuilder& shape, const std::string& name) {
+            CpuDrawObject o;
+            o.name = name;
+            shape.finish(o);
+            if (!o.vertices.empty()) {
+                glm::mat4 placement;
+                auto prepare = [&](CpuDrawObject& shape) { prepare_draw_object(shape, options); };
+                int original = -1;
+                if (options.instance_duplicates) {
+                    original = instancer.match(o, mesh.objects, prepare, placement);
+                } else {
+                    prepare(o);
+                }
+                if (original >= 0) {
+                    std::vector<glm::mat4>& placements = mesh.objects[original].placements;
+                    if (placements.empty()) placements.push_back(glm::mat4(1.0f));
+                    placements.push_back(placement);
+                    return;
                 }
+            }
+            mesh.objects.push_back(std::move(o));
+        };
+
+        if (options.streaming_import) {
+            // Single pass: faces are turned into vertices as they are parsed,
+            // without tinyobj's attrib_t/shape_t copy of the whole file
+            StreamingImport import;
+            import.sink = sink;
+            import.progress = progress;
+            if (!import_obj_streaming(filename, import)) {
+                return {};
+            }
+            materials = std::move(import.materials);
+        } else {
+            tinyobj::ObjReaderConfig config;
+            config.triangulation_method = "earcut";
+            config.triangulate = true;
+            config.vertex_color = false;
+            config.use_mmap = true;  // Parse straight from the mapped .obj/.mtl
+            config.num_threads = 0;  // Parse in parallel on all cores
+
+            // tinyobj's reader has no progress reporting: the file counts as
+            // parsed once it returns, and cancelling takes effect after that
+            std::error_code ec;
+            size_t file_size = std::filesystem::file_size(filename, ec);
+            if (progress) progress->totalBytes = ec ? 0 : file_size;
 
-                // Store vertex data: position(3), normal(3), texcoords(2)
-                for (int k = 0; k < 3; k++) {
-                    buffer.insert(buffer.end(), {
-                            v[k][0], v[k][1], v[k][2],
-                            n[k][0], n[k][1], n[k][2],
-                            tc[k][0], tc[k][1]
-                    });
+            tinyobj::ObjReader reader;
+            if (!reader.ParseFromFile(filename, config)) {
+                if (!reader.Error().empty()) {
+                    std::cerr << "TinyObjReader Error: " << reader.Error() << '\n';
                 }
+                return {};
             }
 
-            if (!inshapes[s].mesh.material_ids.empty()
-                && inshapes[s].mesh.material_ids.size() > s) {
-                // Use material ID of the first face
-                o.material_id = inshapes[s].mesh.material_ids[0];
-            } else {
-                // = ID for default material.
-                o.material_id = materials.size() - 1;
+            if (!reader.Warning().empty()) {
+                std::cout << "TinyObjReader Warning: " << reader.Warning() << '\n';
+            }
+
+            auto& inattrib = reader.GetAttrib();
+            auto& inshapes = reader.GetShapes();
+            materials = reader.GetMaterials();
+            if (progress) progress->bytesParsed = progress->totalBytes.load();
+
+            ShapeBuilder shape(inattrib.vertices, inattrib.normals, inattrib.texcoords);
+            for (const tinyobj::shape_t& inshape : inshapes) {
+                if (progress && progress->cancel) return {};
+
+                const std::vector<tinyobj::index_t>& shape_indices = inshape.mesh.indices;
+                shape.reserve(shape_indices.size(), shape_indices.size());
+
+                for (size_t f = 0; f < shape_indices.size() / 3; f++) {
+                    int current_material_id = inshape.mesh.material_ids[f];
+                    if (current_material_id >= static_cast<int>(materials.size())) {
+                        current_material_id = -1;
+                    }
+                    shape.add_triangle(&shape_indices[3 * f], current_material_id);
+                }
+                sink(shape, inshape.name);
+                if (progress) progress->triangles += shape_indices.size() / 3;
             }
+        }
 
-            if (o.material_id < materials.size()) {
-                tinyobj::material_t mat = materials[o.material_id];
-                o.texNames.ambient_texname = mat.ambient_texname;
-                o.texNames.diffuse_texname = mat.diffuse_texname;
-                o.texNames.specular_texname = mat.specular_texname;
-                o.texNames.specular_highlight_texname = mat.specular_highlight_texname;
+        // Append a default material
+        materials.emplace_back();
+        int default_material = static_cast<int>(materials.size()) - 1;
+        for (CpuDrawObject& o : mesh.objects) {
+            for (SubDraw& sd : o.subDraws) {
+                if (sd.material_id < 0) sd.material_id = default_material;
             }
+        }
+
+        for (const tinyobj::material_t& mat : materials) {
+            Material m;
+            m.ambient = {mat.ambient[0], mat.ambient[1], mat.ambient[2]};
+            m.shininess = mat.shininess;
+            m.texNames = {mat.ambient_texname, mat.diffuse_texname, mat.specular_texname, mat.specular_highlight_texname};
+            mesh.materials.push_back(m);
+        }
+
+        if (instancer.repeats() > 0) {
+            std::cout << std::format("{} shapes repeat earlier ones, drawn as their instances\n", instancer.repeats());
+        }
 
-            if (!buffer.empty()) {
-                GLuint vao;
-                GLuint vbo;
-                glGenVertexArrays(1, &vao);
-                glBindVertexArray(vao);
-                glGenBuffers(1, &vbo);
-                glBindBuffer(GL_ARRAY_BUFFER, vbo);
-                glBufferData(GL_ARRAY_BUFFER, buffer.size() * sizeof(float), buffer.data(), GL_STATIC_DRAW);
+        if (options.build_bvh) {
+            BVH::prepare(mesh, options, progress);
+            if (progress && progress->cancel) return {};
+        }
+
+        decode_textures(filename, options, mesh, progress);
+        if (progress && progress->cancel) return {};
+
+        // Streamed textures need their own mip levels, so they are not packed.
+        // A shared texture set needs no packing either
+        mesh.streamTextures = options.texture_streaming;
+        if (mesh.textureSetKey != 0 && mesh.shared.empty()) {
+            if (!TextureAtlas::pack(mesh, options.resample_textures)) mesh.textureSetKey = 0;
+        }
 
-                glEnableVertexAttribArray(0); // pos
-                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        return mesh;
+    }
 
-                glEnableVertexAttribArray(1); // normal
-                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+    DataTex Mesh::upload(const CpuMesh& mesh, bool fill) {
 
-                glEnableVertexAttribArray(2); // texcoord
-                glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
+        DataTex data = DataTex();
 
-                glBindVertexArray(0);
-                o.material_size = materials.size();
-                o.vao = vao;
-                o.vbo = vbo;
-                o.numTriangles = buffer.size() / (3 + 3 + 2) / 3;
-                o.bmin = bmin;
-                o.bmax = bmax;
+        // Every texture, or the arrays of the whole texture set, comes from the
+        // ResourceCache if another load already uploaded it
+        const std::unordered_map<std::string, int>* slots = nullptr;
+        if (mesh.textureSetKey != 0) {
+            ResourceRef set = ResourceCache::acquire(mesh.textureSetKey);
+            if (!set) {
+                SharedResource arrays;
+                size_t bytes = 0;
+                for (const CpuTextureArray& array : mesh.textureArrays) {
+                    arrays.arrays.push_back(TextureAtlas::upload(mesh, array, fill));
+                    bytes += mesh.textures[array.layers[0]].pixels.size() * array.layers.size();
+                }
+                arrays.slots = mesh.textureSlots;
+                set = ResourceCache::insert(mesh.textureSetKey, std::move(arrays), bytes);
             }
+            data.m_texture_arrays = set->arrays;
+            slots = &set->slots;
+            data.m_resources.push_back(std::move(set));
+        } else {
+            for (const CpuTexture& texture : mesh.textures) {
+                ResourceRef shared = ResourceCache::acquire(texture.key);
+                if (!shared) {
+                    GLuint id = mesh.streamTextures ? TextureStreamer::add(texture) : upload_texture(texture, fill);
+                    SharedResource resource{.texture = id, .arrays = {}, .slots = {}, .vao = 0, .vbo = 0, .ebo = 0};
+                    shared = ResourceCache::insert(texture.key, std::move(resource), texture.pixels.size());
+                }
+                data.textures.try_emplace(texture.name, shared->texture);
+                data.m_resources.push_back(std::move(shared));
+            }
+        }
+
+        // Resolve the material state once, so drawing needs no lookups
+        auto texture_id = [&data](const std::string& texName) -> GLuint {
+            auto it = data.textures.find(texName);
+            return (texName.empty() || it == data.textures.end()) ? 0 : it->second;
+        };
+        set_instances(data, mesh.instances);
+
+        std::vector<Material> materials = mesh.materials;
+        if (slots) TextureAtlas::assign_slots(materials, *slots);
+        for (Material& m : materials) {
+            m.textures[0] = texture_id(m.texNames.ambient_texname);
+            m.textures[1] = texture_id(m.texNames.diffuse_texname);
+            m.textures[2] = texture_id(m.texNames.specular_texname);
+            m.textures[3] = texture_id(m.texNames.specular_highlight_texname);
+        }
+        data.m_materials = std::move(materials);
+        data.m_material_table = UniformBlocks::create_materials(data.m_materials);
 
-            data.m_draw_objects.push_back(o);
+        for (const CpuDrawObject& o : mesh.objects) {
+            data.m_draw_objects.push_back(upload_draw_object(o, fill, data.m_resources));
         }
-        materials.clear();
+
+        // Draw order sorted by material, so each material is bound once per frame
+        for (uint32_t i = 0; i < data.m_draw_objects.size(); i++) {
+            for (uint32_t j = 0; j < data.m_draw_objects[i].subDraws.size(); j++) {
+                data.m_draw_order.push_back({i, j});
+            }
+        }
+        std::ranges::stable_sort(data.m_draw_order, {}, [&data](const DrawItem& item) {
+            return data.m_draw_objects[item.object].subDraws[item.subDraw].material_id;
+        });
+
+        // Boxes for culling, covering the instances set above
+        FrustumCuller::build(data);
+
+        std::cout << std::format("{} draw objects, {} sub-draws, {} materials\n",
+                                 data.m_draw_objects.size(), data.m_draw_order.size(), data.m_materials.size());
+
         return data;
     }
 
+    DataTex Mesh::load_obj(const std::string &filename) {
+        return upload(parse(filename, load_options()));
+    }
+
+    void Mesh::set_draw_state(GLenum face, GLenum type) {
+        // The same for every mesh, so it reaches GL once
+        GLState::polygon_mode(face, type);
+        GLState::enable(GL_POLYGON_OFFSET_FILL);
+        GLState::enable(GL_DEPTH_TEST);
+        GLState::enable(GL_BLEND);
+        GLState::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        GLState::polygon_offset(1.0f, 1.0f);
+    }
+
     void Mesh::draw(GLenum face, GLenum type, GLuint programID, DataTex& data) {
 
-        glPolygonMode(face, type);
-        glEnable(GL_POLYGON_OFFSET_FILL);
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glPolygonOffset(1.0, 1.0);
-        for (auto const& o : data.m_draw_objects) {
-            glBindVertexArray(o.vao);
-            // Bind texture if valid
-            if (o.material_id < o.material_size) {
-                bind_material_textures(o.texNames, programID, data);
+        set_draw_state(face, type);
+
+        // Handles are looked up once per program, not per frame
+        if (programID != s_uniforms.program) resolve_uniforms(programID);
+
+        // Packed meshes bind all of their textures here, once
+        bool texture_arrays = !data.m_texture_arrays.empty();
+        s_uniforms.useTextureArrays.set(texture_arrays);
+        for (size_t i = 0; i < data.m_texture_arrays.size(); i++) {
+            GLState::active_texture(GL_TEXTURE0 + TextureAtlas::first_unit + static_cast<GLenum>(i));
+            GLState::bind_texture(GL_TEXTURE_2D_ARRAY, data.m_texture_arrays[i]);
+        }
+
+        // Without instances the transform attributes are disabled, and read
+        // their current value instead: the identity
+        if (data.m_instances.dirty) upload_instances(data);
+        bool instanced = !data.m_instances.counts.empty();
+        if (!instanced) {
+            glm::mat4 identity(1.0f);
+            for (GLuint c = 0; c < 4; c++) {
+                glVertexAttrib4fv(3 + c, glm::value_ptr(identity[c]));
+            }
+        }
+
+        // Draws are sorted by material: state only changes between runs, and
+        // the range of the material table bound only when they leave it
+        const DrawObject* current_object = nullptr;
+        int current_material = -1;
+        int current_range = -1;
+        for (const DrawItem& item : data.m_draw_order) {
+            const DrawObject& o = data.m_draw_objects[item.object];
+            const SubDraw& sd = o.subDraws[item.subDraw];
+            if (o.vao == 0 || !data.m_bounds.visible[item.object]) continue;
+
+            if (&o != current_object) {
+                GLState::bind_vertex_array(instanced ? data.m_instances.vaos[item.object] : o.vao);
+
+                // Dequantization of the vertex attributes
+                s_uniforms.posOffset.set(o.posOffset);
+                s_uniforms.posScale.set(o.posScale);
+                s_uniforms.octNormals.set(o.vertexFormat == VertexFormat::Quantized);
+                current_object = &o;
             }
 
-            glUniform3fv(glGetUniformLocation(programID, "ambient"), 1, glm::value_ptr(o.ambient));
-            glUniform1fv(glGetUniformLocation(programID, "shininess"), 1, &o.shininess);
+            if (sd.material_id != current_material) {
+                int range = sd.material_id / UniformBlocks::materials_per_range;
+                if (range != current_range) {
+                    UniformBlocks::bind_materials(data.m_material_table, range);
+                    current_range = range;
+                }
+                bind_material(data, sd.material_id, texture_arrays);
+                current_material = sd.material_id;
+            }
 
-            glDrawArrays(GL_TRIANGLES, 0, 3 * o.numTriangles);
-            glBindVertexArray(0);
+            size_t index_size = (o.indexType == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(uint32_t);
+            if (instanced) {
+                glDrawElementsInstanced(GL_TRIANGLES, sd.indexCount, o.indexType,
+                                        (void*)(sd.indexOffset * index_size), data.m_instances.counts[item.object]);
+            } else {
+                glDrawElements(GL_TRIANGLES, sd.indexCount, o.indexType, (void*)(sd.indexOffset * index_size));
+            }
         }
-    }
\ No newline at end of file
+        // The VAO stays bound for the next mesh, the caller unbinds it after the last
+    }
@@ -1,8 +1,16 @@
 #pragma once
 
 #include "debug.h"
+#include "quantize.h"
+#include "resources.h"
+#include "shaders.h"
 
 #include <glm/glm.hpp>
+#include <atomic>
+#include <cfloat>
+#include <filesystem>
+#include <memory>
+#include <string>
 #include <vector>
 #include <unordered_map>
 
@@ -13,65 +21,323 @@ struct texture_names {
     std::string specular_highlight_texname;  // map_Ns
 };
 
+struct TriangleBVH;
+
+// Vertex layout of a DrawObject's vbo
+enum class VertexFormat : int {
+    Float,      // pos(3), normal(3), tex(2) floats, 32 bytes
+    Quantized   // QuantizedVertex: unorm16 pos, octahedral snorm16 normal, half tex, 16 bytes
+};
+
+// Material state resolved at load time
+struct Material {
+    glm::vec3 ambient = glm::vec3(0.0f);
+    float shininess = 0.0f;
+    texture_names texNames;
+    GLuint textures[4] = {0, 0, 0, 0}; // ambient, diffuse, specular, specular highlight (0 = none)
+    int textureSlots[4] = {-1, -1, -1, -1}; // The same in texture arrays: array << 16 | layer (-1 = none)
+};
+
+// Contiguous range of a DrawObject's indices sharing one material
+struct SubDraw {
+    size_t indexOffset = 0;
+    size_t indexCount = 0;
+    int material_id = 0;   // Into DataTex::m_materials
+};
+
 struct DrawObject {
     GLuint vao = 0;
     GLuint vbo = 0;
+    GLuint ebo = 0;
+    GLenum indexType = GL_UNSIGNED_INT; // GL_UNSIGNED_SHORT when numVertices <= 65536
     size_t numTriangles = 0;
-    size_t material_id = -1;
+    size_t numVertices = 0;             // Unique (v, vn, vt) vertices in the vbo
 
-    glm::vec3 bmin; // Boundary Min
+    // Vertex format, and the position = posOffset + posScale * attribute decode
+    VertexFormat vertexFormat = VertexFormat::Float;
+    glm::vec3 posOffset = glm::vec3(0.0f);
+    glm::vec3 posScale = glm::vec3(1.0f);
+
+    glm::vec3 bmin; // Boundary Min, of this object's own vertices
     glm::vec3 bmax; // Boundary Max
+    float uvSpan = 1.0f; // Largest extent of the texture coordinates, for mip streaming
 
-    // Material properties
-    glm::vec3 ambient;
-    float shininess;
-    int material_size;
-    texture_names texNames;
+    // Faces bucketed by material
+    std::vector<SubDraw> subDraws;
+
+    // Where the file repeats this geometry, the first being itself (none: drawn once, where it is)
+    std::vector<glm::mat4> placements;
+
+    std::shared_ptr<const TriangleBVH> bvh;    // For ray casts, none unless built on load
+};
+
+// Copies of a DataTex drawn together, one instanced draw call per sub-draw
+struct Instances {
+    std::vector<glm::mat4> transforms;  // Model transform of each copy, before the view transform
+    GLuint buffer = 0;                  // Each draw object's placements in every copy, as the per-instance attributes 3-6
+    std::vector<GLuint> vaos;           // Per draw object: its vbo and ebo with its part of `buffer` added
+    std::vector<GLsizei> counts;        // Per draw object: its instances in `buffer`, empty when nothing is instanced
+    bool dirty = false;                 // `transforms` changed since they were last uploaded
+    uint32_t version = 0;               // Bumped whenever `transforms` are set
+};
+
+// Boxes of a DataTex's draw objects for the FrustumCuller, each covering all
+// of the object's instances and placements. One lane per draw object in
+// structure-of-arrays form, padded to whole SIMD batches with empty boxes
+struct ObjectBounds {
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+    std::vector<uint8_t> visible;   // Per draw object, as of the last cull (all but the empty until then)
+    uint32_t instancesVersion = 0;  // Instances::version the boxes cover
+};
+
+struct DrawItem {
+    uint32_t object;  // Into DataTex::m_draw_objects
+    uint32_t subDraw; // Into DrawObject::subDraws
+};
+
+// Load settings, captured on the calling thread when a parse starts
+struct LoadOptions {
+    bool streaming_import = false;
+    bool optimize_vertex_cache = true;
+    VertexFormat vertex_format = VertexFormat::Float;
+    bool report_quantization_error = false;
+    int texture_threads = 1;
+    bool texture_cache = false;
+    bool bake_textures = false;
+    bool texture_arrays = false;
+    bool resample_textures = false;
+    bool texture_streaming = false;
+    bool instance_duplicates = false;
+    bool build_bvh = false;
+    bool bvh_cache = false;
+};
+
+// Progress of a parse, written by the parsing thread and readable from any other
+struct LoadProgress {
+    std::atomic<size_t> bytesParsed{0};
+    std::atomic<size_t> totalBytes{0};     // 0 until the file is opened
+    std::atomic<size_t> triangles{0};
+    std::atomic<size_t> texturesDecoded{0};
+    std::atomic<size_t> texturesTotal{0};  // 0 until the materials are known
+    std::atomic<bool> cancel{false};       // Set to make the parse give up early
+};
+
+// Decoded texture image, or its block-compressed mip chain from the TextureCache
+struct CpuTexture {
+    std::string name;   // As referenced by the materials
+    int width = 0;
+    int height = 0;
+    int comp = 0;       // Channels of the source image
+    std::vector<unsigned char> pixels;  // Rows of `comp` bytes per pixel, or the compressed mips back to back
+    GLenum compressedFormat = 0;        // 0 when `pixels` are uncompressed
+    std::vector<size_t> mipSizes;       // Bytes of each mip, largest first, when `pixels` holds a chain
+    uint64_t key = 0;                   // Content hash of the source file, its ResourceCache key.
+                                        // Without pixels when the cache already had it
+
+    bool compressed() const {
+        return compressedFormat != 0;
+    }
+
+    GLenum format() const {
+        const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+        return formats[comp - 1];
+    }
+};
+
+// CPU side of a DrawObject
+struct CpuDrawObject {
+    std::string name;
+    VertexFormat vertexFormat = VertexFormat::Float;
+    std::vector<float> vertices;            // pos(3), normal(3), tex(2), VertexFormat::Float only
+    std::vector<QuantizedVertex> packed;    // VertexFormat::Quantized only
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> shortIndices;     // Replaces `indices` when numVertices <= 65536
+    std::vector<SubDraw> subDraws;
+
+    glm::vec3 posOffset = glm::vec3(0.0f);
+    glm::vec3 posScale = glm::vec3(1.0f);
+    glm::vec3 bmin = glm::vec3(FLT_MAX);
+    glm::vec3 bmax = glm::vec3(-FLT_MAX);
+    float uvSpan = 1.0f;
+    uint64_t key = 0;   // Content hash of the vbo and ebo, their ResourceCache key
+    std::vector<glm::mat4> placements;  // As DrawObject::placements
+    std::shared_ptr<const TriangleBVH> bvh;
+
+    size_t numVertices() const {
+        return vertexFormat == VertexFormat::Quantized ? packed.size() : vertices.size() / (3 + 3 + 2);
+    }
+
+    // Contents of the vbo and the ebo
+    const void* vertex_data() const {
+        return vertexFormat == VertexFormat::Quantized ? static_cast<const void*>(packed.data()) : vertices.data();
+    }
+    size_t vertex_bytes() const {
+        return vertexFormat == VertexFormat::Quantized ? packed.size() * sizeof(QuantizedVertex)
+                                                       : vertices.size() * sizeof(float);
+    }
+    const void* index_data() const {
+        return shortIndices.empty() ? static_cast<const void*>(indices.data()) : shortIndices.data();
+    }
+    size_t index_bytes() const {
+        return shortIndices.empty() ? indices.size() * sizeof(uint32_t) : shortIndices.size() * sizeof(uint16_t);
+    }
+    size_t index_count() const {
+        return shortIndices.empty() ? indices.size() : shortIndices.size();
+    }
+};
+
+// Same-sized, same-format textures packed into one GL_TEXTURE_2D_ARRAY
+struct CpuTextureArray {
+    std::vector<uint32_t> layers;   // Into CpuMesh::textures
+};
+
+// Everything parsed from an .obj, its .mtl and textures, ready for upload.
+// Owns no GL objects, so it can be built on any thread
+struct CpuMesh {
+    std::vector<CpuDrawObject> objects;
+    std::vector<Material> materials;    // Texture ids are resolved on upload
+    std::vector<CpuTexture> textures;
+    std::vector<CpuTextureArray> textureArrays;  // Empty unless the textures were packed
+    bool streamTextures = false;                 // Textures go to the TextureStreamer
+
+    // Packed textures are shared as a whole set: its ResourceCache key (0 when
+    // not packed), and the slot of each texture in its arrays by name
+    uint64_t textureSetKey = 0;
+    std::unordered_map<std::string, int> textureSlots;
+
+    // Cache entries used instead of decoding, held until the upload shares them
+    std::vector<ResourceRef> shared;
+
+    // Textures the materials reference that are missing or could not be
+    // decoded. Left out of `textures`, so those materials draw without them
+    std::vector<std::string> failedTextures;
+
+    // Copies to draw, as placed by a scene file (none: drawn once, untransformed)
+    std::vector<glm::mat4> instances;
 };
 
 class DataTex {
 
 public:
 
-    std::unordered_map<std::string, GLuint> textures;
+    std::unordered_map<std::string, GLuint> textures;   // Unless packed into m_texture_arrays
+    std::vector<GLuint> m_texture_arrays;
     std::vector<DrawObject> m_draw_objects;
+    std::vector<Material> m_materials;
+    std::vector<DrawItem> m_draw_order; // All sub-draws, sorted by material
+    Instances m_instances;              // Drawn once per transform if there are any
+    GLuint m_material_table = 0;        // m_materials as the Materials uniform block (UniformBlocks)
+    ObjectBounds m_bounds;              // Of m_draw_objects, for culling
+
+    // The textures, arrays and buffers above, shared with other DataTex through the ResourceCache
+    std::vector<ResourceRef> m_resources;
 
     void cleanup() {
-        // Delete all textures
-        for (auto& [name, texId] : textures) {
-            if (texId != 0) {
-                glDeleteTextures(1, &texId);
-            }
+        // The instancing objects are this DataTex's own
+        if (!m_instances.vaos.empty()) {
+            glDeleteVertexArrays(static_cast<GLsizei>(m_instances.vaos.size()), m_instances.vaos.data());
+            m_instances.vaos.clear();
         }
-        textures.clear();
-
-        // Delete all VAOs and VBOs
-        for (auto& obj : m_draw_objects) {
-            if (obj.vbo != 0) {
-                glDeleteBuffers(1, &obj.vbo);
-                obj.vbo = 0;
-            }
-            if (obj.vao != 0) {
-                glDeleteVertexArrays(1, &obj.vao);
-                obj.vao = 0;
-            }
+        if (m_instances.buffer != 0) {
+            glDeleteBuffers(1, &m_instances.buffer);
+            m_instances.buffer = 0;
+        }
+        m_instances.transforms.clear();
+        if (m_material_table != 0) {
+            glDeleteBuffers(1, &m_material_table);
+            m_material_table = 0;
         }
+
+        // Release the GL objects, the ResourceCache deletes those no other DataTex uses
+        m_resources.clear();
+        textures.clear();
+        m_texture_arrays.clear();
         m_draw_objects.clear();
+        m_materials.clear();
+        m_draw_order.clear();
+        m_bounds = {};
     }
 };
 
+// Uniforms of the program Mesh::draw() draws with, resolved when it changes
+struct DrawUniforms {
+    GLuint program = 0;
+    Uniform<glm::vec3> posOffset;
+    Uniform<glm::vec3> posScale;
+    Uniform<int> octNormals;
+    Uniform<int> useTextureArrays;
+    Uniform<int> material;         // Into the bound range of DataTex::m_material_table
+};
+
 class Mesh{
 
 public:
 
+    // Pure CPU stage: parses the .obj, its .mtl and decodes the textures.
+    // Reentrant, so it can run on any thread. Reports to `progress` if given,
+    // and returns an empty mesh on failure or when cancelled through it
+    static CpuMesh parse(const std::string &filename, const LoadOptions& options,
+                         LoadProgress* progress = nullptr);
+    // GL stage: creates the buffers and textures of a parsed mesh on the GL thread.
+    // With `fill` false their storage is only allocated, for the UploadScheduler to fill
+    static DataTex upload(const CpuMesh& mesh, bool fill = true);
+    // parse() with the current settings followed by upload()
     static DataTex load_obj(const std::string &filename);
+    // Snapshot of the settings below for parse()
+    static LoadOptions load_options();
+    // Leaves a VAO of `data` bound through GLState, for the caller to unbind after its last draw
     static void draw(GLenum face, GLenum type, GLuint programID, DataTex& data);
+    // The raster state draw() sets up, for paths drawing meshes without it
+    static void set_draw_state(GLenum face, GLenum type);
+    // Points attributes 0-2 of the bound VAO at the vbo bound to GL_ARRAY_BUFFER
+    static void set_vertex_attributes(VertexFormat format);
+    // Each draw object at each of its placements in every copy, back to back per draw object,
+    // with the instances of each in `counts`. Empty when `data` draws nothing instanced
+    static std::vector<glm::mat4> instance_transforms(const DataTex& data, std::vector<GLsizei>& counts);
+    // Draws `data` once per transform from the next draw() on, or once untransformed if there are none
+    static void set_instances(DataTex& data, std::vector<glm::mat4> transforms);
     static void check_errors(const std::string& desc);
 
+    // Reorder triangles and vertices for the post-transform cache on load
+    static bool optimize_vertex_cache;
+
+    // Vertex format used for the next loads, optionally reporting the error of the quantized one
+    static VertexFormat vertex_format;
+    static bool report_quantization_error;
+
+    // Import through the single-pass streaming loader instead of the parallel tinyobj reader.
+    // Opt-in: it saves the whole-file copy but parses on one thread
+    static bool streaming_import;
+
+    // Draw the shapes a file repeats, moved and turned, as instances of one copy
+    static bool instance_duplicates;
+
+    // Upper bound on the threads decoding the textures of one load
+    static int texture_decode_threads;
+
+    // Pack the textures of the next loads into texture arrays, resampling
+    // odd-sized ones to a shared size if needed
+    static bool texture_arrays;
+    static bool resample_texture_arrays;
+
 private:
     static std::string get_base_dir(std::string_view filepath);
     static void fix_path(std::string &path);
-    static void load_texture (std::string filename, const std::string& texname, DataTex& data);
-    static void bind_material_textures(const texture_names& mat, GLuint programId, DataTex& data);
+    // Empty if the file cannot be found
+    static std::filesystem::path resolve_texture_path(std::string filename, const std::string& texname);
+    // Without pixels if the file cannot be decoded
+    static CpuTexture decode_texture(const std::filesystem::path& path, const std::string& texname,
+                                     const LoadOptions& options);
+    static void decode_textures(const std::string& filename, const LoadOptions& options,
+                                CpuMesh& mesh, LoadProgress* progress);
+    static void prepare_draw_object(CpuDrawObject& o, const LoadOptions& options);
+    static DrawObject upload_draw_object(const CpuDrawObject& o, bool fill, std::vector<ResourceRef>& resources);
+    static GLuint upload_texture(const CpuTexture& texture, bool fill);
+    static void upload_instances(DataTex& data);
+    static void bind_material(const DataTex& data, int material, bool texture_arrays);
+    static void resolve_uniforms(GLuint program);
+
+    static DrawUniforms s_uniforms;
 
 };
\ No newline at end of file
@@ -0,0 +1,379 @@
+#include "multidraw.h"
+
+#include "atlas.h"
+#include "glstate.h"
+#include "shaders.h"
+
+#include <glm/gtc/type_ptr.hpp>
+#include <imgui.h>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+bool MultiDraw::supported = false;
+bool MultiDraw::enabled = true;
+GLuint MultiDraw::program = 0;
+size_t MultiDraw::draw_calls = 0;
+size_t MultiDraw::commands = 0;
+
+std::vector<MultiDrawBatch> MultiDraw::s_batches;
+std::vector<GLuint> MultiDraw::s_arrays;
+std::vector<bool> MultiDraw::s_batched;
+std::vector<uint32_t> MultiDraw::s_versions;
+GLuint MultiDraw::s_instances = 0;
+GLuint MultiDraw::s_transforms = 0;
+std::vector<glm::mat4> MultiDraw::s_models;
+
+namespace {
+
+// Makes `buffer` hold at least `bytes`, keeping its first `used`. A new
+// buffer of at least twice the capacity replaces it, true if it did
+bool reserve(GLuint& buffer, size_t& capacity, size_t used, size_t bytes) {
+    if (buffer != 0 && bytes <= capacity) return false;
+    GLuint grown = 0;
+    size_t grown_capacity = std::max(bytes, 2 * capacity);
+    glGenBuffers(1, &grown);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+    glBufferData(GL_COPY_WRITE_BUFFER, grown_capacity, nullptr, GL_STATIC_DRAW);
+    if (used > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+    }
+    if (buffer != 0) glDeleteBuffers(1, &buffer);
+    buffer = grown;
+    capacity = grown_capacity;
+    return true;
+}
+
+// The commands as drawn: culled ones have no instances
+std::vector<DrawElementsIndirectCommand> visible_commands(const MultiDrawBatch& batch) {
+    std::vector<DrawElementsIndirectCommand> commands = batch.commandList;
+    for (size_t c = 0; c < commands.size(); c++) {
+        if (!batch.commandVisible[c]) commands[c].instanceCount = 0;
+    }
+    return commands;
+}
+
+}
+
+void MultiDraw::initialize() {
+    // Vertex shaders need not support storage blocks at all, even on GL 4.3
+    GLint storage_blocks = 0;
+    if (GLEW_VERSION_4_3) glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &storage_blocks);
+    supported = GLEW_VERSION_4_3 && GLEW_ARB_shader_draw_parameters && storage_blocks >= 2;
+    if (!supported) {
+        std::cout << "Multi-draw indirect unavailable: needs GL 4.3 with ARB_shader_draw_parameters\n";
+        return;
+    }
+
+    try {
+        GLuint vertexShader = Shader::init_shaders(GL_VERTEX_SHADER, "../res/shaders/vertex_mdi.glsl");
+        GLuint fragmentShader = Shader::init_shaders(GL_FRAGMENT_SHADER, "../res/shaders/fragment_mdi.glsl");
+        program = Shader::init_program(vertexShader, fragmentShader);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Multi-draw indirect disabled: " << e.what() << "\n";
+        supported = false;
+        return;
+    }
+
+    // The array samplers keep their units, as in Mesh::draw
+    GLint array_units[TextureAtlas::max_arrays];
+    for (int i = 0; i < TextureAtlas::max_arrays; i++) {
+        array_units[i] = TextureAtlas::first_unit + i;
+    }
+    glUseProgram(program);
+    Uniform<int>(program, "u_textureArrays").set(array_units, TextureAtlas::max_arrays);
+}
+
+size_t MultiDraw::vertex_size(VertexFormat format) {
+    return format == VertexFormat::Quantized ? sizeof(QuantizedVertex) : (3 + 3 + 2) * sizeof(float);
+}
+
+MultiDrawBatch& MultiDraw::batch_for(VertexFormat format, GLenum indexType) {
+    for (MultiDrawBatch& batch : s_batches) {
+        if (batch.vertexFormat == format && batch.indexType == indexType) return batch;
+    }
+    MultiDrawBatch& batch = s_batches.emplace_back();
+    batch.vertexFormat = format;
+    batch.indexType = indexType;
+    return batch;
+}
+
+void MultiDraw::update(const std::vector<DataTex>& meshes) {
+    if (!supported || !enabled) {
+        if (!s_versions.empty()) clear();
+        return;
+    }
+
+    // Meshes are only ever appended, anything else starts over
+    if (meshes.size() < s_versions.size()) clear();
+    bool changed = meshes.size() != s_versions.size();
+    for (size_t i = 0; i < s_versions.size() && !changed; i++) {
+        changed = meshes[i].m_instances.version != s_versions[i];
+    }
+    if (!changed) return;
+
+    // Only the new meshes' geometry is copied, after that of the others
+    size_t first_new = s_versions.size();
+    s_batched.resize(meshes.size(), false);
+    s_versions.resize(meshes.size());
+    for (size_t m = first_new; m < meshes.size(); m++) {
+        s_batched[m] = add(meshes[m], m);
+    }
+    if (s_instances == 0) glGenBuffers(1, &s_instances);
+    for (MultiDrawBatch& batch : s_batches) {
+        upload(batch);
+    }
+
+    // Instance counts and base instances shift with any mesh's, so the
+    // instances and commands of all of them are written again
+    for (size_t m = 0; m < meshes.size(); m++) {
+        s_versions[m] = meshes[m].m_instances.version;
+    }
+    write_instances(meshes);
+}
+
+bool MultiDraw::add(const DataTex& data, size_t mesh) {
+    // Per-material textures would need binding between draws
+    if (data.m_draw_objects.empty() || !data.textures.empty()) return false;
+    if (s_arrays.size() + data.m_texture_arrays.size() > TextureAtlas::max_arrays) return false;
+    int array_base = static_cast<int>(s_arrays.size());
+    s_arrays.insert(s_arrays.end(), data.m_texture_arrays.begin(), data.m_texture_arrays.end());
+
+    // Geometry, once per buffer however many meshes share it
+    for (const DrawObject& object : data.m_draw_objects) {
+        if (object.vao == 0) continue;
+        MultiDrawBatch& batch = batch_for(object.vertexFormat, object.indexType);
+        if (!batch.sourceIndex.try_emplace(object.vbo, batch.sources.size()).second) continue;
+        size_t index_size = object.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+        MultiDrawSource source{object.vbo, object.ebo, batch.vertexBytes,
+                               object.numVertices * vertex_size(object.vertexFormat),
+                               batch.indexBytes, object.numTriangles * 3 * index_size};
+        batch.vertexBytes += source.vertexBytes;
+        batch.indexBytes += source.indexBytes;
+        batch.sources.push_back(source);
+    }
+
+    // The instances of each command are filled in by write_instances()
+    for (const DrawItem& item : data.m_draw_order) {
+        const DrawObject& object = data.m_draw_objects[item.object];
+        if (object.vao == 0) continue;
+        const SubDraw& sd = object.subDraws[item.subDraw];
+        const Material& material = data.m_materials[sd.material_id];
+        MultiDrawBatch& batch = batch_for(object.vertexFormat, object.indexType);
+        const MultiDrawSource& source = batch.sources[batch.sourceIndex.at(object.vbo)];
+        size_t index_size = object.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+
+        batch.commandList.push_back({
+            static_cast<GLuint>(sd.indexCount),
+            1u,
+            static_cast<GLuint>(source.indexOffset / index_size + sd.indexOffset),
+            static_cast<GLint>(source.vertexOffset / vertex_size(object.vertexFormat)),
+            0u});
+
+        MultiDrawData draw{};
+        draw.posOffset = glm::vec4(object.posOffset, 0.0f);
+        draw.posScale = glm::vec4(object.posScale, object.vertexFormat == VertexFormat::Quantized ? 1.0f : 0.0f);
+        draw.material = glm::vec4(material.ambient, material.shininess);
+        for (int t = 0; t < 4; t++) {
+            int slot = material.textureSlots[t];
+            draw.textureSlots[t] = slot < 0 ? -1 : slot + (array_base << 16);
+        }
+        draw.mesh[0] = static_cast<uint32_t>(mesh);
+        batch.drawList.push_back(draw);
+        batch.commandObjects.push_back({static_cast<uint32_t>(mesh), item.object});
+    }
+    return true;
+}
+
+void MultiDraw::upload(MultiDrawBatch& batch) {
+    if (batch.uploadedSources == batch.sources.size() && batch.uploadedDraws == batch.drawList.size()) return;
+    if (batch.vao == 0) {
+        glGenVertexArrays(1, &batch.vao);
+        glGenBuffers(1, &batch.commands);
+        glGenBuffers(1, &batch.draws);
+    }
+
+    // The new sources go after those already copied, on the GPU
+    size_t vertex_used = batch.vertexBytes, index_used = batch.indexBytes;
+    if (batch.uploadedSources < batch.sources.size()) {
+        vertex_used = batch.sources[batch.uploadedSources].vertexOffset;
+        index_used = batch.sources[batch.uploadedSources].indexOffset;
+    }
+    bool moved = reserve(batch.vbo, batch.vertexCapacity, vertex_used, batch.vertexBytes);
+    moved |= reserve(batch.ebo, batch.indexCapacity, index_used, batch.indexBytes);
+    for (size_t s = batch.uploadedSources; s < batch.sources.size(); s++) {
+        const MultiDrawSource& source = batch.sources[s];
+        glBindBuffer(GL_COPY_READ_BUFFER, source.vbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, batch.vbo);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, source.vertexOffset, source.vertexBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, source.ebo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, batch.ebo);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, source.indexOffset, source.indexBytes);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    batch.uploadedSources = batch.sources.size();
+
+    if (moved) {
+        GLState::bind_vertex_array(batch.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+        Mesh::set_vertex_attributes(batch.vertexFormat);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.ebo);
+
+        // Instances as in Mesh::upload_instances, from each draw's base instance on
+        glBindBuffer(GL_ARRAY_BUFFER, s_instances);
+        for (GLuint c = 0; c < 4; c++) {
+            glEnableVertexAttribArray(3 + c);
+            glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(c * sizeof(glm::vec4)));
+            glVertexAttribDivisor(3 + c, 1);
+        }
+        GLState::bind_vertex_array(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // New commands start out visible, their buffer is written with the instances
+    batch.commandVisible.resize(batch.commandList.size(), 1);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch.draws);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, batch.drawList.size() * sizeof(MultiDrawData),
+                 batch.drawList.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    batch.uploadedDraws = batch.drawList.size();
+}
+
+void MultiDraw::write_instances(const std::vector<DataTex>& meshes) {
+    // Instance 0 is the identity, for the draws of meshes that are not instanced.
+    // Each mesh's instances follow those of the meshes before it
+    std::vector<glm::mat4> instances = {glm::mat4(1.0f)};
+    std::vector<std::vector<GLsizei>> counts(meshes.size());
+    std::vector<std::vector<GLuint>> base_instance(meshes.size());
+    for (size_t m = 0; m < meshes.size(); m++) {
+        if (!s_batched[m]) continue;
+        std::vector<glm::mat4> transforms = Mesh::instance_transforms(meshes[m], counts[m]);
+        base_instance[m].assign(meshes[m].m_draw_objects.size(), 0);
+        for (size_t o = 0, next = instances.size(); o < counts[m].size(); next += counts[m][o], o++) {
+            base_instance[m][o] = static_cast<GLuint>(next);
+        }
+        instances.insert(instances.end(), transforms.begin(), transforms.end());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, s_instances);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), instances.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    for (MultiDrawBatch& batch : s_batches) {
+        for (size_t c = 0; c < batch.commandList.size(); c++) {
+            auto [mesh, object] = batch.commandObjects[c];
+            batch.commandList[c].instanceCount = counts[mesh].empty() ? 1u : static_cast<GLuint>(counts[mesh][object]);
+            batch.commandList[c].baseInstance = base_instance[mesh][object];
+        }
+        std::vector<DrawElementsIndirectCommand> commands = visible_commands(batch);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.commands);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand),
+                     commands.data(), GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+bool MultiDraw::batched(size_t mesh) {
+    return mesh < s_batched.size() && s_batched[mesh];
+}
+
+void MultiDraw::draw(GLenum face, GLenum type, const std::vector<DataTex>& meshes,
+                     const std::vector<glm::mat4>& models) {
+    draw_calls = 0;
+    commands = 0;
+    if (s_batches.empty()) return;
+
+    GLState::use_program(program);
+    Mesh::set_draw_state(face, type);
+
+    // The camera is in its uniform block, so the models only change with the meshes
+    if (s_transforms == 0) glGenBuffers(1, &s_transforms);
+    if (models != s_models) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_transforms);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, models.size() * sizeof(glm::mat4), models.data(), GL_DYNAMIC_DRAW);
+        s_models = models;
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, s_transforms);
+
+    for (size_t i = 0; i < s_arrays.size(); i++) {
+        GLState::active_texture(GL_TEXTURE0 + TextureAtlas::first_unit + static_cast<GLenum>(i));
+        GLState::bind_texture(GL_TEXTURE_2D_ARRAY, s_arrays[i]);
+    }
+
+    for (MultiDrawBatch& batch : s_batches) {
+        GLState::bind_vertex_array(batch.vao);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.commands);
+
+        // Culled draws keep their command, with no instances. The commands
+        // are only rewritten when what is visible changed
+        bool changed = false;
+        size_t visible = 0;
+        for (size_t c = 0; c < batch.commandList.size(); c++) {
+            auto [mesh, object] = batch.commandObjects[c];
+            uint8_t in = meshes[mesh].m_bounds.visible[object];
+            changed |= in != batch.commandVisible[c];
+            batch.commandVisible[c] = in;
+            visible += in;
+        }
+        if (changed) {
+            std::vector<DrawElementsIndirectCommand> culled = visible_commands(batch);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, culled.size() * sizeof(DrawElementsIndirectCommand),
+                            culled.data());
+        }
+        if (visible == 0) continue;
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, batch.draws);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, batch.indexType, nullptr,
+                                    static_cast<GLsizei>(batch.commandList.size()), 0);
+        draw_calls++;
+        commands += visible;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void MultiDraw::draw_stats() {
+    if (!supported) {
+        ImGui::Text("Multi-draw indirect unavailable (GL 4.3)");
+        return;
+    }
+    ImGui::Checkbox("Multi-draw indirect", &enabled);
+    size_t bytes = 0;
+    for (const MultiDrawBatch& batch : s_batches) {
+        bytes += batch.vertexCapacity + batch.indexCapacity;
+    }
+    ImGui::Text("%d of %d meshes batched, %.1f MB of geometry copies",
+                static_cast<int>(std::ranges::count(s_batched, true)), static_cast<int>(s_batched.size()),
+                bytes / 1048576.0);
+    ImGui::Text("Last frame: %zu indirect calls for %zu draws", draw_calls, commands);
+}
+
+void MultiDraw::clear() {
+    for (MultiDrawBatch& batch : s_batches) {
+        glDeleteVertexArrays(1, &batch.vao);
+        GLuint buffers[] = {batch.vbo, batch.ebo, batch.commands, batch.draws};
+        glDeleteBuffers(4, buffers);
+    }
+    s_batches.clear();
+    if (s_instances != 0) {
+        glDeleteBuffers(1, &s_instances);
+        s_instances = 0;
+    }
+    s_arrays.clear();
+    s_batched.clear();
+    s_versions.clear();
+}
+
+void MultiDraw::shutdown() {
+    clear();
+    if (s_transforms != 0) {
+        glDeleteBuffers(1, &s_transforms);
+        s_transforms = 0;
+    }
+    s_models.clear();
+    if (program != 0) {
+        glDeleteProgram(program);
+        program = 0;
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Per sub-draw state of the multi-draw path, as DrawData in vertex_mdi.glsl (std430)
+struct MultiDrawData {
+    glm::vec4 posOffset;    // xyz: DrawObject::posOffset
+    glm::vec4 posScale;     // xyz: DrawObject::posScale, w: 1 for octahedral normals
+    glm::vec4 material;     // xyz: ambient, w: shininess
+    int textureSlots[4];    // Material::textureSlots, the array renumbered across meshes
+    uint32_t mesh[4];       // x: the mesh, into the models of draw()
+};
+
+// GL arguments of one draw of glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// A draw object's buffers, copied into a batch's at these offsets
+struct MultiDrawSource {
+    GLuint vbo = 0;
+    GLuint ebo = 0;
+    size_t vertexOffset = 0;
+    size_t vertexBytes = 0;
+    size_t indexOffset = 0;
+    size_t indexBytes = 0;
+};
+
+// Geometry of the batched meshes sharing a vertex format and index type,
+// copied into one vbo and ebo, and drawn by one indirect call. Meshes are
+// appended to it, the buffers at least doubling when they run out of room
+struct MultiDrawBatch {
+    VertexFormat vertexFormat = VertexFormat::Float;
+    GLenum indexType = GL_UNSIGNED_INT;
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint ebo = 0;
+    GLuint commands = 0;    // GL_DRAW_INDIRECT_BUFFER of DrawElementsIndirectCommand
+    GLuint draws = 0;       // Shader storage of one MultiDrawData per command
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+    size_t vertexCapacity = 0;
+    size_t indexCapacity = 0;
+    std::vector<MultiDrawSource> sources;
+    std::unordered_map<GLuint, size_t> sourceIndex;    // Into `sources`, by vbo
+    size_t uploadedSources = 0;     // Those already copied into vbo and ebo...
+    size_t uploadedDraws = 0;       // ...and the entries of drawList in `draws`
+    std::vector<DrawElementsIndirectCommand> commandList;
+    std::vector<MultiDrawData> drawList;
+    std::vector<std::pair<uint32_t, uint32_t>> commandObjects;  // Mesh and draw object of each command
+    std::vector<uint8_t> commandVisible;    // As in `commands`: culled ones have no instances there
+};
+
+// Draws all meshes it can take with one glMultiDrawElementsIndirect per
+// vertex format and index type, instead of a bind, uniform updates and a
+// draw call per sub-draw. Their geometry is copied into shared buffers, the
+// per-draw state goes into a shader storage buffer read through gl_DrawID,
+// and their instances into one buffer offset by each draw's base instance.
+// Meshes with per-material textures (which would need binding between draws),
+// or with more texture arrays than units are left, stay with Mesh::draw.
+// The meshes keep their own buffers for that fallback and for when the path
+// is turned off, so batched geometry takes twice its size in video memory.
+// Needs GL 4.3 and ARB_shader_draw_parameters: without them it stays off
+class MultiDraw {
+public:
+
+    // Checks for support and builds the program, once the GL context exists
+    static void initialize();
+
+    // Appends the meshes added since the last call to the batches, and
+    // rewrites the instances and commands if those or any mesh's instances
+    // changed. Frees the batches while the path is off. GL thread only
+    static void update(const std::vector<DataTex>& meshes);
+
+    // Whether meshes[mesh] is drawn by draw() instead of Mesh::draw, as of the last update()
+    static bool batched(size_t mesh);
+
+    // Draws the batched meshes, meshes[i] with `models[i]` as its uModel, and
+    // the camera of the UniformBlocks, skipping the draw objects culled from
+    // them (ObjectBounds::visible). Leaves `program` in use and a batch's
+    // VAO bound, through GLState
+    static void draw(GLenum face, GLenum type, const std::vector<DataTex>& meshes,
+                     const std::vector<glm::mat4>& models);
+
+    static void draw_stats();
+
+    static void shutdown();
+
+    static bool supported;
+    static bool enabled;
+    static GLuint program;
+
+    // Counters
+    static size_t draw_calls;   // Issued by the last draw()
+    static size_t commands;     // Draws they contain, not counting the culled ones
+
+private:
+    static void clear();
+    static MultiDrawBatch& batch_for(VertexFormat format, GLenum indexType);
+    static bool add(const DataTex& data, size_t mesh);
+    static void upload(MultiDrawBatch& batch);
+    static void write_instances(const std::vector<DataTex>& meshes);
+    static size_t vertex_size(VertexFormat format);
+
+    static std::vector<MultiDrawBatch> s_batches;
+    static std::vector<GLuint> s_arrays;        // Texture arrays of all batched meshes, from TextureAtlas::first_unit on
+    static std::vector<bool> s_batched;
+    static std::vector<uint32_t> s_versions;    // Instances::version of each mesh as last written
+    static GLuint s_instances;                  // Per-instance transforms of all batches, attributes 3-6
+    static GLuint s_transforms;                 // Shader storage of the models of draw()
+    static std::vector<glm::mat4> s_models;     // As last uploaded to s_transforms
+};
@@ -0,0 +1,128 @@
+#include "quantize.h"
+
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cmath>
+
+static float snorm16_to_float(int16_t v) {
+    return std::max(static_cast<float>(v) / 32767.0f, -1.0f);
+}
+
+// Octahedral mapping, see "A Survey of Efficient Representations for
+// Independent Unit Vectors" (Cigolle et al. 2014)
+glm::vec3 Quantize::oct_decode(float x, float y) {
+    glm::vec3 n(x, y, 1.0f - std::abs(x) - std::abs(y));
+    if (n.z < 0.0f) {
+        float ox = n.x;
+        n.x = (1.0f - std::abs(n.y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - std::abs(ox)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(n);
+}
+
+void Quantize::encode_normal(glm::vec3 n, int16_t out[2]) {
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1 == 0.0f) {
+        // Missing normal, decodes to +Z
+        out[0] = out[1] = 0;
+        return;
+    }
+    n = n / l1;
+
+    float x = n.x, y = n.y;
+    if (n.z < 0.0f) {
+        x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    // Of the four snorm16 neighbours of (x, y) keep the one that decodes
+    // closest to n
+    glm::vec3 unit = glm::normalize(n);
+    float best = -2.0f;
+    float fx = std::floor(std::clamp(x, -1.0f, 1.0f) * 32767.0f);
+    float fy = std::floor(std::clamp(y, -1.0f, 1.0f) * 32767.0f);
+    for (int i = 0; i < 4; i++) {
+        int16_t qx = static_cast<int16_t>(std::clamp(fx + (i & 1), -32767.0f, 32767.0f));
+        int16_t qy = static_cast<int16_t>(std::clamp(fy + (i >> 1), -32767.0f, 32767.0f));
+        float d = glm::dot(oct_decode(snorm16_to_float(qx), snorm16_to_float(qy)), unit);
+        if (d > best) {
+            best = d;
+            out[0] = qx;
+            out[1] = qy;
+        }
+    }
+}
+
+std::vector<QuantizedVertex> Quantize::encode(const std::vector<float>& vertices,
+                                              const glm::vec3& bmin, const glm::vec3& bmax) {
+    const size_t numVertices = vertices.size() / (3 + 3 + 2);
+    std::vector<QuantizedVertex> out(numVertices);
+
+    glm::vec3 extent = bmax - bmin;
+    glm::vec3 scale(0.0f);
+    for (int k = 0; k < 3; k++) {
+        if (extent[k] > 0.0f) scale[k] = 65535.0f / extent[k];
+    }
+
+    for (size_t i = 0; i < numVertices; i++) {
+        const float* v = &vertices[i * (3 + 3 + 2)];
+        QuantizedVertex& q = out[i];
+
+        for (int k = 0; k < 3; k++) {
+            float p = std::clamp((v[k] - bmin[k]) * scale[k], 0.0f, 65535.0f);
+            q.position[k] = static_cast<uint16_t>(std::lround(p));
+        }
+        q.position[3] = 0;
+
+        encode_normal(glm::vec3(v[3], v[4], v[5]), q.normal);
+
+        q.texcoord[0] = glm::packHalf1x16(v[6]);
+        q.texcoord[1] = glm::packHalf1x16(v[7]);
+    }
+    return out;
+}
+
+glm::vec3 Quantize::decode_position(const QuantizedVertex& v, const glm::vec3& bmin, const glm::vec3& bmax) {
+    glm::vec3 p;
+    for (int k = 0; k < 3; k++) {
+        p[k] = bmin[k] + (static_cast<float>(v.position[k]) / 65535.0f) * (bmax[k] - bmin[k]);
+    }
+    return p;
+}
+
+glm::vec3 Quantize::decode_normal(const QuantizedVertex& v) {
+    return oct_decode(snorm16_to_float(v.normal[0]), snorm16_to_float(v.normal[1]));
+}
+
+QuantizationError Quantize::measure(const std::vector<float>& vertices,
+                                    const std::vector<QuantizedVertex>& quantized,
+                                    const glm::vec3& bmin, const glm::vec3& bmax) {
+    QuantizationError err;
+    double sumSquared = 0.0;
+    float minNormalDot = 1.0f;
+
+    for (size_t i = 0; i < quantized.size(); i++) {
+        const float* v = &vertices[i * (3 + 3 + 2)];
+        const QuantizedVertex& q = quantized[i];
+
+        float d = glm::length(decode_position(q, bmin, bmax) - glm::vec3(v[0], v[1], v[2]));
+        err.maxPosition = std::max(err.maxPosition, d);
+        sumSquared += static_cast<double>(d) * d;
+
+        glm::vec3 n(v[3], v[4], v[5]);
+        if (glm::length(n) > 0.0f) {
+            minNormalDot = std::min(minNormalDot, glm::dot(glm::normalize(n), decode_normal(q)));
+        }
+
+        for (int k = 0; k < 2; k++) {
+            float t = glm::unpackHalf1x16(q.texcoord[k]);
+            err.maxTexcoord = std::max(err.maxTexcoord, std::abs(t - v[6 + k]));
+        }
+    }
+
+    if (!quantized.empty()) {
+        err.rmsPosition = static_cast<float>(std::sqrt(sumSquared / quantized.size()));
+    }
+    err.maxNormalDegrees = glm::degrees(std::acos(std::clamp(minNormalDot, -1.0f, 1.0f)));
+    return err;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// Compact vertex: 16 bytes instead of 32 for pos(3), normal(3), tex(2) floats
+struct QuantizedVertex {
+    uint16_t position[4]; // unorm16 xyz relative to the object bounds, w unused
+    int16_t normal[2];    // snorm16 octahedral encoded unit normal
+    uint16_t texcoord[2]; // half floats
+};
+
+static_assert(sizeof(QuantizedVertex) == 16, "QuantizedVertex must be tightly packed");
+
+// Error introduced by quantizing a vertex buffer
+struct QuantizationError {
+    float maxPosition = 0.0f;      // In object units
+    float rmsPosition = 0.0f;
+    float maxNormalDegrees = 0.0f; // Angle between the original and decoded normal
+    float maxTexcoord = 0.0f;
+};
+
+class Quantize {
+public:
+
+    // Quantizes `vertices` (8 floats each: pos, normal, tex) with positions
+    // relative to the box [bmin, bmax]
+    static std::vector<QuantizedVertex> encode(const std::vector<float>& vertices,
+                                               const glm::vec3& bmin, const glm::vec3& bmax);
+
+    // Compares `quantized` decoded the way vertex.glsl does against `vertices`
+    static QuantizationError measure(const std::vector<float>& vertices,
+                                     const std::vector<QuantizedVertex>& quantized,
+                                     const glm::vec3& bmin, const glm::vec3& bmax);
+
+    static glm::vec3 decode_position(const QuantizedVertex& v, const glm::vec3& bmin, const glm::vec3& bmax);
+    static glm::vec3 decode_normal(const QuantizedVertex& v);
+
+private:
+    static void encode_normal(glm::vec3 n, int16_t out[2]);
+    static glm::vec3 oct_decode(float x, float y);
+};
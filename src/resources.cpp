@@ -0,0 +1,113 @@
+#include "resources.h"
+#include "stream.h"
+
+#include <imgui.h>
+#include <utility>
+
+std::mutex ResourceCache::s_mutex;
+std::unordered_map<uint64_t, ResourceCache::Entry> ResourceCache::s_entries;
+std::vector<uint64_t> ResourceCache::s_released;
+size_t ResourceCache::s_bytes = 0;
+
+ResourceRef::ResourceRef(ResourceRef&& other) noexcept
+    : m_key(other.m_key), m_resource(std::exchange(other.m_resource, nullptr)) {
+}
+
+ResourceRef& ResourceRef::operator=(ResourceRef&& other) noexcept {
+    if (this != &other) {
+        reset();
+        m_key = other.m_key;
+        m_resource = std::exchange(other.m_resource, nullptr);
+    }
+    return *this;
+}
+
+ResourceRef::~ResourceRef() {
+    reset();
+}
+
+void ResourceRef::reset() {
+    if (m_resource) {
+        ResourceCache::release(m_key);
+        m_resource = nullptr;
+    }
+}
+
+ResourceRef ResourceCache::acquire(uint64_t key) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto it = s_entries.find(key);
+    if (it == s_entries.end()) return {};
+
+    // Also revives an entry released since the last collect()
+    it->second.refs++;
+    return {key, &it->second.resource};
+}
+
+bool ResourceCache::contains(uint64_t key) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_entries.contains(key);
+}
+
+ResourceRef ResourceCache::insert(uint64_t key, SharedResource resource, size_t bytes) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    Entry& entry = s_entries[key];
+    entry.resource = std::move(resource);
+    entry.bytes = bytes;
+    entry.refs = 1;
+    s_bytes += bytes;
+    return {key, &entry.resource};
+}
+
+// Releases can come from any thread, the GL objects are deleted by collect()
+void ResourceCache::release(uint64_t key) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto it = s_entries.find(key);
+    if (it != s_entries.end() && --it->second.refs == 0) {
+        s_released.push_back(key);
+    }
+}
+
+void ResourceCache::destroy(const SharedResource& resource) {
+    if (resource.texture != 0) {
+        TextureStreamer::remove(resource.texture);
+        glDeleteTextures(1, &resource.texture);
+    }
+    if (!resource.arrays.empty()) {
+        glDeleteTextures(static_cast<GLsizei>(resource.arrays.size()), resource.arrays.data());
+    }
+    if (resource.vbo != 0) glDeleteBuffers(1, &resource.vbo);
+    if (resource.ebo != 0) glDeleteBuffers(1, &resource.ebo);
+    if (resource.vao != 0) glDeleteVertexArrays(1, &resource.vao);
+}
+
+void ResourceCache::collect() {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (uint64_t key : s_released) {
+        auto it = s_entries.find(key);
+        if (it == s_entries.end() || it->second.refs > 0) continue;
+        destroy(it->second.resource);
+        s_bytes -= it->second.bytes;
+        s_entries.erase(it);
+    }
+    s_released.clear();
+}
+
+void ResourceCache::draw_stats() {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    int refs = 0;
+    for (const auto& [key, entry] : s_entries) {
+        refs += entry.refs;
+    }
+    ImGui::Text("Shared: %d GL resources, %.1f MB, %d references",
+                static_cast<int>(s_entries.size()), s_bytes / 1048576.0, refs);
+}
+
+void ResourceCache::shutdown() {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (const auto& [key, entry] : s_entries) {
+        destroy(entry.resource);
+    }
+    s_entries.clear();
+    s_released.clear();
+    s_bytes = 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "debug.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// GL objects of one cache entry. Which members are set depends on what it holds
+struct SharedResource {
+    GLuint texture = 0;                             // A texture...
+    std::vector<GLuint> arrays;                     // ...the texture arrays of a texture set...
+    std::unordered_map<std::string, int> slots;     // ...with the slot of each of its textures by name...
+    GLuint vao = 0;                                 // ...or the buffers of a draw object
+    GLuint vbo = 0;
+    GLuint ebo = 0;
+};
+
+// A counted reference on a ResourceCache entry, released when destroyed or reset
+class ResourceRef {
+public:
+    ResourceRef() = default;
+    ResourceRef(ResourceRef&& other) noexcept;
+    ResourceRef& operator=(ResourceRef&& other) noexcept;
+    ~ResourceRef();
+
+    void reset();
+
+    explicit operator bool() const {
+        return m_resource != nullptr;
+    }
+    const SharedResource* operator->() const {
+        return m_resource;
+    }
+
+private:
+    friend class ResourceCache;
+    ResourceRef(uint64_t key, const SharedResource* resource) : m_key(key), m_resource(resource) {}
+
+    uint64_t m_key = 0;
+    const SharedResource* m_resource = nullptr;
+};
+
+// Process-wide cache of the GL objects of loaded meshes, keyed by the content
+// hash of what they were made from: source image files, texture sets and
+// vertex and index data. Loads of the same assets share one copy, so GPU
+// memory stays flat however often they are loaded. Entries are deleted once
+// the last reference goes
+class ResourceCache {
+public:
+
+    // A reference on the entry of `key`, empty if there is none. Any thread,
+    // so a parse can hold on to what it does not need to decode
+    static ResourceRef acquire(uint64_t key);
+
+    // Whether there is an entry for `key`. Exact on the GL thread only
+    static bool contains(uint64_t key);
+
+    // Adds the entry of `key`, which must not exist yet, holding `bytes` of GPU memory. GL thread only
+    static ResourceRef insert(uint64_t key, SharedResource resource, size_t bytes);
+
+    // Deletes the GL objects of the entries released since the last call. GL thread only
+    static void collect();
+
+    static void draw_stats();
+
+    // Deletes all entries, referenced or not. GL thread only
+    static void shutdown();
+
+private:
+    friend class ResourceRef;
+
+    struct Entry {
+        SharedResource resource;
+        size_t bytes = 0;
+        int refs = 0;
+    };
+
+    static void release(uint64_t key);
+    static void destroy(const SharedResource& resource);
+
+    static std::mutex s_mutex;
+    static std::unordered_map<uint64_t, Entry> s_entries;
+    static std::vector<uint64_t> s_released;   // Entries whose count dropped to 0
+    static size_t s_bytes;
+};
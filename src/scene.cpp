@@ -0,0 +1,70 @@
+#include "scene.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+std::vector<SceneMesh> Scene::load(const std::string& filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        std::cerr << "Unable to open scene file: " << filename << "\n";
+        return {};
+    }
+    std::filesystem::path base_dir = std::filesystem::path(filename).parent_path();
+
+    std::vector<SceneMesh> meshes;
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++) {
+        std::istringstream words(line);
+        std::string directive;
+        if (!(words >> directive) || directive[0] == '#') continue;
+
+        if (directive == "mesh") {
+            std::string path;
+            std::getline(words >> std::ws, path);
+            if (path.empty()) {
+                std::cerr << filename << ":" << number << ": mesh without a file\n";
+                continue;
+            }
+            std::filesystem::path mesh_path = path;
+            if (mesh_path.is_relative()) mesh_path = base_dir / mesh_path;
+            meshes.push_back({mesh_path.string(), {}});
+        } else if (directive == "instance") {
+            glm::vec3 position;
+            float yaw = 0.0f, scale = 1.0f;
+            if (meshes.empty() || !(words >> position.x >> position.y >> position.z)) {
+                std::cerr << filename << ":" << number << ": expected a mesh, then instance <x> <y> <z>\n";
+                continue;
+            }
+            if (words >> yaw) words >> scale;
+            meshes.back().instances.push_back(placement(position, yaw, scale));
+        } else {
+            std::cerr << filename << ":" << number << ": unknown directive \"" << directive << "\"\n";
+        }
+    }
+
+    // A mesh without instance lines is drawn once, where it is
+    for (SceneMesh& mesh : meshes) {
+        if (mesh.instances.empty()) mesh.instances.push_back(glm::mat4(1.0f));
+    }
+    return meshes;
+}
+
+glm::mat4 Scene::placement(const glm::vec3& position, float yaw, float scale) {
+    glm::mat4 m = glm::translate(glm::mat4(1.0f), position);
+    m = glm::rotate(m, glm::radians(yaw), glm::vec3(0.0f, 1.0f, 0.0f));
+    return glm::scale(m, glm::vec3(scale));
+}
+
+std::vector<glm::mat4> Scene::grid(int columns, int rows, float spacing) {
+    std::vector<glm::mat4> transforms;
+    glm::vec3 origin(-0.5f * spacing * (columns - 1), 0.0f, -0.5f * spacing * (rows - 1));
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < columns; c++) {
+            transforms.push_back(glm::translate(glm::mat4(1.0f), origin + spacing * glm::vec3(c, 0.0f, r)));
+        }
+    }
+    return transforms;
+}
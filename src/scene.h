@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// A mesh of a scene file and the copies of it to draw
+struct SceneMesh {
+    std::string filename;
+    std::vector<glm::mat4> instances;
+};
+
+// Scene files (.scene) place instanced copies of meshes, one directive per line:
+//
+//     mesh <file.obj>                          Following instances are copies of this mesh,
+//                                              relative to the scene file's directory
+//     instance <x> <y> <z> [<yaw> [<scale>]]   A copy at (x, y, z), turned `yaw` degrees
+//                                              about +y and uniformly scaled
+//
+// Empty lines and lines starting with # are skipped. Positions are in the
+// units of the mesh, before the viewer fits it to the view
+class Scene {
+public:
+
+    // The meshes of a scene file, with at least one instance each. Bad lines are reported and skipped
+    static std::vector<SceneMesh> load(const std::string& filename);
+
+    static glm::mat4 placement(const glm::vec3& position, float yaw, float scale);
+
+    // `columns` x `rows` copies `spacing` apart on the xz plane, centred on the origin
+    static std::vector<glm::mat4> grid(int columns, int rows, float spacing);
+};
@@ -1,7 +1,12 @@
 #include "shaders.h"
 
+#include <glm/gtc/type_ptr.hpp>
 #include <fstream>
+#include <iostream>
 #include <stdexcept>
+#include <vector>
+
+std::unordered_map<GLuint, ProgramReflection> Shader::s_programs;
 
 std::string Shader::read_text_file(const char * filename) {
     std::string line;
@@ -79,5 +84,138 @@ GLuint Shader::init_program (GLuint vertexshader, GLuint fragmentshader){
     glDeleteShader(vertexshader);
     glDeleteShader(fragmentshader);
 
+    s_programs[program] = reflect(program);
     return program;
-}
\ No newline at end of file
+}
+
+ProgramReflection Shader::reflect(GLuint program) {
+    ProgramReflection result;
+    auto base_name = [](const char* name) {
+        std::string s = name;
+        if (s.ends_with("[0]")) s.resize(s.size() - 3);
+        return s;
+    };
+
+    GLint count = 0, max_length = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<GLchar> name(std::max(max_length, 1));
+    for (GLint i = 0; i < count; i++) {
+        ShaderVariable v;
+        glGetActiveUniform(program, i, max_length, nullptr, &v.size, &v.type, name.data());
+        v.location = glGetUniformLocation(program, name.data());
+        // Members of uniform blocks have no location, they are set through the block
+        if (v.location >= 0) result.uniforms[base_name(name.data())] = v;
+    }
+
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+    name.resize(std::max(max_length, 1));
+    for (GLint i = 0; i < count; i++) {
+        ShaderVariable v;
+        glGetActiveAttrib(program, i, max_length, nullptr, &v.size, &v.type, name.data());
+        v.location = glGetAttribLocation(program, name.data());
+        result.attributes[base_name(name.data())] = v;
+    }
+
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+    name.resize(std::max(max_length, 1));
+    for (GLint i = 0; i < count; i++) {
+        ShaderVariable v;
+        glGetActiveUniformBlockName(program, i, max_length, nullptr, name.data());
+        glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &v.size);
+        v.location = i;
+        result.uniformBlocks[name.data()] = v;
+    }
+
+    // Storage blocks only have the program interface query
+    if (GLEW_VERSION_4_3) {
+        glGetProgramInterfaceiv(program, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &count);
+        glGetProgramInterfaceiv(program, GL_SHADER_STORAGE_BLOCK, GL_MAX_NAME_LENGTH, &max_length);
+        name.resize(std::max(max_length, 1));
+        for (GLint i = 0; i < count; i++) {
+            ShaderVariable v;
+            glGetProgramResourceName(program, GL_SHADER_STORAGE_BLOCK, i, max_length, nullptr, name.data());
+            GLenum property = GL_BUFFER_DATA_SIZE;
+            glGetProgramResourceiv(program, GL_SHADER_STORAGE_BLOCK, i, 1, &property, 1, nullptr, &v.size);
+            v.location = i;
+            result.storageBlocks[name.data()] = v;
+        }
+    }
+    return result;
+}
+
+const ProgramReflection& Shader::reflection(GLuint program) {
+    static const ProgramReflection none;
+    auto it = s_programs.find(program);
+    return it == s_programs.end() ? none : it->second;
+}
+
+namespace {
+    // The GL types a uniform set as T may be declared with
+    template<class T> bool accepts(GLenum type);
+    template<> bool accepts<float>(GLenum type) { return type == GL_FLOAT; }
+    template<> bool accepts<glm::vec3>(GLenum type) { return type == GL_FLOAT_VEC3; }
+    template<> bool accepts<glm::vec4>(GLenum type) { return type == GL_FLOAT_VEC4; }
+    template<> bool accepts<glm::ivec4>(GLenum type) { return type == GL_INT_VEC4; }
+    template<> bool accepts<glm::mat4>(GLenum type) { return type == GL_FLOAT_MAT4; }
+    template<> bool accepts<int>(GLenum type) {
+        // Booleans and samplers are set as ints too
+        switch (type) {
+            case GL_INT: case GL_BOOL:
+            case GL_SAMPLER_2D: case GL_SAMPLER_2D_ARRAY:
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+template<class T>
+Uniform<T>::Uniform(GLuint program, const std::string& name) {
+    const ProgramReflection& reflection = Shader::reflection(program);
+    auto it = reflection.uniforms.find(name);
+    if (it == reflection.uniforms.end()) {
+        // The compiler drops uniforms that do not affect the output
+        std::cerr << "Uniform " << name << " is not active in program " << program << "\n";
+        return;
+    }
+    if (!accepts<T>(it->second.type)) {
+        std::cerr << "Uniform " << name << " is declared with GL type 0x" << std::hex << it->second.type
+                  << std::dec << ", which it cannot be set as\n";
+        return;
+    }
+    m_location = it->second.location;
+}
+
+void Shader::set_uniform(GLint location, const float* values, GLsizei count) {
+    glUniform1fv(location, count, values);
+}
+
+void Shader::set_uniform(GLint location, const int* values, GLsizei count) {
+    glUniform1iv(location, count, values);
+}
+
+void Shader::set_uniform(GLint location, const glm::vec3* values, GLsizei count) {
+    glUniform3fv(location, count, glm::value_ptr(values[0]));
+}
+
+void Shader::set_uniform(GLint location, const glm::vec4* values, GLsizei count) {
+    glUniform4fv(location, count, glm::value_ptr(values[0]));
+}
+
+void Shader::set_uniform(GLint location, const glm::ivec4* values, GLsizei count) {
+    glUniform4iv(location, count, glm::value_ptr(values[0]));
+}
+
+void Shader::set_uniform(GLint location, const glm::mat4* values, GLsizei count) {
+    glUniformMatrix4fv(location, count, GL_FALSE, glm::value_ptr(values[0]));
+}
+
+template class Uniform<float>;
+template class Uniform<int>;
+template class Uniform<glm::vec3>;
+template class Uniform<glm::vec4>;
+template class Uniform<glm::ivec4>;
+template class Uniform<glm::mat4>;
\ No newline at end of file
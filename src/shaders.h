@@ -1,7 +1,25 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 #include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// An active variable of a linked program
+struct ShaderVariable {
+    GLint location = -1;    // Of uniforms and attributes, the index of blocks
+    GLenum type = GL_NONE;  // GL_FLOAT_VEC3, GL_SAMPLER_2D... (GL_NONE for blocks)
+    GLint size = 1;         // Array elements, or the bytes of a block
+};
+
+// Everything a linked program exposes, reflected once by Shader::init_program.
+// Arrays are listed under their name without "[0]"
+struct ProgramReflection {
+    std::unordered_map<std::string, ShaderVariable> uniforms;
+    std::unordered_map<std::string, ShaderVariable> uniformBlocks;
+    std::unordered_map<std::string, ShaderVariable> storageBlocks;  // GL 4.3 only
+    std::unordered_map<std::string, ShaderVariable> attributes;
+};
 
 class Shader{
 public:
@@ -9,9 +27,51 @@ public:
     static GLuint init_shaders (GLenum type, const char * filename);
     static GLuint init_program (GLuint vertexshader, GLuint fragmentshader);
 
+    // The reflection of a program linked by init_program (empty for others)
+    static const ProgramReflection& reflection(GLuint program);
+
+    // glUniform* of the program in use, by the type of the values
+    static void set_uniform(GLint location, const float* values, GLsizei count);
+    static void set_uniform(GLint location, const int* values, GLsizei count);
+    static void set_uniform(GLint location, const glm::vec3* values, GLsizei count);
+    static void set_uniform(GLint location, const glm::vec4* values, GLsizei count);
+    static void set_uniform(GLint location, const glm::ivec4* values, GLsizei count);
+    static void set_uniform(GLint location, const glm::mat4* values, GLsizei count);
+
 private:
     static std::string read_text_file(const char * filename);
+    static ProgramReflection reflect(GLuint program);
 
     static void program_errors (GLint program);
     static void shader_errors (GLint shader);
-};
\ No newline at end of file
+
+    static std::unordered_map<GLuint, ProgramReflection> s_programs;
+};
+
+// Location of a uniform of type T, resolved by name once against the
+// program's reflection, and checked against its declared type. Setting a
+// handle that did not resolve does nothing, like location -1.
+// The program must be in use when setting
+template<class T>
+class Uniform {
+public:
+    Uniform() = default;
+    Uniform(GLuint program, const std::string& name);
+
+    void set(const T& value) const { set(&value, 1); }
+    void set(const T* values, GLsizei count) const {
+        if (m_location >= 0) Shader::set_uniform(m_location, values, count);
+    }
+
+    explicit operator bool() const { return m_location >= 0; }
+
+private:
+    GLint m_location = -1;
+};
+
+extern template class Uniform<float>;
+extern template class Uniform<int>;
+extern template class Uniform<glm::vec3>;
+extern template class Uniform<glm::vec4>;
+extern template class Uniform<glm::ivec4>;
+extern template class Uniform<glm::mat4>;
@@ -0,0 +1,250 @@
+#include "stream.h"
+#include "glstate.h"
+#include "texcache.h"
+
+#include <imgui.h>
+#include <algorithm>
+#include <cmath>
+
+bool TextureStreamer::enabled = false;
+float TextureStreamer::budget_mb = 256.0f;
+float TextureStreamer::upload_mb = 8.0f;
+int TextureStreamer::initial_size = 64;
+size_t TextureStreamer::resident_bytes = 0;
+size_t TextureStreamer::frame_bytes = 0;
+size_t TextureStreamer::evictions = 0;
+
+std::unordered_map<GLuint, StreamedTexture> TextureStreamer::s_textures;
+uint64_t TextureStreamer::s_frame = 0;
+
+void TextureStreamer::build_mips(CpuTexture& texture) {
+    if (texture.compressed() || !texture.mipSizes.empty()) return;
+
+    std::vector<unsigned char> level = texture.pixels;
+    texture.mipSizes.push_back(level.size());
+    int w = texture.width, h = texture.height;
+    while (w > 1 || h > 1) {
+        level = TextureCache::downsample(level, w, h, texture.comp);
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+        texture.pixels.insert(texture.pixels.end(), level.begin(), level.end());
+        texture.mipSizes.push_back(level.size());
+    }
+}
+
+size_t TextureStreamer::level_bytes(const StreamedTexture& t, int level) {
+    return t.cpu.mipSizes[level];
+}
+
+size_t TextureStreamer::level_offset(const StreamedTexture& t, int level) {
+    size_t offset = 0;
+    for (int l = 0; l < level; l++) {
+        offset += t.cpu.mipSizes[l];
+    }
+    return offset;
+}
+
+void TextureStreamer::upload_levels(GLuint id, StreamedTexture& t, int first, int last) {
+    const CpuTexture& c = t.cpu;
+    size_t begin = level_offset(t, first);
+    size_t end = level_offset(t, last + 1);
+
+    // Staged in a pixel unpack buffer like all texture uploads; the
+    // pointers below are offsets into it
+    GLuint pbo;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, end - begin, c.pixels.data() + begin, GL_STREAM_DRAW);
+
+    GLState::bind_texture(GL_TEXTURE_2D, id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    size_t offset = 0;
+    for (int level = first; level <= last; level++) {
+        GLsizei w = std::max(1, c.width >> level), h = std::max(1, c.height >> level);
+        const void* data = reinterpret_cast<const void*>(offset);
+        if (c.compressed()) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, c.compressedFormat, w, h, 0,
+                                   static_cast<GLsizei>(level_bytes(t, level)), data);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, level, c.format(), w, h, 0, c.format(), GL_UNSIGNED_BYTE, data);
+        }
+        offset += level_bytes(t, level);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &pbo);
+}
+
+GLuint TextureStreamer::add(const CpuTexture& texture) {
+    GLuint id;
+    glGenTextures(1, &id);
+
+    StreamedTexture& t = s_textures[id];
+    t.cpu = texture;
+    t.levels = texture.mipSizes.size();
+
+    // Start at the finest level no larger than `initial_size`
+    int level = 0;
+    while (level + 1 < static_cast<int>(t.levels) &&
+           std::max(texture.width >> level, texture.height >> level) > initial_size) {
+        level++;
+    }
+    t.floor = t.resident = t.wanted = level;
+    t.lastUsed = s_frame;
+
+    upload_levels(id, t, level, static_cast<int>(t.levels) - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(t.levels) - 1);
+    GLState::bind_texture(GL_TEXTURE_2D, 0);
+
+    resident_bytes += t.cpu.pixels.size() - level_offset(t, level);
+    return id;
+}
+
+void TextureStreamer::set_resident(GLuint id, StreamedTexture& t, int level) {
+    if (level < t.resident) {
+        upload_levels(id, t, level, t.resident - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        resident_bytes += level_offset(t, t.resident) - level_offset(t, level);
+    } else {
+        GLState::bind_texture(GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        // Respecifying the dropped levels as empty releases their storage
+        for (int l = t.resident; l < level; l++) {
+            glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        resident_bytes -= level_offset(t, level) - level_offset(t, t.resident);
+    }
+    GLState::bind_texture(GL_TEXTURE_2D, 0);
+    t.resident = level;
+}
+
+bool TextureStreamer::evict(const StreamedTexture* keep) {
+    // The finest level of the least recently used texture that has more than it needs
+    auto victim = s_textures.end();
+    for (auto it = s_textures.begin(); it != s_textures.end(); ++it) {
+        if (&it->second == keep || it->second.resident >= it->second.wanted) continue;
+        if (victim == s_textures.end() || it->second.lastUsed < victim->second.lastUsed) victim = it;
+    }
+    if (victim == s_textures.end()) return false;
+
+    set_resident(victim->first, victim->second, victim->second.resident + 1);
+    evictions++;
+    return true;
+}
+
+void TextureStreamer::request(const DataTex& data, const glm::mat4& mvp, float viewport_height) {
+    if (s_textures.empty()) return;
+
+    for (const DrawObject& o : data.m_draw_objects) {
+        if (o.vao == 0) continue;
+
+        // A repeated shape needs the detail of its largest repeat
+        float pixels = -1.0f;
+        if (o.placements.empty()) pixels = projected_size(o, mvp, viewport_height);
+        for (const glm::mat4& placement : o.placements) {
+            pixels = std::max(pixels, projected_size(o, mvp * placement, viewport_height));
+        }
+        if (pixels < 0.0f) continue;
+
+        for (const SubDraw& sd : o.subDraws) {
+            for (GLuint id : data.m_materials[sd.material_id].textures) {
+                auto it = s_textures.find(id);
+                if (id == 0 || it == s_textures.end()) continue;
+                StreamedTexture& t = it->second;
+
+                // One texel per pixel: the texels spanned across the object against the pixels it covers
+                float texels = std::max(t.cpu.width, t.cpu.height) * o.uvSpan;
+                int level = static_cast<int>(std::floor(std::log2(std::max(texels / std::max(pixels, 1.0f), 1.0f))));
+                t.wanted = std::min(t.wanted, std::min(level, t.floor));
+                t.lastUsed = s_frame;
+            }
+        }
+    }
+}
+
+float TextureStreamer::projected_size(const DrawObject& o, const glm::mat4& mvp, float viewport_height) {
+    // Screen-space extent of the bounding box, the whole viewport if it reaches behind the eye
+    glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+    int behind = 0;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? o.bmax.x : o.bmin.x, (i & 2) ? o.bmax.y : o.bmin.y, (i & 4) ? o.bmax.z : o.bmin.z);
+        glm::vec4 clip = mvp * glm::vec4(corner, 1.0f);
+        if (clip.w <= 1e-4f) {
+            behind++;
+            continue;
+        }
+        glm::vec2 ndc(clip.x / clip.w, clip.y / clip.w);
+        lo = glm::min(lo, ndc);
+        hi = glm::max(hi, ndc);
+    }
+    if (behind == 8) return -1.0f;
+    if (behind == 0 && (hi.x < -1.0f || lo.x > 1.0f || hi.y < -1.0f || lo.y > 1.0f)) return -1.0f;
+    return behind > 0 ? viewport_height : std::max(hi.x - lo.x, hi.y - lo.y) * 0.5f * viewport_height;
+}
+
+void TextureStreamer::update() {
+    size_t budget = static_cast<size_t>(budget_mb * 1024.0f * 1024.0f);
+    size_t frame_budget = static_cast<size_t>(upload_mb * 1024.0f * 1024.0f);
+    frame_bytes = 0;
+
+    // The budget may have been lowered
+    while (resident_bytes > budget && evict(nullptr)) {}
+
+    // Textures that need finer levels, the most under-resolved first
+    std::vector<std::pair<GLuint, StreamedTexture*>> wanting;
+    for (auto& [id, t] : s_textures) {
+        if (t.wanted < t.resident) wanting.emplace_back(id, &t);
+    }
+    std::ranges::sort(wanting, [](const auto& a, const auto& b) {
+        return a.second->resident - a.second->wanted > b.second->resident - b.second->wanted;
+    });
+
+    // One level per texture per round, so they all sharpen gradually.
+    // At least one level goes up per frame, however small the frame budget
+    bool progress = true;
+    while (progress && frame_bytes < frame_budget) {
+        progress = false;
+        for (auto& [id, t] : wanting) {
+            if (t->wanted >= t->resident) continue;
+            size_t bytes = level_bytes(*t, t->resident - 1);
+            if (frame_bytes > 0 && frame_bytes + bytes > frame_budget) continue;
+
+            while (resident_bytes + bytes > budget && evict(t)) {}
+            if (resident_bytes + bytes > budget) continue;
+
+            set_resident(id, *t, t->resident - 1);
+            frame_bytes += bytes;
+            progress = true;
+        }
+    }
+
+    // The draws of the next frame request again
+    for (auto& [id, t] : s_textures) {
+        t.wanted = t.floor;
+    }
+    s_frame++;
+}
+
+void TextureStreamer::draw_stats() {
+    ImGui::SliderFloat("Texture budget (MB)", &budget_mb, 16.0f, 4096.0f);
+    ImGui::SliderFloat("Texture streaming (MB/frame)", &upload_mb, 0.25f, 64.0f);
+    ImGui::Text("Resident: %.1f MB in %d streamed textures", resident_bytes / 1048576.0,
+                static_cast<int>(s_textures.size()));
+    ImGui::Text("Last frame: %.2f MB streamed, %zu evictions so far", frame_bytes / 1048576.0, evictions);
+}
+
+void TextureStreamer::remove(GLuint id) {
+    auto it = s_textures.find(id);
+    if (it == s_textures.end()) return;
+    resident_bytes -= it->second.cpu.pixels.size() - level_offset(it->second, it->second.resident);
+    s_textures.erase(it);
+}
+
+void TextureStreamer::shutdown() {
+    s_textures.clear();
+    resident_bytes = 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <unordered_map>
+
+// A texture whose finer mips are only on the GPU while something on screen needs them
+struct StreamedTexture {
+    CpuTexture cpu;          // Full mip chain, kept to upload levels again after eviction
+    size_t levels = 0;
+    int floor = 0;           // Level it starts at, never evicted past
+    int resident = 0;        // Finest level on the GPU, GL_TEXTURE_BASE_LEVEL
+    int wanted = 0;          // Finest level requested since the last update()
+    uint64_t lastUsed = 0;   // Frame of the last request
+};
+
+// Mip streaming for the per-material textures of meshes loaded with
+// LoadOptions::texture_streaming. Textures start with only their mips of
+// at most `initial_size` texels on the GPU. Each frame the draw objects
+// request the level their projected size needs, and finer levels are
+// uploaded, at most `upload_mb` per frame, while the resident levels of all
+// streamed textures fit in `budget_mb`. Over budget, the finest level of the
+// least recently used texture that has more than it needs is dropped.
+// The GL texture names stay the same throughout, only their base level moves
+class TextureStreamer {
+public:
+
+    // Builds the mip chain of an uncompressed texture on the CPU, for streaming. Any thread
+    static void build_mips(CpuTexture& texture);
+
+    // Creates the texture with its coarse mips resident. GL thread only
+    static GLuint add(const CpuTexture& texture);
+
+    // Requests the mip levels the textures of `data` need when drawn with `mvp`
+    // into a viewport `viewport_height` pixels tall
+    static void request(const DataTex& data, const glm::mat4& mvp, float viewport_height);
+
+    // Uploads and evicts levels according to the requests since the last call. GL thread only
+    static void update();
+
+    static void draw_stats();
+
+    // Forgets a texture the ResourceCache is about to delete
+    static void remove(GLuint id);
+
+    // Forgets all textures. Their GL names belong to the ResourceCache
+    static void shutdown();
+
+    static bool enabled;        // For the next loads
+    static float budget_mb;
+    static float upload_mb;     // Per frame
+    static int initial_size;
+
+    // Counters
+    static size_t resident_bytes;
+    static size_t frame_bytes;  // Uploaded in the last update()
+    static size_t evictions;
+
+private:
+    // Pixels the bounding box of `o` spans on screen, negative when it is off screen
+    static float projected_size(const DrawObject& o, const glm::mat4& mvp, float viewport_height);
+    static size_t level_bytes(const StreamedTexture& t, int level);
+    static size_t level_offset(const StreamedTexture& t, int level);
+    static void upload_levels(GLuint id, StreamedTexture& t, int first, int last);
+    static void set_resident(GLuint id, StreamedTexture& t, int level);
+    // Drops one level of some texture other than `keep`. False if none has any to spare
+    static bool evict(const StreamedTexture* keep);
+
+    static std::unordered_map<GLuint, StreamedTexture> s_textures;
+    static uint64_t s_frame;
+};
@@ -0,0 +1,330 @@
+#include "texcache.h"
+
+#define STB_DXT_IMPLEMENTATION
+#include <stb_dxt.h>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+bool TextureCache::enabled = true;
+bool TextureCache::bake_on_miss = false;
+bool TextureCache::supported = false;
+std::filesystem::path TextureCache::directory = "../cache/textures";
+
+namespace {
+
+const char ENTRY_MAGIC[4] = {'V', 'T', 'C', '1'};
+const uint32_t ENTRY_VERSION = 1;
+
+// Followed by the source path, the byte size of each mip and the mips themselves
+struct EntryHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t sourceTime;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+    uint32_t format;
+    int32_t width;
+    int32_t height;
+    int32_t comp;
+    uint32_t mipCount;
+    uint32_t pathLength;
+};
+
+// Reads the header and source path of an entry, false unless it is an entry of `canonical`
+bool read_header(std::ifstream& in, const std::filesystem::path& canonical, EntryHeader& header) {
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) != 0 || header.version != ENTRY_VERSION) {
+        return false;
+    }
+
+    // Different sources whose paths hash alike share the entry file
+    std::string path(header.pathLength, '\0');
+    return in.read(path.data(), path.size()) && path == canonical.generic_string();
+}
+
+// Bytes of one 4x4 block of the BC formats compress() writes, 0 for any other
+size_t format_block_bytes(GLenum format) {
+    switch (format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RED_RGTC1:
+        return 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_RG_RGTC2:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+// Largest width or height an entry may have
+constexpr int32_t max_size = 1 << 16;
+
+// Content hashes of the sources seen so far, by canonical path
+struct KnownSource {
+    int64_t time;
+    uint64_t size;
+    uint64_t hash;
+};
+
+std::mutex known_mutex;
+std::unordered_map<std::string, KnownSource> known_sources;
+
+// The source image as `channels` bytes per pixel. Missing colour channels
+// repeat the last one, a missing alpha is opaque
+std::vector<unsigned char> expand(const CpuTexture& texture, int channels) {
+    size_t count = static_cast<size_t>(texture.width) * texture.height;
+    std::vector<unsigned char> out(count * channels);
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char* src = &texture.pixels[i * texture.comp];
+        for (int c = 0; c < channels; c++) {
+            out[i * channels + c] = c < texture.comp ? src[c] : (c == 3 ? 255 : src[texture.comp - 1]);
+        }
+    }
+    return out;
+}
+
+// Appends the 4x4 blocks of one mip level to `out`, repeating the edge
+// pixels of levels whose size is not a multiple of 4
+void compress_level(const std::vector<unsigned char>& image, int w, int h, int channels, GLenum format,
+                    std::vector<unsigned char>& out) {
+    size_t block_bytes = format_block_bytes(format);
+    unsigned char block[16 * 4];
+    for (int by = 0; by < h; by += 4) {
+        for (int bx = 0; bx < w; bx += 4) {
+            for (int i = 0; i < 16; i++) {
+                int x = std::min(bx + i % 4, w - 1);
+                int y = std::min(by + i / 4, h - 1);
+                std::memcpy(&block[i * channels], &image[(static_cast<size_t>(y) * w + x) * channels], channels);
+            }
+
+            size_t at = out.size();
+            out.resize(at + block_bytes);
+            if (format == GL_COMPRESSED_RED_RGTC1) {
+                stb_compress_bc4_block(&out[at], block);
+            } else if (format == GL_COMPRESSED_RG_RGTC2) {
+                stb_compress_bc5_block(&out[at], block);
+            } else {
+                stb_compress_dxt_block(&out[at], block, format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, STB_DXT_HIGHQUAL);
+            }
+        }
+    }
+}
+
+}
+
+void TextureCache::compress(CpuTexture& texture, bool normal_map) {
+    GLenum format;
+    int channels;
+    if (normal_map || texture.comp == 2) {
+        format = GL_COMPRESSED_RG_RGTC2;
+        channels = 2;
+    } else if (texture.comp == 1) {
+        format = GL_COMPRESSED_RED_RGTC1;
+        channels = 1;
+    } else {
+        format = texture.comp == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        channels = 4;
+    }
+
+    std::vector<unsigned char> image = expand(texture, channels);
+    std::vector<unsigned char> blocks;
+    std::vector<size_t> mip_sizes;
+    int w = texture.width, h = texture.height;
+    while (true) {
+        size_t before = blocks.size();
+        compress_level(image, w, h, channels, format, blocks);
+        mip_sizes.push_back(blocks.size() - before);
+        if (w == 1 && h == 1) break;
+        image = TextureCache::downsample(image, w, h, channels);
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+
+    texture.pixels = std::move(blocks);
+    texture.compressedFormat = format;
+    texture.mipSizes = std::move(mip_sizes);
+}
+
+std::vector<unsigned char> TextureCache::downsample(const std::vector<unsigned char>& src, int w, int h, int channels) {
+    int nw = std::max(1, w / 2);
+    int nh = std::max(1, h / 2);
+    std::vector<unsigned char> out(static_cast<size_t>(nw) * nh * channels);
+    for (int y = 0; y < nh; y++) {
+        int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+        for (int x = 0; x < nw; x++) {
+            int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+            for (int c = 0; c < channels; c++) {
+                int sum = src[(static_cast<size_t>(y0) * w + x0) * channels + c] +
+                          src[(static_cast<size_t>(y0) * w + x1) * channels + c] +
+                          src[(static_cast<size_t>(y1) * w + x0) * channels + c] +
+                          src[(static_cast<size_t>(y1) * w + x1) * channels + c];
+                out[(static_cast<size_t>(y) * nw + x) * channels + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+    return out;
+}
+
+bool TextureCache::is_normal_map(const std::filesystem::path& source) {
+    return source.stem().string().ends_with("_bump");
+}
+
+std::filesystem::path TextureCache::entry_path(const std::filesystem::path& source) {
+    std::string key = std::filesystem::weakly_canonical(source).generic_string();
+    return directory / std::format("{:016x}.vtc", hash_bytes(key.data(), key.size()));
+}
+
+bool TextureCache::load(const std::filesystem::path& source, CpuTexture& texture) {
+    std::error_code ec;
+    std::filesystem::path canonical = std::filesystem::canonical(source, ec);
+    if (ec) return false;
+
+    std::ifstream in(entry_path(canonical), std::ios::binary);
+    if (!in) return false;
+
+    EntryHeader header;
+    if (!read_header(in, canonical, header)) return false;
+
+    // Stale unless the source is unchanged. A new modification time alone
+    // (a copy or checkout) is fine as long as the contents still match
+    int64_t time = std::filesystem::last_write_time(canonical, ec).time_since_epoch().count();
+    uint64_t size = std::filesystem::file_size(canonical, ec);
+    if (ec || size != header.sourceSize) return false;
+    if (time != header.sourceTime && hash_file(canonical) != header.sourceHash) return false;
+
+    // Nothing is sized from the header before it is known to describe a
+    // whole mip chain that compress() could have written, and that the file holds
+    size_t block_bytes = format_block_bytes(header.format);
+    if (block_bytes == 0 || header.comp < 1 || header.comp > 4 || header.width < 1 || header.height < 1 ||
+        header.width > max_size || header.height > max_size || header.mipCount < 1 ||
+        header.mipCount > std::bit_width(static_cast<uint32_t>(std::max(header.width, header.height)))) {
+        return false;
+    }
+    uint64_t mip_sizes[std::bit_width(static_cast<uint32_t>(max_size))];
+    if (!in.read(reinterpret_cast<char*>(mip_sizes), header.mipCount * sizeof(uint64_t))) return false;
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < header.mipCount; i++) {
+        uint64_t w = std::max(1, header.width >> i), h = std::max(1, header.height >> i);
+        if (mip_sizes[i] != (w + 3) / 4 * ((h + 3) / 4) * block_bytes) return false;
+        total += mip_sizes[i];
+    }
+    std::streamoff at = in.tellg();
+    uint64_t entry_size = std::filesystem::file_size(entry_path(canonical), ec);
+    if (ec || at < 0 || entry_size - static_cast<uint64_t>(at) != total) return false;
+
+    std::vector<unsigned char> pixels(total);
+    if (!in.read(reinterpret_cast<char*>(pixels.data()), pixels.size())) return false;
+
+    texture.width = header.width;
+    texture.height = header.height;
+    texture.comp = header.comp;
+    texture.pixels = std::move(pixels);
+    texture.compressedFormat = header.format;
+    texture.mipSizes.assign(mip_sizes, mip_sizes + header.mipCount);
+    return true;
+}
+
+bool TextureCache::store(const std::filesystem::path& source, const CpuTexture& texture) {
+    std::error_code ec;
+    std::filesystem::path canonical = std::filesystem::canonical(source, ec);
+    if (ec || !texture.compressed()) return false;
+
+    std::string path = canonical.generic_string();
+    EntryHeader header;
+    std::memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    header.version = ENTRY_VERSION;
+    header.sourceTime = std::filesystem::last_write_time(canonical, ec).time_since_epoch().count();
+    header.sourceSize = std::filesystem::file_size(canonical, ec);
+    header.sourceHash = source_hash(canonical);
+    header.format = texture.compressedFormat;
+    header.width = texture.width;
+    header.height = texture.height;
+    header.comp = texture.comp;
+    header.mipCount = static_cast<uint32_t>(texture.mipSizes.size());
+    header.pathLength = static_cast<uint32_t>(path.size());
+    if (ec) return false;
+
+    std::filesystem::create_directories(directory, ec);
+    if (ec) return false;
+
+    // Written under a temporary name and renamed, so a concurrent load never reads a partial entry
+    std::filesystem::path entry = entry_path(canonical);
+    std::filesystem::path temp = entry;
+    temp += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::vector<uint64_t> mip_sizes(texture.mipSizes.begin(), texture.mipSizes.end());
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(path.data(), path.size());
+        out.write(reinterpret_cast<const char*>(mip_sizes.data()), mip_sizes.size() * sizeof(uint64_t));
+        out.write(reinterpret_cast<const char*>(texture.pixels.data()), texture.pixels.size());
+        if (!out) {
+            out.close();
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(temp, entry, ec);
+    if (ec) {
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+// FNV-1a
+uint64_t TextureCache::hash_bytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t TextureCache::source_hash(const std::filesystem::path& source) {
+    std::error_code ec;
+    std::filesystem::path canonical = std::filesystem::canonical(source, ec);
+    if (ec) return hash_file(source);
+    int64_t time = std::filesystem::last_write_time(canonical, ec).time_since_epoch().count();
+    uint64_t size = std::filesystem::file_size(canonical, ec);
+    if (ec) return hash_file(canonical);
+
+    std::string key = canonical.generic_string();
+    {
+        std::lock_guard lock(known_mutex);
+        auto it = known_sources.find(key);
+        if (it != known_sources.end() && it->second.time == time && it->second.size == size) {
+            return it->second.hash;
+        }
+    }
+
+    // An entry written while the source was as it is now already holds its hash
+    EntryHeader header;
+    std::ifstream in(entry_path(canonical), std::ios::binary);
+    uint64_t hash = in && read_header(in, canonical, header) && header.sourceTime == time &&
+                    header.sourceSize == size ? header.sourceHash : hash_file(canonical);
+
+    std::lock_guard lock(known_mutex);
+    known_sources[key] = {time, size, hash};
+    return hash;
+}
+
+uint64_t TextureCache::hash_file(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> chunk(1 << 20);
+    uint64_t hash = hash_bytes(nullptr, 0);
+    while (in) {
+        in.read(chunk.data(), chunk.size());
+        hash = hash_bytes(chunk.data(), static_cast<size_t>(in.gcount()), hash);
+    }
+    return hash;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <cstdint>
+#include <filesystem>
+
+// On-disk cache of textures block-compressed with full mip chains: BC5 for
+// `_bump` maps, BC4 for other single channel images, BC1 for RGB and BC3
+// for RGBA. An entry is keyed by the canonical path of its source image and
+// only used while the source's modification time and size, or failing that
+// its content hash, still match. Needs no GL context, so the offline baker
+// shares it with the viewer
+class TextureCache {
+public:
+
+    // Fills `texture` with the cached mip chain of `source`. False if there is no valid entry
+    static bool load(const std::filesystem::path& source, CpuTexture& texture);
+
+    // Writes the compressed `texture` as the entry of `source`
+    static bool store(const std::filesystem::path& source, const CpuTexture& texture);
+
+    // Replaces the pixels of a decoded texture by its block-compressed mip chain
+    static void compress(CpuTexture& texture, bool normal_map);
+
+    // Next mip level of an image of `channels` bytes per pixel: 2x2 box filter, clamping at odd edges
+    static std::vector<unsigned char> downsample(const std::vector<unsigned char>& src, int w, int h, int channels);
+
+    // Whether `source` is compressed as a two channel normal map
+    static bool is_normal_map(const std::filesystem::path& source);
+
+    // Cache file of `source`
+    static std::filesystem::path entry_path(const std::filesystem::path& source);
+
+    // FNV-1a of bytes and of a file's contents, continuing from `seed`
+    static uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+    static uint64_t hash_file(const std::filesystem::path& path);
+
+    // Content hash of `source`. Only read in full when neither an earlier
+    // call nor the source's cache entry saw it at its current modification
+    // time and size
+    static uint64_t source_hash(const std::filesystem::path& source);
+
+    // Use cached entries when loading, and compress and store missing ones on the loading thread
+    static bool enabled;
+    static bool bake_on_miss;
+
+    // Set on the GL thread once S3TC support is known
+    static bool supported;
+
+    static std::filesystem::path directory;
+};
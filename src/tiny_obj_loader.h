@@ -421,6 +421,23 @@ struct attrib_t {
   const std::vector<real_t> &GetVertexWeights() const { return vertex_weights; }
 };
 
+// Number of records in an .obj, as counted by a quick pre-scan before
+// parsing. Lets callback users reserve their storage up front.
+struct record_counts_t {
+  size_t num_vertices;       // `v` lines
+  size_t num_normals;        // `vn` lines
+  size_t num_texcoords;      // `vt` lines
+  size_t num_faces;          // `f` lines
+  size_t num_face_vertices;  // sum of the vertex counts of all `f` lines
+
+  record_counts_t()
+      : num_vertices(0),
+        num_normals(0),
+        num_texcoords(0),
+        num_faces(0),
+        num_face_vertices(0) {}
+};
+
 struct callback_t {
   // W is optional and set to 1 if there is no `w` item in `v` line
   void (*vertex_cb)(void *user_data, real_t x, real_t y, real_t z, real_t w);
@@ -446,6 +463,15 @@ struct callback_t {
   // There may be multiple group names
   void (*group_cb)(void *user_data, const char **names, int num_names);
   void (*object_cb)(void *user_data, const char *name);
+  // Called once before any other callback with the record counts of the
+  // whole file. Only the memory/mapped variants of LoadObjWithCallback()
+  // can count ahead, the stream variant never calls it.
+  void (*counts_cb)(void *user_data, const record_counts_t &counts);
+  // Called about every megabyte of input with the number of bytes parsed so
+  // far and the size of the input(0 if unknown, e.g. for streams). Return
+  // false to stop loading, LoadObjWithCallback() then returns false.
+  bool (*progress_cb)(void *user_data, size_t bytes_parsed,
+                      size_t total_bytes);
 
   callback_t()
       : vertex_cb(NULL),
@@ -456,7 +482,9 @@ struct callback_t {
         usemtl_cb(NULL),
         mtllib_cb(NULL),
         group_cb(NULL),
-        object_cb(NULL) {}
+        object_cb(NULL),
+        counts_cb(NULL),
+        progress_cb(NULL) {}
 };
 
 class MaterialReader {
@@ -476,8 +504,11 @@ class MaterialReader {
 class MaterialFileReader : public MaterialReader {
  public:
   // Path could contain separator(';' in Windows, ':' in Posix)
-  explicit MaterialFileReader(const std::string &mtl_basedir)
-      : m_mtlBaseDir(mtl_basedir) {}
+  // `use_mmap` reads the .mtl through a memory mapping instead of an
+  // std::ifstream.
+  explicit MaterialFileReader(const std::string &mtl_basedir,
+                              bool use_mmap = false)
+      : m_mtlBaseDir(mtl_basedir), m_useMmap(use_mmap) {}
   virtual ~MaterialFileReader() TINYOBJ_OVERRIDE {}
   virtual bool operator()(const std::string &matId,
                           std::vector<material_t> *materials,
@@ -485,7 +516,13 @@ class MaterialFileReader : public MaterialReader {
                           std::string *err) TINYOBJ_OVERRIDE;
 
  private:
+  bool LoadFile(const std::string &filepath,
+                std::vector<material_t> *materials,
+                std::map<std::string, int> *matMap, std::string *warn,
+                std::string *err);
+
   std::string m_mtlBaseDir;
+  bool m_useMmap;
 };
 
 ///
@@ -527,8 +564,25 @@ struct ObjReaderConfig {
   ///
   std::string mtl_search_path;
 
+  ///
+  /// Memory map the .obj and .mtl files and parse straight from the mapped
+  /// pages instead of reading them line by line through an std::ifstream.
+  /// Valid only when loading .obj from a file.
+  ///
+  bool use_mmap;
+
+  ///
+  /// Number of threads used to parse the .obj. 0 = one per hardware thread.
+  /// Valid only with `use_mmap`.
+  ///
+  unsigned int num_threads;
+
   ObjReaderConfig()
-      : triangulate(true), triangulation_method("simple"), vertex_color(true) {}
+      : triangulate(true),
+        triangulation_method("simple"),
+        vertex_color(true),
+        use_mmap(false),
+        num_threads(1) {}
 };
 
 ///
@@ -611,6 +665,28 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
              const char *mtl_basedir = NULL, bool triangulate = true,
              bool default_vcols_fallback = true);
 
+/// Same as the file based LoadObj(), but the .obj and .mtl files are memory
+/// mapped and parsed in place.
+/// 'num_threads' > 1 parses the .obj in that many newline aligned chunks in
+/// parallel(0 = one per hardware thread). The result is the same as
+/// parsing it sequentially.
+bool LoadObjMapped(attrib_t *attrib, std::vector<shape_t> *shapes,
+                   std::vector<material_t> *materials, std::string *warn,
+                   std::string *err, const char *filename,
+                   const char *mtl_basedir = NULL, bool triangulate = true,
+                   bool default_vcols_fallback = true,
+                   unsigned int num_threads = 1);
+
+/// Loads .obj from a memory buffer of `len` bytes. The buffer does not need
+/// to be NUL terminated. See LoadObjMapped() for 'num_threads'.
+bool LoadObjFromMemory(attrib_t *attrib, std::vector<shape_t> *shapes,
+                       std::vector<material_t> *materials, std::string *warn,
+                       std::string *err, const char *buf, size_t len,
+                       MaterialReader *readMatFn = NULL,
+                       bool triangulate = true,
+                       bool default_vcols_fallback = true,
+                       unsigned int num_threads = 1);
+
 /// Loads .obj from a file with custom user callback.
 /// .mtl is loaded as usual and parsed material_t data will be passed to
 /// `callback.mtllib_cb`.
@@ -622,6 +698,30 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
                          MaterialReader *readMatFn = NULL,
                          std::string *warn = NULL, std::string *err = NULL);
 
+/// Same as above, but parses the .obj from a memory buffer of `len` bytes in
+/// place. The buffer does not need to be NUL terminated. The records are
+/// counted before parsing and passed to `callback.counts_cb`.
+bool LoadObjWithCallback(const char *buf, size_t len,
+                         const callback_t &callback, void *user_data = NULL,
+                         MaterialReader *readMatFn = NULL,
+                         std::string *warn = NULL, std::string *err = NULL);
+
+/// Same as above, but the .obj and .mtl files are memory mapped.
+bool LoadObjWithCallbackMapped(const char *filename,
+                               const callback_t &callback,
+                               void *user_data = NULL,
+                               const char *mtl_basedir = NULL,
+                               std::string *warn = NULL,
+                               std::string *err = NULL);
+
+/// Triangulates one polygon the same way LoadObj() does with
+/// `triangulate` = true and appends the triangles to `out`.
+/// `indices` must already be resolved to 0-based indices into `vertices`.
+/// Returns false(with a warning) for degenerate or invalid polygons.
+bool TriangulatePolygon(const index_t *indices, int num_indices,
+                        const std::vector<real_t> &vertices,
+                        std::vector<index_t> *out, std::string *warn = NULL);
+
 /// Loads object from a std::istream, uses `readMatFn` to retrieve
 /// std::istream for materials.
 /// Returns true when loading .obj become success.
@@ -667,6 +767,36 @@ bool ParseTextureNameAndOption(std::string *texname, texture_option_t *texopt,
 #include <sstream>
 #include <utility>
 
+#if __cplusplus >= 201103L
+#include <thread>
+#endif
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#include <system_error>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define TINYOBJLOADER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #ifdef TINYOBJLOADER_USE_MAPBOX_EARCUT
 
 #ifdef TINYOBJLOADER_DONOT_INCLUDE_MAPBOX_EARCUT
@@ -798,6 +928,223 @@ static std::istream &safeGetline(std::istream &is, std::string &t) {
   return is;
 }
 
+//
+// Read-only view of a whole file. The file is memory mapped so the parser can
+// tokenize straight out of the page cache instead of copying every byte
+// through an std::ifstream.
+//
+class MappedFile {
+ public:
+  MappedFile() : data_(NULL), size_(0) {
+#ifdef _WIN32
+    file_ = INVALID_HANDLE_VALUE;
+    mapping_ = NULL;
+#endif
+  }
+  ~MappedFile() { Close(); }
+
+  bool Open(const char *filename) {
+    Close();
+#ifdef _WIN32
+    file_ = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size)) {
+      Close();
+      return false;
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    if (size_ == 0) {
+      return true;  // Nothing to map. An empty file is still a valid file.
+    }
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_ == NULL) {
+      Close();
+      return false;
+    }
+    data_ = static_cast<const char *>(
+        MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (data_ == NULL) {
+      Close();
+      return false;
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0) {
+      close(fd);
+      return true;  // Nothing to map. An empty file is still a valid file.
+    }
+    void *p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping keeps its own reference to the file.
+    if (p == MAP_FAILED) {
+      size_ = 0;
+      return false;
+    }
+    madvise(p, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char *>(p);
+#endif
+    return true;
+  }
+
+  void Close() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_ != NULL) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    mapping_ = NULL;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_) munmap(const_cast<char *>(data_), size_);
+#endif
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(const MappedFile &);             // non-copyable
+  MappedFile &operator=(const MappedFile &);  // non-copyable
+
+  const char *data_;
+  size_t size_;
+#ifdef _WIN32
+  HANDLE file_;
+  HANDLE mapping_;
+#endif
+};
+
+//
+// Exposes a memory buffer as a std::streambuf without copying it, so the
+// istream based parsers (e.g. LoadMtl) can read from a mapped file.
+//
+class MemoryStreamBuf : public std::streambuf {
+ public:
+  MemoryStreamBuf(const char *data, size_t size) {
+    char *p = const_cast<char *>(data);
+    setg(p, p, p + size);
+  }
+};
+
+//
+// Line sources for the .obj parser.
+//
+// `Next()` returns the next line with its line ending stripped. The returned
+// pointer is only guaranteed to be terminated by one of IS_NEW_LINE's
+// characters, so the number/index parsers can run on it directly.
+// `Terminated()` returns a NUL terminated copy of the rest of the line for
+// the (rare) commands which need a C string.
+// `Offset()` is the number of bytes consumed so far.
+//
+class StreamLineReader {
+ public:
+  explicit StreamLineReader(std::istream *is) : is_(is), offset_(0) {}
+
+  bool Next(const char **line, size_t *len) {
+    if (is_->peek() == -1) {
+      return false;
+    }
+    safeGetline(*is_, linebuf_);
+    offset_ += linebuf_.size() + 1;  // Counts '\r\n' as one byte
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf_.size() > 0) {
+      if (linebuf_[linebuf_.size() - 1] == '\n')
+        linebuf_.erase(linebuf_.size() - 1);
+    }
+    if (linebuf_.size() > 0) {
+      if (linebuf_[linebuf_.size() - 1] == '\r')
+        linebuf_.erase(linebuf_.size() - 1);
+    }
+
+    (*line) = linebuf_.c_str();
+    (*len) = linebuf_.size();
+    return true;
+  }
+
+  const char *Terminated(const char *token) { return token; }
+
+  size_t Offset() const { return offset_; }
+
+ private:
+  std::istream *is_;
+  size_t offset_;
+  std::string linebuf_;
+};
+
+class MemoryLineReader {
+ public:
+  MemoryLineReader(const char *data, size_t size)
+      : begin_(data), cur_(data), end_(data + size), line_end_(NULL) {}
+
+  bool Next(const char **line, size_t *len) {
+    if (cur_ >= end_) {
+      return false;
+    }
+
+    const char *nl = static_cast<const char *>(
+        memchr(cur_, '\n', static_cast<size_t>(end_ - cur_)));
+    const char *stop = nl ? nl : end_;
+
+    // A lone '\r' also ends a line (see safeGetline).
+    const char *cr = static_cast<const char *>(
+        memchr(cur_, '\r', static_cast<size_t>(stop - cur_)));
+    const char *next;
+    if (cr) {
+      stop = cr;
+      next = cr + 1;
+      if ((next < end_) && (*next == '\n')) next++;
+    } else {
+      next = nl ? nl + 1 : end_;
+    }
+
+    if (stop == end_) {
+      // The last line has no line ending, so nothing would stop a parser
+      // from reading past the mapping. Parse a copy instead.
+      linebuf_.assign(cur_, stop);
+      (*line) = linebuf_.c_str();
+      line_end_ = NULL;
+    } else {
+      (*line) = cur_;
+      line_end_ = stop;
+    }
+    (*len) = static_cast<size_t>(stop - cur_);
+    cur_ = next;
+    return true;
+  }
+
+  const char *Terminated(const char *token) {
+    if (!line_end_) {
+      return token;  // Already a copy.
+    }
+    linebuf_.assign(token, line_end_);
+    line_end_ = NULL;
+    return linebuf_.c_str();
+  }
+
+  size_t Offset() const { return static_cast<size_t>(cur_ - begin_); }
+
+ private:
+  const char *begin_;
+  const char *cur_;
+  const char *end_;
+  const char *line_end_;  // NULL when the current line lives in linebuf_
+  std::string linebuf_;
+};
+
 #define IS_SPACE(x) (((x) == ' ') || ((x) == '\t'))
 #define IS_DIGIT(x) \
   (static_cast<unsigned int>((x) - '0') < static_cast<unsigned int>(10))
@@ -854,16 +1201,115 @@ static inline bool fixIndex(int idx, int n, int *ret, bool allow_zero,
 static inline std::string parseString(const char **token) {
   std::string s;
   (*token) += strspn((*token), " \t");
-  size_t e = strcspn((*token), " \t\r");
+  size_t e = strcspn((*token), " \t\r\n");
   s = std::string((*token), &(*token)[e]);
   (*token) += e;
   return s;
 }
 
+//
+// Digit and delimiter scanners for the number parsers.
+//
+// With SSE2 they test 16 characters at a time. A 16 byte load may read past
+// the end of the token (and of the buffer), so it is only issued when it
+// stays inside the page of the first character, which is always readable.
+// Otherwise they fall back to the scalar loop.
+//
+#ifdef TINYOBJLOADER_USE_SSE2
+#if defined(__clang__) || defined(__GNUC__)
+#define TINYOBJ_NO_SANITIZE_OVERREAD \
+  __attribute__((no_sanitize_address, no_sanitize_thread))
+#else
+#define TINYOBJ_NO_SANITIZE_OVERREAD
+#endif
+
+static inline bool canLoad16(const char *p) {
+  return (reinterpret_cast<size_t>(p) & 4095) <= (4096 - 16);
+}
+
+static inline unsigned int countTrailingZeros(unsigned int x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long idx;
+  _BitScanForward(&idx, x);
+  return static_cast<unsigned int>(idx);
+#else
+  return static_cast<unsigned int>(__builtin_ctz(x));
+#endif
+}
+
+// Number of leading decimal digits at `p`.
+TINYOBJ_NO_SANITIZE_OVERREAD
+static inline size_t scanDigits(const char *p) {
+  size_t n = 0;
+  while (canLoad16(p + n)) {
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + n));
+    // Unsigned range test '0' <= c <= '9' using signed compares.
+    __m128i t = _mm_sub_epi8(c, _mm_set1_epi8(static_cast<char>('0' + 128)));
+    __m128i not_digit = _mm_cmpgt_epi8(t, _mm_set1_epi8(-128 + 9));
+    unsigned int mask =
+        static_cast<unsigned int>(_mm_movemask_epi8(not_digit));
+    if (mask) return n + countTrailingZeros(mask);
+    n += 16;
+  }
+  while (IS_DIGIT(p[n])) n++;
+  return n;
+}
+
+// Distance to the first ' ', '\t', '\r', '\n' or '\0' at `p`.
+TINYOBJ_NO_SANITIZE_OVERREAD
+static inline size_t scanTokenEnd(const char *p) {
+  size_t n = 0;
+  while (canLoad16(p + n)) {
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + n));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))),
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\r')),
+                                  _mm_cmpeq_epi8(c, _mm_set1_epi8('\n'))),
+                     _mm_cmpeq_epi8(c, _mm_setzero_si128())));
+    unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(m));
+    if (mask) return n + countTrailingZeros(mask);
+    n += 16;
+  }
+  return n + strcspn(p + n, " \t\r\n");
+}
+#else
+static inline size_t scanDigits(const char *p) {
+  size_t n = 0;
+  while (IS_DIGIT(p[n])) n++;
+  return n;
+}
+
+static inline size_t scanTokenEnd(const char *p) {
+  return strcspn(p, " \t\r\n");
+}
+#endif  // TINYOBJLOADER_USE_SSE2
+
+// Parses an optionally signed decimal integer like atoi(), but without the
+// locale and whitespace handling. Stops at the first non-digit.
+static inline int parseDecimalInt(const char *s) {
+  const char *p = s;
+  if ((*p == '+') || (*p == '-')) p++;
+  size_t n = scanDigits(p);
+#if __cplusplus >= 201703L
+  int i = 0;
+  std::from_chars_result r = std::from_chars(p, p + n, i);
+  if (r.ec == std::errc()) {
+    return (*s == '-') ? -i : i;
+  }
+  return atoi(s);  // out of range, keep atoi()'s behavior
+#else
+  if (n > 9) return atoi(s);  // may overflow
+  int i = 0;
+  for (size_t k = 0; k < n; k++) i = i * 10 + (p[k] - '0');
+  return (*s == '-') ? -i : i;
+#endif
+}
+
 static inline int parseInt(const char **token) {
   (*token) += strspn((*token), " \t");
-  int i = atoi((*token));
-  (*token) += strcspn((*token), " \t\r");
+  int i = parseDecimalInt((*token));
+  (*token) += strcspn((*token), " \t\r\n");
   return i;
 }
 
@@ -894,7 +1340,12 @@ static inline int parseInt(const char **token) {
 //  - s >= s_end.
 //  - parse failure.
 //
-static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+// NOTE: This accumulates the mantissa digit by digit and is not correctly
+// rounded. tryParseNumber() below is preferred when std::from_chars is
+// available.
+//
+static bool tryParseDoubleLegacy(const char *s, const char *s_end,
+                                 double *result) {
   if (s >= s_end) {
     return false;
   }
@@ -1027,25 +1478,152 @@ fail:
   return false;
 }
 
+// Floating-point std::from_chars is missing from some standard libraries
+// (Apple's libc++ among them). Those use strtof/strtod in the "C" locale
+// instead, also correctly rounded. TINYOBJLOADER_NO_FROM_CHARS forces that
+// path, and TINYOBJLOADER_NUMBER_PARSER names the one compiled in
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L) && \
+    !defined(TINYOBJLOADER_NO_FROM_CHARS)
+#define TINYOBJLOADER_USE_FROM_CHARS
+#define TINYOBJLOADER_NUMBER_PARSER "std::from_chars"
+#elif defined(__APPLE__) || defined(__GLIBC__)
+#define TINYOBJLOADER_USE_STRTOD_L
+#define TINYOBJLOADER_NUMBER_PARSER "strtof_l/strtod_l (C locale)"
+#else
+#define TINYOBJLOADER_NUMBER_PARSER "strtof/strtod"
+#endif
+
+#ifndef TINYOBJLOADER_USE_FROM_CHARS
+#ifdef TINYOBJLOADER_USE_STRTOD_L
+#include <locale.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+static locale_t cLocale() {
+  static const locale_t locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+  return locale;
+}
+static inline float strtoReal(const char *s, char **end, float) {
+  return strtof_l(s, end, cLocale());
+}
+static inline double strtoReal(const char *s, char **end, double) {
+  return strtod_l(s, end, cLocale());
+}
+#else
+static inline float strtoReal(const char *s, char **end, float) {
+  return strtof(s, end);
+}
+static inline double strtoReal(const char *s, char **end, double) {
+  return strtod(s, end);
+}
+#endif
+
+// The correctly rounded fallback of tryParseNumber(). The token is checked
+// against the OBJ grammar first, as strto* also accepts hex, inf and nan,
+// then parsed from a NUL-terminated copy
+template <typename T>
+static bool tryParseNumberStrtod(const char *s, const char *s_end,
+                                 T *result) {
+  const char *curr = s;
+  if ((curr < s_end) && ((*curr == '+') || (*curr == '-'))) curr++;
+  const char *digits = curr;
+  while ((curr < s_end) && IS_DIGIT(*curr)) curr++;
+  bool mantissa = curr != digits;
+  if ((curr < s_end) && (*curr == '.')) {
+    curr++;
+    const char *fraction = curr;
+    while ((curr < s_end) && IS_DIGIT(*curr)) curr++;
+    mantissa = mantissa || (curr != fraction);
+  }
+  if (!mantissa) return false;
+  if ((curr < s_end) && ((*curr == 'e') || (*curr == 'E'))) {
+    curr++;
+    if ((curr < s_end) && ((*curr == '+') || (*curr == '-'))) curr++;
+    const char *exponent = curr;
+    while ((curr < s_end) && IS_DIGIT(*curr)) curr++;
+    if (curr == exponent) return false;  // Empty E is not allowed.
+  }
+
+  char buffer[64];
+  std::string long_token;
+  const char *token = buffer;
+  size_t length = static_cast<size_t>(curr - s);
+  if (length < sizeof(buffer)) {
+    memcpy(buffer, s, length);
+    buffer[length] = '\0';
+  } else {
+    long_token.assign(s, length);
+    token = long_token.c_str();
+  }
+  (*result) = strtoReal(token, nullptr, T());  // inf/0 when out of range
+  return true;
+}
+#endif  // !TINYOBJLOADER_USE_FROM_CHARS
+
+// Same grammar as tryParseDoubleLegacy(), but parses with std::from_chars,
+// which is correctly rounded. Printed values therefore round-trip exactly,
+// and parsing straight to `float` avoids double rounding.
+template <typename T>
+static bool tryParseNumber(const char *s, const char *s_end, T *result) {
+#ifdef TINYOBJLOADER_USE_FROM_CHARS
+  if (s >= s_end) {
+    return false;
+  }
+
+  // std::from_chars rejects a leading '+', and accepts "inf"/"nan" and
+  // hex floats, which the OBJ grammar does not.
+  const char *curr = s;
+  if ((*curr == '+') || (*curr == '-')) curr++;
+  if ((curr == s_end) || !(IS_DIGIT(*curr) || (*curr == '.'))) {
+    return false;
+  }
+
+  T val;
+  std::from_chars_result r =
+      std::from_chars((*s == '+') ? s + 1 : s, s_end, val);
+  if (r.ec == std::errc()) {
+    if ((r.ptr != s_end) && ((*r.ptr == 'e') || (*r.ptr == 'E'))) {
+      return false;  // Empty E is not allowed.
+    }
+    (*result) = val;
+    return true;
+  }
+  if (r.ec != std::errc::result_out_of_range) {
+    return false;
+  }
+  // Overflow/underflow: fall through to get inf/0 like before.
+  double dval;
+  if (!tryParseDoubleLegacy(s, s_end, &dval)) {
+    return false;
+  }
+  (*result) = static_cast<T>(dval);
+  return true;
+#else
+  return tryParseNumberStrtod(s, s_end, result);
+#endif
+}
+
+static inline bool tryParseDouble(const char *s, const char *s_end,
+                                  double *result) {
+  return tryParseNumber(s, s_end, result);
+}
+
 static inline real_t parseReal(const char **token, double default_value = 0.0) {
   (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
-  double val = default_value;
-  tryParseDouble((*token), end, &val);
-  real_t f = static_cast<real_t>(val);
+  const char *end = (*token) + scanTokenEnd((*token));
+  real_t f;
+  if (!tryParseNumber((*token), end, &f)) {
+    f = static_cast<real_t>(default_value);
+  }
   (*token) = end;
   return f;
 }
 
 static inline bool parseReal(const char **token, real_t *out) {
   (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
-  double val;
-  bool ret = tryParseDouble((*token), end, &val);
-  if (ret) {
-    real_t f = static_cast<real_t>(val);
-    (*out) = f;
-  }
+  const char *end = (*token) + scanTokenEnd((*token));
+  bool ret = tryParseNumber((*token), end, out);
   (*token) = end;
   return ret;
 }
@@ -1120,7 +1698,7 @@ static inline int parseVertexWithColor(real_t *x, real_t *y, real_t *z,
 
 static inline bool parseOnOff(const char **token, bool default_value = true) {
   (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
+  const char *end = (*token) + strcspn((*token), " \t\r\n");
 
   bool ret = default_value;
   if ((0 == strncmp((*token), "on", 2))) {
@@ -1136,7 +1714,7 @@ static inline bool parseOnOff(const char **token, bool default_value = true) {
 static inline texture_type_t parseTextureType(
     const char **token, texture_type_t default_value = TEXTURE_TYPE_NONE) {
   (*token) += strspn((*token), " \t");
-  const char *end = (*token) + strcspn((*token), " \t\r");
+  const char *end = (*token) + strcspn((*token), " \t\r\n");
   texture_type_t ty = default_value;
 
   if ((0 == strncmp((*token), "cube_top", strlen("cube_top")))) {
@@ -1164,7 +1742,7 @@ static tag_sizes parseTagTriple(const char **token) {
 
   (*token) += strspn((*token), " \t");
   ts.num_ints = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  (*token) += strcspn((*token), "/ \t\r\n");
   if ((*token)[0] != '/') {
     return ts;
   }
@@ -1173,7 +1751,7 @@ static tag_sizes parseTagTriple(const char **token) {
 
   (*token) += strspn((*token), " \t");
   ts.num_reals = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  (*token) += strcspn((*token), "/ \t\r\n");
   if ((*token)[0] != '/') {
     return ts;
   }
@@ -1193,11 +1771,11 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
 
   vertex_index_t vi(-1);
 
-  if (!fixIndex(atoi((*token)), vsize, &vi.v_idx, false, context)) {
+  if (!fixIndex(parseDecimalInt((*token)), vsize, &vi.v_idx, false, context)) {
     return false;
   }
 
-  (*token) += strcspn((*token), "/ \t\r");
+  (*token) += strcspn((*token), "/ \t\r\n");
   if ((*token)[0] != '/') {
     (*ret) = vi;
     return true;
@@ -1207,20 +1785,20 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
   // i//k
   if ((*token)[0] == '/') {
     (*token)++;
-    if (!fixIndex(atoi((*token)), vnsize, &vi.vn_idx, true, context)) {
+    if (!fixIndex(parseDecimalInt((*token)), vnsize, &vi.vn_idx, true, context)) {
       return false;
     }
-    (*token) += strcspn((*token), "/ \t\r");
+    (*token) += strcspn((*token), "/ \t\r\n");
     (*ret) = vi;
     return true;
   }
 
   // i/j/k or i/j
-  if (!fixIndex(atoi((*token)), vtsize, &vi.vt_idx, true, context)) {
+  if (!fixIndex(parseDecimalInt((*token)), vtsize, &vi.vt_idx, true, context)) {
     return false;
   }
 
-  (*token) += strcspn((*token), "/ \t\r");
+  (*token) += strcspn((*token), "/ \t\r\n");
   if ((*token)[0] != '/') {
     (*ret) = vi;
     return true;
@@ -1228,22 +1806,26 @@ static bool parseTriple(const char **token, int vsize, int vnsize, int vtsize,
 
   // i/j/k
   (*token)++;  // skip '/'
-  if (!fixIndex(atoi((*token)), vnsize, &vi.vn_idx, true, context)) {
+  if (!fixIndex(parseDecimalInt((*token)), vnsize, &vi.vn_idx, true, context)) {
     return false;
   }
-  (*token) += strcspn((*token), "/ \t\r");
+  (*token) += strcspn((*token), "/ \t\r\n");
 
   (*ret) = vi;
 
   return true;
 }
 
+// Marks an index that is absent from a face vertex (e.g. `vt` in `1//2`).
+static const int kMissingIndex = -2147483647 - 1;
+
 // Parse raw triples: i, i/j/k, i//k, i/j
-static vertex_index_t parseRawTriple(const char **token) {
-  vertex_index_t vi(static_cast<int>(0));  // 0 is an invalid index in OBJ
+// Absent indices are set to `missing`.
+static vertex_index_t parseRawTriple(const char **token, int missing = 0) {
+  vertex_index_t vi(missing);  // 0 is an invalid index in OBJ
 
-  vi.v_idx = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  vi.v_idx = parseDecimalInt((*token));
+  (*token) += strcspn((*token), "/ \t\r\n");
   if ((*token)[0] != '/') {
     return vi;
   }
@@ -1252,25 +1834,172 @@ static vertex_index_t parseRawTriple(const char **token) {
   // i//k
   if ((*token)[0] == '/') {
     (*token)++;
-    vi.vn_idx = atoi((*token));
-    (*token) += strcspn((*token), "/ \t\r");
+    vi.vn_idx = parseDecimalInt((*token));
+    (*token) += strcspn((*token), "/ \t\r\n");
     return vi;
   }
 
   // i/j/k or i/j
-  vi.vt_idx = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  vi.vt_idx = parseDecimalInt((*token));
+  (*token) += strcspn((*token), "/ \t\r\n");
   if ((*token)[0] != '/') {
     return vi;
   }
 
   // i/j/k
   (*token)++;  // skip '/'
-  vi.vn_idx = atoi((*token));
-  (*token) += strcspn((*token), "/ \t\r");
+  vi.vn_idx = parseDecimalInt((*token));
+  (*token) += strcspn((*token), "/ \t\r\n");
   return vi;
 }
 
+// Resolves raw indices from parseRawTriple() the same way parseTriple() does.
+static bool resolveRawTriple(const vertex_index_t &raw, int vsize, int vnsize,
+                             int vtsize, vertex_index_t *ret,
+                             const warning_context &context) {
+  vertex_index_t vi(-1);
+
+  if (!fixIndex(raw.v_idx, vsize, &vi.v_idx, false, context)) {
+    return false;
+  }
+  if ((raw.vt_idx != kMissingIndex) &&
+      !fixIndex(raw.vt_idx, vtsize, &vi.vt_idx, true, context)) {
+    return false;
+  }
+  if ((raw.vn_idx != kMissingIndex) &&
+      !fixIndex(raw.vn_idx, vnsize, &vi.vn_idx, true, context)) {
+    return false;
+  }
+
+  (*ret) = vi;
+  return true;
+}
+
+//
+// Face layout specialization.
+//
+// Files nearly always use a single form for all face vertices. The layout is
+// detected from the first `f` record and the remaining records are parsed by
+// a parser specialized for it, which checks each separator instead of
+// branching on it. Any token that does not match the layout (or has an
+// unusual index such as a very long one) makes the caller fall back to the
+// generic parseTriple()/parseRawTriple() for that line.
+//
+enum face_layout_t {
+  FACE_LAYOUT_UNKNOWN = 0,
+  FACE_LAYOUT_V,         // i
+  FACE_LAYOUT_V_VT,      // i/j
+  FACE_LAYOUT_V_VN,      // i//k
+  FACE_LAYOUT_V_VT_VN,   // i/j/k
+  FACE_LAYOUT_GENERIC    // anything else
+};
+
+static face_layout_t detectFaceLayout(const char *token) {
+  token += strspn(token, " \t");
+  if ((token[0] != '-') && (token[0] != '+') && !IS_DIGIT(token[0])) {
+    return FACE_LAYOUT_GENERIC;
+  }
+
+  size_t n = strcspn(token, " \t\r\n#");
+  const char *s1 = static_cast<const char *>(memchr(token, '/', n));
+  if (!s1) return FACE_LAYOUT_V;
+  if (s1[1] == '/') return FACE_LAYOUT_V_VN;
+  n -= static_cast<size_t>(s1 + 1 - token);
+  if (!memchr(s1 + 1, '/', n)) return FACE_LAYOUT_V_VT;
+  return FACE_LAYOUT_V_VT_VN;
+}
+
+// Parses an index of up to 9 digits. Returns false for anything else, which
+// includes indices that could overflow.
+static inline bool parseFaceIndex(const char **token, int *out) {
+  const char *p = (*token);
+  bool neg = false;
+  if ((*p == '-') || (*p == '+')) {
+    neg = (*p == '-');
+    p++;
+  }
+  if (!IS_DIGIT(*p)) return false;
+
+  int i = 0;
+  const char *end = p + 9;
+  while ((p < end) && IS_DIGIT(*p)) {
+    i = i * 10 + (*p - '0');
+    p++;
+  }
+  if (IS_DIGIT(*p)) return false;
+
+  (*out) = neg ? -i : i;
+  (*token) = p;
+  return true;
+}
+
+static inline bool isFaceVertexEnd(char c) {
+  return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') ||
+         (c == '\0');
+}
+
+template <int Layout>
+static inline bool parseRawTripleAs(const char **token, vertex_index_t *vi) {
+  if (!parseFaceIndex(token, &vi->v_idx)) return false;
+
+  if (Layout == FACE_LAYOUT_V_VT || Layout == FACE_LAYOUT_V_VT_VN) {
+    if ((*token)[0] != '/') return false;
+    (*token)++;
+    if (!parseFaceIndex(token, &vi->vt_idx)) return false;
+  }
+
+  if (Layout == FACE_LAYOUT_V_VN) {
+    if (((*token)[0] != '/') || ((*token)[1] != '/')) return false;
+    (*token) += 2;
+    if (!parseFaceIndex(token, &vi->vn_idx)) return false;
+  }
+
+  if (Layout == FACE_LAYOUT_V_VT_VN) {
+    if ((*token)[0] != '/') return false;
+    (*token)++;
+    if (!parseFaceIndex(token, &vi->vn_idx)) return false;
+  }
+
+  return isFaceVertexEnd((*token)[0]);
+}
+
+// Parses the raw indices of a face line with the given layout, appending them
+// to `indices`. On a mismatch `indices` is left unchanged and false is
+// returned.
+template <int Layout>
+static bool parseFaceIndicesAs(const char *token,
+                               std::vector<vertex_index_t> *indices,
+                               int missing) {
+  size_t begin = indices->size();
+  while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+    vertex_index_t vi(missing);
+    if (!parseRawTripleAs<Layout>(&token, &vi)) {
+      indices->resize(begin);
+      return false;
+    }
+    indices->push_back(vi);
+    token += strspn(token, " \t\r");
+  }
+  return true;
+}
+
+static bool parseFaceIndicesFast(face_layout_t layout, const char *token,
+                                 std::vector<vertex_index_t> *indices,
+                                 int missing) {
+  switch (layout) {
+    case FACE_LAYOUT_V:
+      return parseFaceIndicesAs<FACE_LAYOUT_V>(token, indices, missing);
+    case FACE_LAYOUT_V_VT:
+      return parseFaceIndicesAs<FACE_LAYOUT_V_VT>(token, indices, missing);
+    case FACE_LAYOUT_V_VN:
+      return parseFaceIndicesAs<FACE_LAYOUT_V_VN>(token, indices, missing);
+    case FACE_LAYOUT_V_VT_VN:
+      return parseFaceIndicesAs<FACE_LAYOUT_V_VT_VN>(token, indices, missing);
+    default:
+      return false;
+  }
+}
+
 bool ParseTextureNameAndOption(std::string *texname, texture_option_t *texopt,
                                const char *linebuf) {
   // @todo { write more robust lexer and parser. }
@@ -2467,6 +3196,29 @@ void LoadMtl(std::map<std::string, int> *material_map,
   }
 }
 
+bool MaterialFileReader::LoadFile(const std::string &filepath,
+                                  std::vector<material_t> *materials,
+                                  std::map<std::string, int> *matMap,
+                                  std::string *warn, std::string *err) {
+  if (m_useMmap) {
+    MappedFile file;
+    if (!file.Open(filepath.c_str())) {
+      return false;
+    }
+    MemoryStreamBuf buf(file.data(), file.size());
+    std::istream matIStream(&buf);
+    LoadMtl(matMap, materials, &matIStream, warn, err);
+    return true;
+  }
+
+  std::ifstream matIStream(filepath.c_str());
+  if (!matIStream) {
+    return false;
+  }
+  LoadMtl(matMap, materials, &matIStream, warn, err);
+  return true;
+}
+
 bool MaterialFileReader::operator()(const std::string &matId,
                                     std::vector<material_t> *materials,
                                     std::map<std::string, int> *matMap,
@@ -2490,10 +3242,7 @@ bool MaterialFileReader::operator()(const std::string &matId,
     for (size_t i = 0; i < paths.size(); i++) {
       std::string filepath = JoinPath(paths[i], matId);
 
-      std::ifstream matIStream(filepath.c_str());
-      if (matIStream) {
-        LoadMtl(matMap, materials, &matIStream, warn, err);
-
+      if (LoadFile(filepath, materials, matMap, warn, err)) {
         return true;
       }
     }
@@ -2508,10 +3257,7 @@ bool MaterialFileReader::operator()(const std::string &matId,
 
   } else {
     std::string filepath = matId;
-    std::ifstream matIStream(filepath.c_str());
-    if (matIStream) {
-      LoadMtl(matMap, materials, &matIStream, warn, err);
-
+    if (LoadFile(filepath, materials, matMap, warn, err)) {
       return true;
     }
 
@@ -2582,18 +3328,25 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
                  triangulate, default_vcols_fallback);
 }
 
-bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
-             std::vector<material_t> *materials, std::string *warn,
-             std::string *err, std::istream *inStream,
-             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
-             bool default_vcols_fallback) {
-  std::stringstream errss;
-
+// Vertex attributes parsed from `v`, `vn` and `vt` lines.
+struct obj_attribs {
   std::vector<real_t> v;
   std::vector<real_t> vertex_weights;  // optional [w] component in `v`
   std::vector<real_t> vn;
   std::vector<real_t> vt;
   std::vector<real_t> vc;
+
+  bool found_all_colors;  // check if all 'v' line has color info
+
+  obj_attribs() : found_all_colors(true) {}
+};
+
+//
+// State of a single .obj load. Shared by the sequential loader and the
+// replay stage of the chunked parallel loader.
+//
+struct obj_parse_state {
+  obj_attribs attribs;
   std::vector<skin_weight_t> vw;  // tinyobj extension: vertex skin weights
   std::vector<tag_t> tags;
   PrimGroup prim_group;
@@ -2602,566 +3355,1112 @@ bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
   // material
   std::set<std::string> material_filenames;
   std::map<std::string, int> material_map;
-  int material = -1;
+  int material;
 
   // smoothing group id
-  unsigned int current_smoothing_id =
-      0;  // Initial value. 0 means no smoothing.
+  unsigned int current_smoothing_id;  // 0 means no smoothing.
+
+  int greatest_v_idx;
+  int greatest_vn_idx;
+  int greatest_vt_idx;
 
-  int greatest_v_idx = -1;
-  int greatest_vn_idx = -1;
-  int greatest_vt_idx = -1;
+  // Number of `v`, `vn` and `vt` seen so far. Base for relative indices.
+  int num_v;
+  int num_vn;
+  int num_vt;
 
   shape_t shape;
 
-  bool found_all_colors = true;  // check if all 'v' line has color info
+  size_t line_num;
+
+  face_layout_t face_layout;
+
+  obj_parse_state()
+      : material(-1),
+        current_smoothing_id(0),
+        greatest_v_idx(-1),
+        greatest_vn_idx(-1),
+        greatest_vt_idx(-1),
+        num_v(0),
+        num_vn(0),
+        num_vt(0),
+        line_num(0),
+        face_layout(FACE_LAYOUT_UNKNOWN) {}
+};
 
-  size_t line_num = 0;
-  std::string linebuf;
-  while (inStream->peek() != -1) {
-    safeGetline(*inStream, linebuf);
+// Parses `v`, `vn` and `vt` lines. Returns false for any other line.
+static bool parseAttribLine(const char *token, obj_attribs *a,
+                            bool default_vcols_fallback) {
+  // vertex
+  if (token[0] == 'v' && IS_SPACE((token[1]))) {
+    token += 2;
+    real_t x, y, z;
+    real_t r, g, b;
+
+    int num_components = parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+    a->found_all_colors &= (num_components == 6);
+
+    a->v.push_back(x);
+    a->v.push_back(y);
+    a->v.push_back(z);
+
+    a->vertex_weights.push_back(
+        r);  // r = w, and initialized to 1.0 when `w` component is not found.
+
+    if ((num_components == 6) || default_vcols_fallback) {
+      a->vc.push_back(r);
+      a->vc.push_back(g);
+      a->vc.push_back(b);
+    }
+
+    return true;
+  }
 
-    line_num++;
+  // normal
+  if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+    token += 3;
+    real_t x, y, z;
+    parseReal3(&x, &y, &z, &token);
+    a->vn.push_back(x);
+    a->vn.push_back(y);
+    a->vn.push_back(z);
+    return true;
+  }
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
+  // texcoord
+  if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+    token += 3;
+    real_t x, y;
+    parseReal2(&x, &y, &token);
+    a->vt.push_back(x);
+    a->vt.push_back(y);
+    return true;
+  }
+
+  return false;
+}
+
+static void addFace(obj_parse_state *st, const face_t &face) {
+  for (size_t i = 0; i < face.vertex_indices.size(); i++) {
+    const vertex_index_t &vi = face.vertex_indices[i];
+    st->greatest_v_idx =
+        st->greatest_v_idx > vi.v_idx ? st->greatest_v_idx : vi.v_idx;
+    st->greatest_vn_idx =
+        st->greatest_vn_idx > vi.vn_idx ? st->greatest_vn_idx : vi.vn_idx;
+    st->greatest_vt_idx =
+        st->greatest_vt_idx > vi.vt_idx ? st->greatest_vt_idx : vi.vt_idx;
+  }
+
+  // replace with emplace_back + std::move on C++11
+  st->prim_group.faceGroup.push_back(face);
+}
+
+// Parses a `f` line. `token` points past the leading "f ".
+static bool parseFaceLine(const char *token, obj_parse_state *st,
+                          std::string *warn, std::string *err) {
+  warning_context context;
+  context.warn = warn;
+  context.line_number = st->line_num;
+
+  token += strspn(token, " \t");
+
+  face_t face;
+
+  face.smoothing_group_id = st->current_smoothing_id;
+  face.vertex_indices.reserve(3);
+
+  if (st->face_layout == FACE_LAYOUT_UNKNOWN) {
+    st->face_layout = detectFaceLayout(token);
+  }
+
+  if (parseFaceIndicesFast(st->face_layout, token, &face.vertex_indices,
+                           kMissingIndex)) {
+    for (size_t i = 0; i < face.vertex_indices.size(); i++) {
+      vertex_index_t *vi = &face.vertex_indices[i];
+      if (!resolveRawTriple(*vi, st->num_v, st->num_vn, st->num_vt, vi,
+                            context)) {
+        if (err) {
+          (*err) +=
+              "Failed to parse `f' line (e.g. a zero value for vertex index "
+              "or invalid relative vertex index). Line " +
+              toString(st->line_num) + ").\n";
+        }
+        return false;
+      }
     }
 
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
+    addFace(st, face);
+    return true;
+  }
+
+  while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+    vertex_index_t vi;
+    if (!parseTriple(&token, st->num_v, st->num_vn, st->num_vt, &vi,
+                     context)) {
+      if (err) {
+        (*err) +=
+            "Failed to parse `f' line (e.g. a zero value for vertex index "
+            "or invalid relative vertex index). Line " +
+            toString(st->line_num) + ").\n";
+      }
+      return false;
     }
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+    face.vertex_indices.push_back(vi);
+    size_t n = strspn(token, " \t\r");
+    token += n;
+  }
 
-    assert(token);
-    if (token[0] == '\0') continue;  // empty line
+  addFace(st, face);
+  return true;
+}
 
-    if (token[0] == '#') continue;  // comment line
+// Parses `vw`, `l` and `p` lines. These do not need a NUL terminated line.
+// Sets `*handled` to false for any other line.
+static bool parsePrimLine(const char *token, obj_parse_state *st,
+                          std::string *warn, std::string *err,
+                          bool *handled) {
+  (*handled) = true;
 
-    // vertex
-    if (token[0] == 'v' && IS_SPACE((token[1]))) {
-      token += 2;
-      real_t x, y, z;
-      real_t r, g, b;
+  // skin weight. tinyobj extension
+  if (token[0] == 'v' && token[1] == 'w' && IS_SPACE((token[2]))) {
+    token += 3;
 
-      int num_components = parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
-      found_all_colors &= (num_components == 6);
+    // vw <vid> <joint_0> <weight_0> <joint_1> <weight_1> ...
+    // example:
+    // vw 0 0 0.25 1 0.25 2 0.5
 
-      v.push_back(x);
-      v.push_back(y);
-      v.push_back(z);
+    // TODO(syoyo): Add syntax check
+    int vid = 0;
+    vid = parseInt(&token);
 
-      vertex_weights.push_back(
-          r);  // r = w, and initialized to 1.0 when `w` component is not found.
+    skin_weight_t sw;
 
-      if ((num_components == 6) || default_vcols_fallback) {
-        vc.push_back(r);
-        vc.push_back(g);
-        vc.push_back(b);
+    sw.vertex_id = vid;
+
+    while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+      real_t j, w;
+      // joint_id should not be negative, weight may be negative
+      // TODO(syoyo): # of elements check
+      parseReal2(&j, &w, &token, -1.0);
+
+      if (j < static_cast<real_t>(0)) {
+        if (err) {
+          std::stringstream ss;
+          ss << "Failed parse `vw' line. joint_id is negative. "
+                "line "
+             << st->line_num << ".)\n";
+          (*err) += ss.str();
+        }
+        return false;
       }
 
-      continue;
-    }
+      joint_and_weight_t jw;
 
-    // normal
-    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y, z;
-      parseReal3(&x, &y, &z, &token);
-      vn.push_back(x);
-      vn.push_back(y);
-      vn.push_back(z);
-      continue;
-    }
+      jw.joint_id = int(j);
+      jw.weight = w;
 
-    // texcoord
-    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
-      token += 3;
-      real_t x, y;
-      parseReal2(&x, &y, &token);
-      vt.push_back(x);
-      vt.push_back(y);
-      continue;
+      sw.weightValues.push_back(jw);
+
+      size_t n = strspn(token, " \t\r");
+      token += n;
     }
 
-    // skin weight. tinyobj extension
-    if (token[0] == 'v' && token[1] == 'w' && IS_SPACE((token[2]))) {
-      token += 3;
+    st->vw.push_back(sw);
+    return true;
+  }
 
-      // vw <vid> <joint_0> <weight_0> <joint_1> <weight_1> ...
-      // example:
-      // vw 0 0 0.25 1 0.25 2 0.5
+  warning_context context;
+  context.warn = warn;
+  context.line_number = st->line_num;
 
-      // TODO(syoyo): Add syntax check
-      int vid = 0;
-      vid = parseInt(&token);
+  // line
+  if (token[0] == 'l' && IS_SPACE((token[1]))) {
+    token += 2;
+
+    __line_t line;
+
+    while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+      vertex_index_t vi;
+      if (!parseTriple(&token, st->num_v, st->num_vn, st->num_vt, &vi,
+                       context)) {
+        if (err) {
+          (*err) +=
+              "Failed to parse `l' line (e.g. a zero value for vertex index. "
+              "Line " +
+              toString(st->line_num) + ").\n";
+        }
+        return false;
+      }
 
-      skin_weight_t sw;
+      line.vertex_indices.push_back(vi);
 
-      sw.vertex_id = vid;
+      size_t n = strspn(token, " \t\r");
+      token += n;
+    }
 
-      while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
-        real_t j, w;
-        // joint_id should not be negative, weight may be negative
-        // TODO(syoyo): # of elements check
-        parseReal2(&j, &w, &token, -1.0);
-
-        if (j < static_cast<real_t>(0)) {
-          if (err) {
-            std::stringstream ss;
-            ss << "Failed parse `vw' line. joint_id is negative. "
-                  "line "
-               << line_num << ".)\n";
-            (*err) += ss.str();
-          }
-          return false;
+    st->prim_group.lineGroup.push_back(line);
+
+    return true;
+  }
+
+  // points
+  if (token[0] == 'p' && IS_SPACE((token[1]))) {
+    token += 2;
+
+    __points_t pts;
+
+    while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+      vertex_index_t vi;
+      if (!parseTriple(&token, st->num_v, st->num_vn, st->num_vt, &vi,
+                       context)) {
+        if (err) {
+          (*err) +=
+              "Failed to parse `p' line (e.g. a zero value for vertex index. "
+              "Line " +
+              toString(st->line_num) + ").\n";
         }
+        return false;
+      }
 
-        joint_and_weight_t jw;
+      pts.vertex_indices.push_back(vi);
 
-        jw.joint_id = int(j);
-        jw.weight = w;
+      size_t n = strspn(token, " \t\r");
+      token += n;
+    }
 
-        sw.weightValues.push_back(jw);
+    st->prim_group.pointsGroup.push_back(pts);
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+    return true;
+  }
+
+  (*handled) = false;
+  return true;
+}
+
+// Parses the remaining commands (usemtl, mtllib, g, o, t, s).
+// `token` must be NUL terminated.
+static bool parseCommandLine(const char *token, obj_parse_state *st,
+                             std::vector<shape_t> *shapes,
+                             std::vector<material_t> *materials,
+                             std::string *warn, std::string *err,
+                             MaterialReader *readMatFn, bool triangulate) {
+  const std::vector<real_t> &v = st->attribs.v;
+
+  // use mtl
+  if ((0 == strncmp(token, "usemtl", 6))) {
+    token += 6;
+    std::string namebuf = parseString(&token);
+
+    int newMaterialId = -1;
+    std::map<std::string, int>::const_iterator it =
+        st->material_map.find(namebuf);
+    if (it != st->material_map.end()) {
+      newMaterialId = it->second;
+    } else {
+      // { error!! material not found }
+      if (warn) {
+        (*warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
       }
+    }
 
-      vw.push_back(sw);
+    if (newMaterialId != st->material) {
+      // Create per-face material. Thus we don't add `shape` to `shapes` at
+      // this time.
+      // just clear `faceGroup` after `exportGroupsToShape()` call.
+      exportGroupsToShape(&st->shape, st->prim_group, st->tags, st->material,
+                          st->name, triangulate, v, warn);
+      st->prim_group.faceGroup.clear();
+      st->material = newMaterialId;
     }
 
-    warning_context context;
-    context.warn = warn;
-    context.line_number = line_num;
+    return true;
+  }
 
-    // line
-    if (token[0] == 'l' && IS_SPACE((token[1]))) {
-      token += 2;
+  // load mtl
+  if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+    if (readMatFn) {
+      token += 7;
 
-      __line_t line;
+      std::vector<std::string> filenames;
+      SplitString(std::string(token), ' ', '\\', filenames);
 
-      while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi, context)) {
-          if (err) {
-            (*err) +=
-                "Failed to parse `l' line (e.g. a zero value for vertex index. "
-                "Line " +
-                toString(line_num) + ").\n";
-          }
-          return false;
+      if (filenames.empty()) {
+        if (warn) {
+          std::stringstream ss;
+          ss << "Looks like empty filename for mtllib. Use default "
+                "material (line "
+             << st->line_num << ".)\n";
+
+          (*warn) += ss.str();
         }
+      } else {
+        bool found = false;
+        for (size_t s = 0; s < filenames.size(); s++) {
+          if (st->material_filenames.count(filenames[s]) > 0) {
+            found = true;
+            continue;
+          }
 
-        line.vertex_indices.push_back(vi);
+          std::string warn_mtl;
+          std::string err_mtl;
+          bool ok = (*readMatFn)(filenames[s].c_str(), materials,
+                                 &st->material_map, &warn_mtl, &err_mtl);
+          if (warn && (!warn_mtl.empty())) {
+            (*warn) += warn_mtl;
+          }
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+          if (err && (!err_mtl.empty())) {
+            (*err) += err_mtl;
+          }
+
+          if (ok) {
+            found = true;
+            st->material_filenames.insert(filenames[s]);
+            break;
+          }
+        }
+
+        if (!found) {
+          if (warn) {
+            (*warn) +=
+                "Failed to load material file(s). Use default "
+                "material.\n";
+          }
+        }
       }
+    }
 
-      prim_group.lineGroup.push_back(line);
+    return true;
+  }
 
-      continue;
+  // group name
+  if (token[0] == 'g' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = exportGroupsToShape(&st->shape, st->prim_group, st->tags,
+                                   st->material, st->name, triangulate, v,
+                                   warn);
+    (void)ret;  // return value not used.
+
+    if (st->shape.mesh.indices.size() > 0) {
+      shapes->push_back(st->shape);
     }
 
-    // points
-    if (token[0] == 'p' && IS_SPACE((token[1]))) {
-      token += 2;
+    st->shape = shape_t();
 
-      __points_t pts;
+    // material = -1;
+    st->prim_group.clear();
 
-      while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi, context)) {
-          if (err) {
-            (*err) +=
-                "Failed to parse `p' line (e.g. a zero value for vertex index. "
-                "Line " +
-                toString(line_num) + ").\n";
-          }
-          return false;
-        }
+    std::vector<std::string> names;
 
-        pts.vertex_indices.push_back(vi);
+    while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+      std::string str = parseString(&token);
+      names.push_back(str);
+      token += strspn(token, " \t\r");  // skip tag
+    }
 
-        size_t n = strspn(token, " \t\r");
-        token += n;
+    // names[0] must be 'g'
+
+    if (names.size() < 2) {
+      // 'g' with empty names
+      if (warn) {
+        std::stringstream ss;
+        ss << "Empty group name. line: " << st->line_num << "\n";
+        (*warn) += ss.str();
+        st->name = "";
       }
+    } else {
+      std::stringstream ss;
+      ss << names[1];
 
-      prim_group.pointsGroup.push_back(pts);
+      // tinyobjloader does not support multiple groups for a primitive.
+      // Currently we concatinate multiple group names with a space to get
+      // single group name.
 
-      continue;
+      for (size_t i = 2; i < names.size(); i++) {
+        ss << " " << names[i];
+      }
+
+      st->name = ss.str();
     }
 
-    // face
-    if (token[0] == 'f' && IS_SPACE((token[1]))) {
-      token += 2;
-      token += strspn(token, " \t");
+    return true;
+  }
 
-      face_t face;
+  // object name
+  if (token[0] == 'o' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = exportGroupsToShape(&st->shape, st->prim_group, st->tags,
+                                   st->material, st->name, triangulate, v,
+                                   warn);
+    (void)ret;  // return value not used.
+
+    if (st->shape.mesh.indices.size() > 0 ||
+        st->shape.lines.indices.size() > 0 ||
+        st->shape.points.indices.size() > 0) {
+      shapes->push_back(st->shape);
+    }
 
-      face.smoothing_group_id = current_smoothing_id;
-      face.vertex_indices.reserve(3);
+    // material = -1;
+    st->prim_group.clear();
+    st->shape = shape_t();
 
-      while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
-        vertex_index_t vi;
-        if (!parseTriple(&token, static_cast<int>(v.size() / 3),
-                         static_cast<int>(vn.size() / 3),
-                         static_cast<int>(vt.size() / 2), &vi, context)) {
-          if (err) {
-            (*err) +=
-                "Failed to parse `f' line (e.g. a zero value for vertex index "
-                "or invalid relative vertex index). Line " +
-                toString(line_num) + ").\n";
-          }
-          return false;
-        }
+    // @todo { multiple object name? }
+    token += 2;
+    std::stringstream ss;
+    ss << token;
+    st->name = ss.str();
 
-        greatest_v_idx = greatest_v_idx > vi.v_idx ? greatest_v_idx : vi.v_idx;
-        greatest_vn_idx =
-            greatest_vn_idx > vi.vn_idx ? greatest_vn_idx : vi.vn_idx;
-        greatest_vt_idx =
-            greatest_vt_idx > vi.vt_idx ? greatest_vt_idx : vi.vt_idx;
+    return true;
+  }
 
-        face.vertex_indices.push_back(vi);
-        size_t n = strspn(token, " \t\r");
-        token += n;
-      }
+  if (token[0] == 't' && IS_SPACE(token[1])) {
+    const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
+    tag_t tag;
 
-      // replace with emplace_back + std::move on C++11
-      prim_group.faceGroup.push_back(face);
+    token += 2;
 
-      continue;
+    tag.name = parseString(&token);
+
+    tag_sizes ts = parseTagTriple(&token);
+
+    if (ts.num_ints < 0) {
+      ts.num_ints = 0;
+    }
+    if (ts.num_ints > max_tag_nums) {
+      ts.num_ints = max_tag_nums;
     }
 
-    // use mtl
-    if ((0 == strncmp(token, "usemtl", 6))) {
-      token += 6;
-      std::string namebuf = parseString(&token);
+    if (ts.num_reals < 0) {
+      ts.num_reals = 0;
+    }
+    if (ts.num_reals > max_tag_nums) {
+      ts.num_reals = max_tag_nums;
+    }
 
-      int newMaterialId = -1;
-      std::map<std::string, int>::const_iterator it =
-          material_map.find(namebuf);
-      if (it != material_map.end()) {
-        newMaterialId = it->second;
+    if (ts.num_strings < 0) {
+      ts.num_strings = 0;
+    }
+    if (ts.num_strings > max_tag_nums) {
+      ts.num_strings = max_tag_nums;
+    }
+
+    tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+      tag.intValues[i] = parseInt(&token);
+    }
+
+    tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
+      tag.floatValues[i] = parseReal(&token);
+    }
+
+    tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+      tag.stringValues[i] = parseString(&token);
+    }
+
+    st->tags.push_back(tag);
+
+    return true;
+  }
+
+  if (token[0] == 's' && IS_SPACE(token[1])) {
+    // smoothing group id
+    token += 2;
+
+    // skip space.
+    token += strspn(token, " \t");  // skip space
+
+    if (token[0] == '\0') {
+      return true;
+    }
+
+    if (token[0] == '\r' || token[1] == '\n') {
+      return true;
+    }
+
+    if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
+        token[2] == 'f') {
+      st->current_smoothing_id = 0;
+    } else {
+      // assume number
+      int smGroupId = parseInt(&token);
+      if (smGroupId < 0) {
+        // parse error. force set to 0.
+        // FIXME(syoyo): Report warning.
+        st->current_smoothing_id = 0;
       } else {
-        // { error!! material not found }
-        if (warn) {
-          (*warn) += "material [ '" + namebuf + "' ] not found in .mtl\n";
-        }
+        st->current_smoothing_id = static_cast<unsigned int>(smGroupId);
       }
+    }
 
-      if (newMaterialId != material) {
-        // Create per-face material. Thus we don't add `shape` to `shapes` at
-        // this time.
-        // just clear `faceGroup` after `exportGroupsToShape()` call.
-        exportGroupsToShape(&shape, prim_group, tags, material, name,
-                            triangulate, v, warn);
-        prim_group.faceGroup.clear();
-        material = newMaterialId;
-      }
+    return true;
+  }  // smoothing group id
 
-      continue;
+  // Ignore unknown command.
+  return true;
+}
+
+// Flushes the last shape and moves the parsed attributes into `attrib`.
+static bool finishObj(obj_parse_state *st, attrib_t *attrib,
+                      std::vector<shape_t> *shapes, std::string *warn,
+                      bool triangulate, bool default_vcols_fallback) {
+  obj_attribs &a = st->attribs;
+
+  // not all vertices have colors, no default colors desired? -> clear colors
+  if (!a.found_all_colors && !default_vcols_fallback) {
+    a.vc.clear();
+  }
+
+  if (st->greatest_v_idx >= static_cast<int>(a.v.size() / 3)) {
+    if (warn) {
+      std::stringstream ss;
+      ss << "Vertex indices out of bounds (line " << st->line_num << ".)\n\n";
+      (*warn) += ss.str();
     }
+  }
+  if (st->greatest_vn_idx >= static_cast<int>(a.vn.size() / 3)) {
+    if (warn) {
+      std::stringstream ss;
+      ss << "Vertex normal indices out of bounds (line " << st->line_num
+         << ".)\n\n";
+      (*warn) += ss.str();
+    }
+  }
+  if (st->greatest_vt_idx >= static_cast<int>(a.vt.size() / 2)) {
+    if (warn) {
+      std::stringstream ss;
+      ss << "Vertex texcoord indices out of bounds (line " << st->line_num
+         << ".)\n\n";
+      (*warn) += ss.str();
+    }
+  }
 
-    // load mtl
-    if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
-      if (readMatFn) {
-        token += 7;
+  bool ret = exportGroupsToShape(&st->shape, st->prim_group, st->tags,
+                                 st->material, st->name, triangulate, a.v,
+                                 warn);
+  // exportGroupsToShape return false when `usemtl` is called in the last
+  // line.
+  // we also add `shape` to `shapes` when `shape.mesh` has already some
+  // faces(indices)
+  if (ret || st->shape.mesh.indices
+                 .size()) {  // FIXME(syoyo): Support other prims(e.g. lines)
+    shapes->push_back(st->shape);
+  }
+  st->prim_group.clear();  // for safety
 
-        std::vector<std::string> filenames;
-        SplitString(std::string(token), ' ', '\\', filenames);
+  attrib->vertices.swap(a.v);
+  attrib->vertex_weights.swap(a.vertex_weights);
+  attrib->normals.swap(a.vn);
+  attrib->texcoords.swap(a.vt);
+  attrib->texcoord_ws.swap(a.vt);
+  attrib->colors.swap(a.vc);
+  attrib->skin_weights.swap(st->vw);
 
-        if (filenames.empty()) {
-          if (warn) {
-            std::stringstream ss;
-            ss << "Looks like empty filename for mtllib. Use default "
-                  "material (line "
-               << line_num << ".)\n";
+  return true;
+}
 
-            (*warn) += ss.str();
-          }
-        } else {
-          bool found = false;
-          for (size_t s = 0; s < filenames.size(); s++) {
-            if (material_filenames.count(filenames[s]) > 0) {
-              found = true;
-              continue;
-            }
+template <typename LineReader>
+static bool LoadObjFromLines(attrib_t *attrib, std::vector<shape_t> *shapes,
+                             std::vector<material_t> *materials,
+                             std::string *warn, std::string *err,
+                             LineReader &reader, MaterialReader *readMatFn,
+                             bool triangulate, bool default_vcols_fallback) {
+  obj_parse_state st;
 
-            std::string warn_mtl;
-            std::string err_mtl;
-            bool ok = (*readMatFn)(filenames[s].c_str(), materials,
-                                   &material_map, &warn_mtl, &err_mtl);
-            if (warn && (!warn_mtl.empty())) {
-              (*warn) += warn_mtl;
-            }
+  const char *line;
+  size_t line_len;
+  while (reader.Next(&line, &line_len)) {
+    st.line_num++;
 
-            if (err && (!err_mtl.empty())) {
-              (*err) += err_mtl;
-            }
+    // Skip if empty line.
+    if (line_len == 0) {
+      continue;
+    }
 
-            if (ok) {
-              found = true;
-              material_filenames.insert(filenames[s]);
-              break;
-            }
-          }
+    // Skip leading space.
+    const char *token = line;
+    token += strspn(token, " \t");
 
-          if (!found) {
-            if (warn) {
-              (*warn) +=
-                  "Failed to load material file(s). Use default "
-                  "material.\n";
-            }
-          }
-        }
-      }
+    assert(token);
+    if (IS_NEW_LINE(token[0])) continue;  // empty line
+
+    if (token[0] == '#') continue;  // comment line
 
+    if (parseAttribLine(token, &st.attribs, default_vcols_fallback)) {
+      st.num_v = static_cast<int>(st.attribs.v.size() / 3);
+      st.num_vn = static_cast<int>(st.attribs.vn.size() / 3);
+      st.num_vt = static_cast<int>(st.attribs.vt.size() / 2);
       continue;
     }
 
-    // group name
-    if (token[0] == 'g' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v, warn);
-      (void)ret;  // return value not used.
-
-      if (shape.mesh.indices.size() > 0) {
-        shapes->push_back(shape);
+    // face
+    if (token[0] == 'f' && IS_SPACE((token[1]))) {
+      if (!parseFaceLine(token + 2, &st, warn, err)) {
+        return false;
       }
+      continue;
+    }
 
-      shape = shape_t();
+    bool handled;
+    if (!parsePrimLine(token, &st, warn, err, &handled)) {
+      return false;
+    }
+    if (handled) {
+      continue;
+    }
 
-      // material = -1;
-      prim_group.clear();
+    // The remaining commands are rare and parse C strings.
+    token = reader.Terminated(token);
 
-      std::vector<std::string> names;
+    if (!parseCommandLine(token, &st, shapes, materials, warn, err, readMatFn,
+                          triangulate)) {
+      return false;
+    }
+  }
 
-      while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
-        std::string str = parseString(&token);
-        names.push_back(str);
-        token += strspn(token, " \t\r");  // skip tag
-      }
+  return finishObj(&st, attrib, shapes, warn, triangulate,
+                   default_vcols_fallback);
+}
 
-      // names[0] must be 'g'
+#if __cplusplus >= 201103L
+//
+// Chunked parallel loader.
+//
+// The buffer is split into newline aligned chunks. Each thread parses the
+// `v`/`vn`/`vt` records of its chunk and the raw (unresolved) indices of its
+// `f` records. A prefix sum over the per-chunk attribute counts gives each
+// chunk the base for relative/negative indices, which are then resolved in
+// parallel as well. Finally the chunks are replayed in file order on one
+// thread to build the same shapes as the sequential loader.
+//
 
-      if (names.size() < 2) {
-        // 'g' with empty names
-        if (warn) {
-          std::stringstream ss;
-          ss << "Empty group name. line: " << line_num << "\n";
-          (*warn) += ss.str();
-          name = "";
-        }
-      } else {
-        std::stringstream ss;
-        ss << names[1];
+// A run of consecutive `f` lines, or a single other line.
+struct obj_chunk_record {
+  const char *line;  // NULL for a run of faces.
+  size_t line_len;
+  size_t line_num;  // Chunk-local line number of the (first) line.
+  size_t face_begin;
+  size_t num_faces;
+  size_t index_begin;  // First vertex of the run in face_indices.
+  // Chunk-local attribute counts before this record.
+  int num_v;
+  int num_vn;
+  int num_vt;
+};
 
-        // tinyobjloader does not support multiple groups for a primitive.
-        // Currently we concatinate multiple group names with a space to get
-        // single group name.
+struct obj_chunk {
+  const char *begin;
+  const char *end;
+
+  obj_attribs attribs;
+  std::vector<vertex_index_t> face_indices;
+  std::vector<unsigned int> face_sizes;
+  std::vector<obj_chunk_record> records;
+  std::string last_line;  // Copy of an unterminated last line.
+  size_t num_lines;
+  face_layout_t face_layout;  // Detected from the chunk's first `f` line.
+
+  // Set by the prefix sum.
+  int v_base;
+  int vn_base;
+  int vt_base;
+  size_t line_base;
+
+  // Zero indices produce warnings, so chunks containing them are resolved
+  // during the replay to report them in file order.
+  bool has_zero_index;
+  bool resolved;
+  size_t error_face;  // First face which failed to resolve.
+
+  obj_chunk()
+      : begin(NULL),
+        end(NULL),
+        num_lines(0),
+        face_layout(FACE_LAYOUT_UNKNOWN),
+        v_base(0),
+        vn_base(0),
+        vt_base(0),
+        line_base(0),
+        has_zero_index(false),
+        resolved(false),
+        error_face(static_cast<size_t>(-1)) {}
+};
 
-        for (size_t i = 2; i < names.size(); i++) {
-          ss << " " << names[i];
-        }
+static void parseObjChunk(obj_chunk *chunk, bool default_vcols_fallback) {
+  MemoryLineReader reader(chunk->begin,
+                          static_cast<size_t>(chunk->end - chunk->begin));
+  obj_attribs &a = chunk->attribs;
+  bool in_face_run = false;
 
-        name = ss.str();
-      }
+  const char *line;
+  size_t line_len;
+  while (reader.Next(&line, &line_len)) {
+    chunk->num_lines++;
 
+    const char *token = line + strspn(line, " \t");
+    if ((line_len == 0) || IS_NEW_LINE(token[0]) || (token[0] == '#')) {
+      in_face_run = false;
       continue;
     }
 
-    // object name
-    if (token[0] == 'o' && IS_SPACE((token[1]))) {
-      // flush previous face group.
-      bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                     triangulate, v, warn);
-      (void)ret;  // return value not used.
-
-      if (shape.mesh.indices.size() > 0 || shape.lines.indices.size() > 0 ||
-          shape.points.indices.size() > 0) {
-        shapes->push_back(shape);
-      }
+    // face
+    if (token[0] == 'f' && IS_SPACE((token[1]))) {
+      token += 2;
+      token += strspn(token, " \t");
 
-      // material = -1;
-      prim_group.clear();
-      shape = shape_t();
+      if (!in_face_run) {
+        obj_chunk_record rec;
+        rec.line = NULL;
+        rec.line_len = 0;
+        rec.line_num = chunk->num_lines;
+        rec.face_begin = chunk->face_sizes.size();
+        rec.num_faces = 0;
+        rec.index_begin = chunk->face_indices.size();
+        rec.num_v = static_cast<int>(a.v.size() / 3);
+        rec.num_vn = static_cast<int>(a.vn.size() / 3);
+        rec.num_vt = static_cast<int>(a.vt.size() / 2);
+        chunk->records.push_back(rec);
+        in_face_run = true;
+      }
 
-      // @todo { multiple object name? }
-      token += 2;
-      std::stringstream ss;
-      ss << token;
-      name = ss.str();
+      if (chunk->face_layout == FACE_LAYOUT_UNKNOWN) {
+        chunk->face_layout = detectFaceLayout(token);
+      }
 
+      size_t begin = chunk->face_indices.size();
+      if (!parseFaceIndicesFast(chunk->face_layout, token,
+                                &chunk->face_indices, kMissingIndex)) {
+        while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+          chunk->face_indices.push_back(parseRawTriple(&token, kMissingIndex));
+          token += strspn(token, " \t\r");
+        }
+      }
+      for (size_t k = begin; k < chunk->face_indices.size(); k++) {
+        const vertex_index_t &vi = chunk->face_indices[k];
+        chunk->has_zero_index |=
+            (vi.v_idx == 0) || (vi.vn_idx == 0) || (vi.vt_idx == 0);
+      }
+      chunk->face_sizes.push_back(
+          static_cast<unsigned int>(chunk->face_indices.size() - begin));
+      chunk->records.back().num_faces++;
       continue;
     }
 
-    if (token[0] == 't' && IS_SPACE(token[1])) {
-      const int max_tag_nums = 8192;  // FIXME(syoyo): Parameterize.
-      tag_t tag;
+    in_face_run = false;
 
-      token += 2;
+    if (parseAttribLine(token, &a, default_vcols_fallback)) {
+      continue;
+    }
 
-      tag.name = parseString(&token);
+    // Everything else is replayed in order on a single thread.
+    size_t len = line_len - static_cast<size_t>(token - line);
+    if ((token < chunk->begin) || (token >= chunk->end)) {
+      chunk->last_line.assign(token, len);
+      token = chunk->last_line.c_str();
+    }
 
-      tag_sizes ts = parseTagTriple(&token);
+    obj_chunk_record rec;
+    rec.line = token;
+    rec.line_len = len;
+    rec.line_num = chunk->num_lines;
+    rec.face_begin = 0;
+    rec.num_faces = 0;
+    rec.index_begin = 0;
+    rec.num_v = static_cast<int>(a.v.size() / 3);
+    rec.num_vn = static_cast<int>(a.vn.size() / 3);
+    rec.num_vt = static_cast<int>(a.vt.size() / 2);
+    chunk->records.push_back(rec);
+  }
+}
 
-      if (ts.num_ints < 0) {
-        ts.num_ints = 0;
-      }
-      if (ts.num_ints > max_tag_nums) {
-        ts.num_ints = max_tag_nums;
-      }
+static void resolveObjChunk(obj_chunk *chunk) {
+  if (chunk->has_zero_index) {
+    return;  // Resolved during the replay.
+  }
 
-      if (ts.num_reals < 0) {
-        ts.num_reals = 0;
-      }
-      if (ts.num_reals > max_tag_nums) {
-        ts.num_reals = max_tag_nums;
+  warning_context context;
+  context.warn = NULL;
+  context.line_number = 0;
+
+  for (size_t r = 0; r < chunk->records.size(); r++) {
+    const obj_chunk_record &rec = chunk->records[r];
+    if (rec.line) continue;
+
+    int vsize = chunk->v_base + rec.num_v;
+    int vnsize = chunk->vn_base + rec.num_vn;
+    int vtsize = chunk->vt_base + rec.num_vt;
+
+    vertex_index_t *vi = &chunk->face_indices[rec.index_begin];
+    for (size_t f = rec.face_begin; f < rec.face_begin + rec.num_faces; f++) {
+      for (unsigned int k = 0; k < chunk->face_sizes[f]; k++, vi++) {
+        if (!resolveRawTriple(*vi, vsize, vnsize, vtsize, vi, context)) {
+          chunk->error_face = f;
+          chunk->resolved = true;
+          return;
+        }
       }
+    }
+  }
+  chunk->resolved = true;
+}
 
-      if (ts.num_strings < 0) {
-        ts.num_strings = 0;
-      }
-      if (ts.num_strings > max_tag_nums) {
-        ts.num_strings = max_tag_nums;
-      }
+// Replays a parsed chunk in file order. Mirrors LoadObjFromLines().
+static bool replayObjChunk(obj_chunk *chunk, obj_parse_state *st,
+                           std::vector<shape_t> *shapes,
+                           std::vector<material_t> *materials,
+                           std::string *warn, std::string *err,
+                           MaterialReader *readMatFn, bool triangulate) {
+  std::string linebuf;
 
-      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+  for (size_t r = 0; r < chunk->records.size(); r++) {
+    const obj_chunk_record &rec = chunk->records[r];
+    st->num_v = chunk->v_base + rec.num_v;
+    st->num_vn = chunk->vn_base + rec.num_vn;
+    st->num_vt = chunk->vt_base + rec.num_vt;
+    st->line_num = chunk->line_base + rec.line_num;
 
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
-        tag.intValues[i] = parseInt(&token);
-      }
+    if (rec.line) {
+      linebuf.assign(rec.line, rec.line_len);
+      const char *token = linebuf.c_str();
 
-      tag.floatValues.resize(static_cast<size_t>(ts.num_reals));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_reals); ++i) {
-        tag.floatValues[i] = parseReal(&token);
+      bool handled;
+      if (!parsePrimLine(token, st, warn, err, &handled)) {
+        return false;
       }
-
-      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
-        tag.stringValues[i] = parseString(&token);
+      if (!handled && !parseCommandLine(token, st, shapes, materials, warn,
+                                        err, readMatFn, triangulate)) {
+        return false;
       }
-
-      tags.push_back(tag);
-
       continue;
     }
 
-    if (token[0] == 's' && IS_SPACE(token[1])) {
-      // smoothing group id
-      token += 2;
-
-      // skip space.
-      token += strspn(token, " \t");  // skip space
-
-      if (token[0] == '\0') {
-        continue;
-      }
-
-      if (token[0] == '\r' || token[1] == '\n') {
-        continue;
+    const vertex_index_t *vi = &chunk->face_indices[rec.index_begin];
+    for (size_t f = rec.face_begin; f < rec.face_begin + rec.num_faces;
+         f++, st->line_num++) {
+      face_t face;
+      face.smoothing_group_id = st->current_smoothing_id;
+
+      bool ok = (f != chunk->error_face);
+      if (ok && chunk->resolved) {
+        face.vertex_indices.assign(vi, vi + chunk->face_sizes[f]);
+      } else if (ok) {
+        warning_context context;
+        context.warn = warn;
+        context.line_number = st->line_num;
+
+        face.vertex_indices.resize(chunk->face_sizes[f]);
+        for (unsigned int k = 0; ok && k < chunk->face_sizes[f]; k++) {
+          ok = resolveRawTriple(vi[k], st->num_v, st->num_vn, st->num_vt,
+                                &face.vertex_indices[k], context);
+        }
       }
 
-      if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' &&
-          token[2] == 'f') {
-        current_smoothing_id = 0;
-      } else {
-        // assume number
-        int smGroupId = parseInt(&token);
-        if (smGroupId < 0) {
-          // parse error. force set to 0.
-          // FIXME(syoyo): Report warning.
-          current_smoothing_id = 0;
-        } else {
-          current_smoothing_id = static_cast<unsigned int>(smGroupId);
+      if (!ok) {
+        if (err) {
+          (*err) +=
+              "Failed to parse `f' line (e.g. a zero value for vertex index "
+              "or invalid relative vertex index). Line " +
+              toString(st->line_num) + ").\n";
         }
+        return false;
       }
 
-      continue;
-    }  // smoothing group id
-
-    // Ignore unknown command.
+      vi += chunk->face_sizes[f];
+      addFace(st, face);
+    }
   }
 
-  // not all vertices have colors, no default colors desired? -> clear colors
-  if (!found_all_colors && !default_vcols_fallback) {
-    vc.clear();
+  return true;
+}
+
+static bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                            std::vector<material_t> *materials,
+                            std::string *warn, std::string *err,
+                            const char *buf, size_t len,
+                            MaterialReader *readMatFn, bool triangulate,
+                            bool default_vcols_fallback,
+                            unsigned int num_threads) {
+  // Split into newline aligned chunks.
+  std::vector<obj_chunk> chunks(num_threads);
+  const char *end = buf + len;
+  const char *cur = buf;
+  for (unsigned int t = 0; t < num_threads; t++) {
+    const char *stop = buf + (len / num_threads) * (t + 1);
+    if ((t + 1 == num_threads) || (stop >= end)) {
+      stop = end;
+    } else if (stop < cur) {
+      stop = cur;
+    } else {
+      const char *nl = static_cast<const char *>(
+          memchr(stop, '\n', static_cast<size_t>(end - stop)));
+      stop = nl ? nl + 1 : end;
+    }
+    chunks[t].begin = cur;
+    chunks[t].end = stop;
+    cur = stop;
   }
 
-  if (greatest_v_idx >= static_cast<int>(v.size() / 3)) {
-    if (warn) {
-      std::stringstream ss;
-      ss << "Vertex indices out of bounds (line " << line_num << ".)\n\n";
-      (*warn) += ss.str();
+  {
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < chunks.size(); t++) {
+      workers.push_back(std::thread(parseObjChunk, &chunks[t],
+                                    default_vcols_fallback));
     }
+    parseObjChunk(&chunks[0], default_vcols_fallback);
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
   }
-  if (greatest_vn_idx >= static_cast<int>(vn.size() / 3)) {
-    if (warn) {
-      std::stringstream ss;
-      ss << "Vertex normal indices out of bounds (line " << line_num
-         << ".)\n\n";
-      (*warn) += ss.str();
+
+  // Prefix sum of the per-chunk attribute and line counts.
+  obj_parse_state st;
+  obj_attribs &a = st.attribs;
+  size_t num_v = 0, num_vn = 0, num_vt = 0, num_vc = 0;
+  for (size_t t = 0; t < chunks.size(); t++) {
+    obj_chunk &c = chunks[t];
+    c.v_base = static_cast<int>(num_v / 3);
+    c.vn_base = static_cast<int>(num_vn / 3);
+    c.vt_base = static_cast<int>(num_vt / 2);
+    c.line_base = (t == 0) ? 0
+                           : chunks[t - 1].line_base + chunks[t - 1].num_lines;
+    num_v += c.attribs.v.size();
+    num_vn += c.attribs.vn.size();
+    num_vt += c.attribs.vt.size();
+    num_vc += c.attribs.vc.size();
+    a.found_all_colors &= c.attribs.found_all_colors;
+  }
+
+  {
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < chunks.size(); t++) {
+      workers.push_back(std::thread(resolveObjChunk, &chunks[t]));
     }
+    resolveObjChunk(&chunks[0]);
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
   }
-  if (greatest_vt_idx >= static_cast<int>(vt.size() / 2)) {
-    if (warn) {
-      std::stringstream ss;
-      ss << "Vertex texcoord indices out of bounds (line " << line_num
-         << ".)\n\n";
-      (*warn) += ss.str();
+
+  a.v.reserve(num_v);
+  a.vertex_weights.reserve(num_v / 3);
+  a.vn.reserve(num_vn);
+  a.vt.reserve(num_vt);
+  a.vc.reserve(num_vc);
+  for (size_t t = 0; t < chunks.size(); t++) {
+    obj_attribs &ca = chunks[t].attribs;
+    a.v.insert(a.v.end(), ca.v.begin(), ca.v.end());
+    a.vertex_weights.insert(a.vertex_weights.end(), ca.vertex_weights.begin(),
+                            ca.vertex_weights.end());
+    a.vn.insert(a.vn.end(), ca.vn.begin(), ca.vn.end());
+    a.vt.insert(a.vt.end(), ca.vt.begin(), ca.vt.end());
+    a.vc.insert(a.vc.end(), ca.vc.begin(), ca.vc.end());
+    ca = obj_attribs();  // release
+  }
+
+  for (size_t t = 0; t < chunks.size(); t++) {
+    if (!replayObjChunk(&chunks[t], &st, shapes, materials, warn, err,
+                        readMatFn, triangulate)) {
+      return false;
     }
+    // release
+    std::vector<vertex_index_t>().swap(chunks[t].face_indices);
+    std::vector<unsigned int>().swap(chunks[t].face_sizes);
   }
+  st.line_num = chunks.back().line_base + chunks.back().num_lines;
 
-  bool ret = exportGroupsToShape(&shape, prim_group, tags, material, name,
-                                 triangulate, v, warn);
-  // exportGroupsToShape return false when `usemtl` is called in the last
-  // line.
-  // we also add `shape` to `shapes` when `shape.mesh` has already some
-  // faces(indices)
-  if (ret || shape.mesh.indices
-                 .size()) {  // FIXME(syoyo): Support other prims(e.g. lines)
-    shapes->push_back(shape);
+  return finishObj(&st, attrib, shapes, warn, triangulate,
+                   default_vcols_fallback);
+}
+#endif  // __cplusplus >= 201103L
+
+bool LoadObj(attrib_t *attrib, std::vector<shape_t> *shapes,
+             std::vector<material_t> *materials, std::string *warn,
+             std::string *err, std::istream *inStream,
+             MaterialReader *readMatFn /*= NULL*/, bool triangulate,
+             bool default_vcols_fallback) {
+  StreamLineReader reader(inStream);
+  return LoadObjFromLines(attrib, shapes, materials, warn, err, reader,
+                          readMatFn, triangulate, default_vcols_fallback);
+}
+
+bool LoadObjFromMemory(attrib_t *attrib, std::vector<shape_t> *shapes,
+                       std::vector<material_t> *materials, std::string *warn,
+                       std::string *err, const char *buf, size_t len,
+                       MaterialReader *readMatFn /*= NULL*/, bool triangulate,
+                       bool default_vcols_fallback,
+                       unsigned int num_threads /*= 1*/) {
+#if __cplusplus >= 201103L
+  if (num_threads == 0) {
+    num_threads = std::thread::hardware_concurrency();
+  }
+  // Not worth spinning up threads for small files.
+  const size_t min_chunk_size = 1024 * 1024;
+  if (num_threads > len / min_chunk_size) {
+    num_threads = static_cast<unsigned int>(len / min_chunk_size);
   }
-  prim_group.clear();  // for safety
+  if (num_threads > 1) {
+    return LoadObjParallel(attrib, shapes, materials, warn, err, buf, len,
+                           readMatFn, triangulate, default_vcols_fallback,
+                           num_threads);
+  }
+#else
+  (void)num_threads;
+#endif
 
-  if (err) {
-    (*err) += errss.str();
+  MemoryLineReader reader(buf, len);
+  return LoadObjFromLines(attrib, shapes, materials, warn, err, reader,
+                          readMatFn, triangulate, default_vcols_fallback);
+}
+
+bool LoadObjMapped(attrib_t *attrib, std::vector<shape_t> *shapes,
+                   std::vector<material_t> *materials, std::string *warn,
+                   std::string *err, const char *filename,
+                   const char *mtl_basedir, bool triangulate,
+                   bool default_vcols_fallback,
+                   unsigned int num_threads /*= 1*/) {
+  attrib->vertices.clear();
+  attrib->normals.clear();
+  attrib->texcoords.clear();
+  attrib->colors.clear();
+  shapes->clear();
+
+  MappedFile file;
+  if (!file.Open(filename)) {
+    if (err) {
+      std::stringstream errss;
+      errss << "Cannot open file [" << filename << "]\n";
+      (*err) = errss.str();
+    }
+    return false;
   }
 
-  attrib->vertices.swap(v);
-  attrib->vertex_weights.swap(vertex_weights);
-  attrib->normals.swap(vn);
-  attrib->texcoords.swap(vt);
-  attrib->texcoord_ws.swap(vt);
-  attrib->colors.swap(vc);
-  attrib->skin_weights.swap(vw);
+  std::string baseDir = mtl_basedir ? mtl_basedir : "";
+  if (!baseDir.empty()) {
+#ifndef _WIN32
+    const char dirsep = '/';
+#else
+    const char dirsep = '\\';
+#endif
+    if (baseDir[baseDir.length() - 1] != dirsep) baseDir += dirsep;
+  }
+  MaterialFileReader matFileReader(baseDir, /* use_mmap */ true);
 
-  return true;
+  return LoadObjFromMemory(attrib, shapes, materials, warn, err, file.data(),
+                           file.size(), &matFileReader, triangulate,
+                           default_vcols_fallback, num_threads);
 }
 
-bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
-                         void *user_data /*= NULL*/,
-                         MaterialReader *readMatFn /*= NULL*/,
-                         std::string *warn, /* = NULL*/
-                         std::string *err /*= NULL*/) {
+template <typename LineReader>
+static bool LoadObjWithCallbackFromLines(LineReader &reader,
+                                         size_t total_bytes,
+                                         const callback_t &callback,
+                                         void *user_data,
+                                         MaterialReader *readMatFn,
+                                         std::string *warn, std::string *err) {
   std::stringstream errss;
 
+  const size_t progress_interval = 1024 * 1024;
+  size_t last_progress = 0;
+
   // material
   std::set<std::string> material_filenames;
   std::map<std::string, int> material_map;
@@ -3173,31 +4472,31 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
   names.reserve(2);
   std::vector<const char *> names_out;
 
-  std::string linebuf;
-  while (inStream.peek() != -1) {
-    safeGetline(inStream, linebuf);
-
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
+  const char *line;
+  size_t line_len;
+  while (reader.Next(&line, &line_len)) {
+    if (callback.progress_cb &&
+        (reader.Offset() - last_progress >= progress_interval)) {
+      last_progress = reader.Offset();
+      if (!callback.progress_cb(user_data, last_progress, total_bytes)) {
+        if (err) {
+          (*err) += "Loading cancelled.\n";
+        }
+        return false;
+      }
     }
 
     // Skip if empty line.
-    if (linebuf.empty()) {
+    if (line_len == 0) {
       continue;
     }
 
     // Skip leading space.
-    const char *token = linebuf.c_str();
+    const char *token = line;
     token += strspn(token, " \t");
 
     assert(token);
-    if (token[0] == '\0') continue;  // empty line
+    if (IS_NEW_LINE(token[0])) continue;  // empty line
 
     if (token[0] == '#') continue;  // comment line
 
@@ -3267,6 +4566,9 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
       continue;
     }
 
+    // The remaining commands are rare and parse C strings.
+    token = reader.Terminated(token);
+
     // use mtl
     if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
       token += 7;
@@ -3444,6 +4746,10 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
     // Ignore unknown command.
   }
 
+  if (callback.progress_cb) {
+    callback.progress_cb(user_data, reader.Offset(), total_bytes);
+  }
+
   if (err) {
     (*err) += errss.str();
   }
@@ -3451,6 +4757,173 @@ bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
   return true;
 }
 
+bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
+                         void *user_data /*= NULL*/,
+                         MaterialReader *readMatFn /*= NULL*/,
+                         std::string *warn, /* = NULL*/
+                         std::string *err /*= NULL*/) {
+  StreamLineReader reader(&inStream);
+  return LoadObjWithCallbackFromLines(reader, 0, callback, user_data,
+                                      readMatFn, warn, err);
+}
+
+// Counts the `v`, `vn`, `vt` and `f` records without parsing any numbers.
+// Lines are only split at '\n', so files with lone '\r' line endings get
+// undercounted; the counts are a sizing hint, nothing more.
+static void countObjRecords(const char *buf, size_t len,
+                            record_counts_t *counts) {
+  const char *p = buf;
+  const char *end = buf + len;
+  while (p < end) {
+    while ((p < end) && IS_SPACE(*p)) p++;
+
+    const char *nl =
+        static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    const char *stop = nl ? nl : end;
+    size_t n = static_cast<size_t>(stop - p);
+
+    if ((n >= 2) && (p[0] == 'v')) {
+      if (IS_SPACE(p[1])) {
+        counts->num_vertices++;
+      } else if ((n >= 3) && (p[1] == 'n') && IS_SPACE(p[2])) {
+        counts->num_normals++;
+      } else if ((n >= 3) && (p[1] == 't') && IS_SPACE(p[2])) {
+        counts->num_texcoords++;
+      }
+    } else if ((n >= 2) && (p[0] == 'f') && IS_SPACE(p[1])) {
+      counts->num_faces++;
+      bool in_token = false;
+      for (const char *q = p + 2; (q < stop) && (*q != '#'); q++) {
+        bool space = IS_SPACE(*q) || (*q == '\r');
+        if (!space && !in_token) counts->num_face_vertices++;
+        in_token = !space;
+      }
+    }
+
+    p = nl ? nl + 1 : end;
+  }
+}
+
+bool LoadObjWithCallback(const char *buf, size_t len,
+                         const callback_t &callback,
+                         void *user_data /*= NULL*/,
+                         MaterialReader *readMatFn /*= NULL*/,
+                         std::string *warn /*= NULL*/,
+                         std::string *err /*= NULL*/) {
+  if (callback.counts_cb) {
+    record_counts_t counts;
+    countObjRecords(buf, len, &counts);
+    callback.counts_cb(user_data, counts);
+  }
+
+  MemoryLineReader reader(buf, len);
+  return LoadObjWithCallbackFromLines(reader, len, callback, user_data,
+                                      readMatFn, warn, err);
+}
+
+bool LoadObjWithCallbackMapped(const char *filename,
+                               const callback_t &callback,
+                               void *user_data /*= NULL*/,
+                               const char *mtl_basedir /*= NULL*/,
+                               std::string *warn /*= NULL*/,
+                               std::string *err /*= NULL*/) {
+  MappedFile file;
+  if (!file.Open(filename)) {
+    if (err) {
+      std::stringstream errss;
+      errss << "Cannot open file [" << filename << "]\n";
+      (*err) = errss.str();
+    }
+    return false;
+  }
+
+  std::string baseDir = mtl_basedir ? mtl_basedir : "";
+  if (!baseDir.empty()) {
+#ifndef _WIN32
+    const char dirsep = '/';
+#else
+    const char dirsep = '\\';
+#endif
+    if (baseDir[baseDir.length() - 1] != dirsep) baseDir += dirsep;
+  }
+  MaterialFileReader matFileReader(baseDir, /* use_mmap */ true);
+
+  return LoadObjWithCallback(file.data(), file.size(), callback, user_data,
+                             &matFileReader, warn, err);
+}
+
+bool TriangulatePolygon(const index_t *indices, int num_indices,
+                        const std::vector<real_t> &vertices,
+                        std::vector<index_t> *out, std::string *warn) {
+  if (num_indices < 3) {
+    if (warn) {
+      (*warn) += "Degenerated face found\n.";
+    }
+    return false;
+  }
+
+  if (num_indices == 3) {
+    out->insert(out->end(), indices, indices + 3);
+    return true;
+  }
+
+  if (num_indices == 4) {
+    // Same split as exportGroupsToShape(), inlined since quads are by far
+    // the most common polygon.
+    size_t vi[4];
+    for (int k = 0; k < 4; k++) {
+      vi[k] = size_t(indices[k].vertex_index);
+      if ((3 * vi[k] + 2) >= vertices.size()) {
+        if (warn) {
+          (*warn) += "Face with invalid vertex index found.\n";
+        }
+        return false;
+      }
+    }
+
+    real_t e02x = vertices[vi[2] * 3 + 0] - vertices[vi[0] * 3 + 0];
+    real_t e02y = vertices[vi[2] * 3 + 1] - vertices[vi[0] * 3 + 1];
+    real_t e02z = vertices[vi[2] * 3 + 2] - vertices[vi[0] * 3 + 2];
+    real_t e13x = vertices[vi[3] * 3 + 0] - vertices[vi[1] * 3 + 0];
+    real_t e13y = vertices[vi[3] * 3 + 1] - vertices[vi[1] * 3 + 1];
+    real_t e13z = vertices[vi[3] * 3 + 2] - vertices[vi[1] * 3 + 2];
+
+    real_t sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+    real_t sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+
+    if (sqr02 < sqr13) {
+      // [0, 1, 2], [0, 2, 3]
+      const int order[6] = {0, 1, 2, 0, 2, 3};
+      for (int k = 0; k < 6; k++) out->push_back(indices[order[k]]);
+    } else {
+      // [0, 1, 3], [1, 2, 3]
+      const int order[6] = {0, 1, 3, 1, 2, 3};
+      for (int k = 0; k < 6; k++) out->push_back(indices[order[k]]);
+    }
+    return true;
+  }
+
+  // Larger polygons are rare, so run them through the regular exporter to
+  // get exactly the same triangles.
+  PrimGroup prim_group;
+  prim_group.faceGroup.resize(1);
+  face_t &face = prim_group.faceGroup[0];
+  face.vertex_indices.reserve(static_cast<size_t>(num_indices));
+  for (int k = 0; k < num_indices; k++) {
+    face.vertex_indices.push_back(vertex_index_t(indices[k].vertex_index,
+                                                 indices[k].texcoord_index,
+                                                 indices[k].normal_index));
+  }
+
+  shape_t shape;
+  std::vector<tag_t> tags;
+  exportGroupsToShape(&shape, prim_group, tags, -1, std::string(), true,
+                      vertices, warn);
+  out->insert(out->end(), shape.mesh.indices.begin(),
+              shape.mesh.indices.end());
+  return !shape.mesh.indices.empty();
+}
+
 bool ObjReader::ParseFromFile(const std::string &filename,
                               const ObjReaderConfig &config) {
   std::string mtl_search_path;
@@ -3468,9 +4941,16 @@ bool ObjReader::ParseFromFile(const std::string &filename,
     mtl_search_path = config.mtl_search_path;
   }
 
-  valid_ = LoadObj(&attrib_, &shapes_, &materials_, &warning_, &error_,
-                   filename.c_str(), mtl_search_path.c_str(),
-                   config.triangulate, config.vertex_color);
+  if (config.use_mmap) {
+    valid_ = LoadObjMapped(&attrib_, &shapes_, &materials_, &warning_, &error_,
+                           filename.c_str(), mtl_search_path.c_str(),
+                           config.triangulate, config.vertex_color,
+                           config.num_threads);
+  } else {
+    valid_ = LoadObj(&attrib_, &shapes_, &materials_, &warning_, &error_,
+                     filename.c_str(), mtl_search_path.c_str(),
+                     config.triangulate, config.vertex_color);
+  }
 
   return valid_;
 }
@@ -0,0 +1,139 @@
+#include "ubo.h"
+
+#include "mesh.h"
+#include "shaders.h"
+
+#include <glm/gtc/type_ptr.hpp>
+#include <imgui.h>
+#include <algorithm>
+#include <iostream>
+
+size_t UniformBlocks::uploads = 0;
+size_t UniformBlocks::bytes_uploaded = 0;
+
+GLuint UniformBlocks::s_camera = 0;
+GLuint UniformBlocks::s_lights = 0;
+CameraBlock UniformBlocks::s_cameraData{};
+std::array<LightBlock, UniformBlocks::num_lights> UniformBlocks::s_lightData{};
+bool UniformBlocks::s_cameraDirty = true;
+uint32_t UniformBlocks::s_dirtyLights = (1u << num_lights) - 1;
+
+void UniformBlocks::initialize() {
+    // Filled by the first flush(), everything starts dirty
+    glGenBuffers(1, &s_camera);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_camera);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), nullptr, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &s_lights);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_lights);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(s_lightData), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // These bindings stay, only the material range changes between draws
+    glBindBufferBase(GL_UNIFORM_BUFFER, camera_binding, s_camera);
+    glBindBufferBase(GL_UNIFORM_BUFFER, lights_binding, s_lights);
+}
+
+void UniformBlocks::bind(GLuint program) {
+    struct Block {
+        const char* name;
+        Binding binding;
+        size_t size;
+    };
+    const Block blocks[] = {
+        {"Camera", camera_binding, sizeof(CameraBlock)},
+        {"Lights", lights_binding, sizeof(s_lightData)},
+        {"Materials", materials_binding, materials_per_range * sizeof(MaterialBlock)}
+    };
+
+    // GL 4.1 has no binding layout qualifier, the program is told instead
+    const ProgramReflection& reflection = Shader::reflection(program);
+    for (const Block& block : blocks) {
+        auto it = reflection.uniformBlocks.find(block.name);
+        if (it == reflection.uniformBlocks.end()) continue;
+        if (static_cast<size_t>(it->second.size) != block.size) {
+            std::cerr << "Uniform block " << block.name << " is " << it->second.size
+                      << " bytes, expected " << block.size << "\n";
+            continue;
+        }
+        glUniformBlockBinding(program, it->second.location, block.binding);
+    }
+}
+
+void UniformBlocks::set_camera(const glm::mat4& view, const glm::mat4& projection) {
+    if (view == s_cameraData.view && projection == s_cameraData.projection) return;
+    s_cameraData = {view, projection, projection * view};
+    s_cameraDirty = true;
+}
+
+void UniformBlocks::set_light(int light, const glm::vec4& position, const glm::vec4& color) {
+    LightBlock& data = s_lightData[light];
+    if (position == data.position && color == data.color) return;
+    data = {position, color};
+    s_dirtyLights |= 1u << light;
+}
+
+void UniformBlocks::flush() {
+    uploads = 0;
+    bytes_uploaded = 0;
+
+    if (s_cameraDirty) {
+        glBindBuffer(GL_UNIFORM_BUFFER, s_camera);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &s_cameraData);
+        uploads++;
+        bytes_uploaded += sizeof(CameraBlock);
+        s_cameraDirty = false;
+    }
+
+    // One upload per run of changed lights
+    if (s_dirtyLights != 0) {
+        glBindBuffer(GL_UNIFORM_BUFFER, s_lights);
+        for (int first = 0; first < num_lights; first++) {
+            if (!(s_dirtyLights & (1u << first))) continue;
+            int last = first;
+            while (last + 1 < num_lights && (s_dirtyLights & (1u << (last + 1)))) last++;
+            GLsizeiptr bytes = (last - first + 1) * sizeof(LightBlock);
+            glBufferSubData(GL_UNIFORM_BUFFER, first * sizeof(LightBlock), bytes, &s_lightData[first]);
+            uploads++;
+            bytes_uploaded += bytes;
+            first = last;
+        }
+        s_dirtyLights = 0;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+GLuint UniformBlocks::create_materials(const std::vector<Material>& materials) {
+    // Whole ranges, as a bound range must cover the block
+    size_t ranges = std::max<size_t>(1, (materials.size() + materials_per_range - 1) / materials_per_range);
+    std::vector<MaterialBlock> table(ranges * materials_per_range);
+    for (size_t i = 0; i < materials.size(); i++) {
+        const Material& m = materials[i];
+        table[i] = {glm::vec4(m.ambient, m.shininess), glm::make_vec4(m.textureSlots)};
+    }
+
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, table.size() * sizeof(MaterialBlock), table.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return buffer;
+}
+
+void UniformBlocks::bind_materials(GLuint table, int range) {
+    // 8 KB offsets meet any GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    GLsizeiptr bytes = materials_per_range * sizeof(MaterialBlock);
+    glBindBufferRange(GL_UNIFORM_BUFFER, materials_binding, table, range * bytes, bytes);
+}
+
+void UniformBlocks::draw_stats() {
+    ImGui::Text("Uniform buffers: %zu uploads, %zu bytes last frame", uploads, bytes_uploaded);
+}
+
+void UniformBlocks::shutdown() {
+    GLuint buffers[] = {s_camera, s_lights};
+    glDeleteBuffers(2, buffers);
+    s_camera = 0;
+    s_lights = 0;
+    s_cameraDirty = true;
+    s_dirtyLights = (1u << num_lights) - 1;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Material;
+
+// std140 layouts of the uniform blocks of the shaders (Camera, Lights, Materials)
+struct CameraBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+};
+
+struct LightBlock {
+    glm::vec4 position;
+    glm::vec4 color;        // a: 0 for off
+};
+
+struct MaterialBlock {
+    glm::vec4 ambient;          // w: shininess
+    glm::ivec4 textureSlots;    // Material::textureSlots
+};
+
+// The uniform buffers shared by all programs: the camera and the lights,
+// re-uploaded only where they changed since the last flush(), and the
+// material tables of the meshes, written once on upload. Draws select their
+// material by index into a range of `materials_per_range` of the table
+class UniformBlocks {
+public:
+
+    enum Binding : GLuint {
+        camera_binding = 0,
+        lights_binding = 1,
+        materials_binding = 2
+    };
+
+    static constexpr int num_lights = 5;            // Lights.lights[]
+    static constexpr int materials_per_range = 256; // Materials.materials[], 8 KB of the 16 KB every GL has
+
+    // Creates the camera and light buffers, once the GL context exists
+    static void initialize();
+
+    // Points the blocks `program` has at their binding, and reports those
+    // whose size differs from the structs above
+    static void bind(GLuint program);
+
+    static void set_camera(const glm::mat4& view, const glm::mat4& projection);
+    static void set_light(int light, const glm::vec4& position, const glm::vec4& color);
+
+    // Uploads what changed since the last call, before drawing
+    static void flush();
+
+    // The material table of a mesh, in whole ranges. GL thread only
+    static GLuint create_materials(const std::vector<Material>& materials);
+
+    // Binds materials [range * materials_per_range, (range + 1) * materials_per_range) of `table`
+    static void bind_materials(GLuint table, int range);
+
+    static void draw_stats();
+
+    static void shutdown();
+
+    // Counters of the last flush()
+    static size_t uploads;
+    static size_t bytes_uploaded;
+
+private:
+    static GLuint s_camera;
+    static GLuint s_lights;
+    static CameraBlock s_cameraData;
+    static std::array<LightBlock, num_lights> s_lightData;
+    static bool s_cameraDirty;
+    static uint32_t s_dirtyLights;  // Bit i: s_lightData[i] changed
+};
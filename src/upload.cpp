@@ -0,0 +1,204 @@
+#include "upload.h"
+#include "atlas.h"
+#include "glstate.h"
+
+#include <imgui.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unordered_set>
+
+float UploadScheduler::budget_mb = 8.0f;
+float UploadScheduler::budget_ms = 2.0f;
+size_t UploadScheduler::queued_bytes = 0;
+size_t UploadScheduler::frame_bytes = 0;
+float UploadScheduler::frame_ms = 0.0f;
+
+std::list<PendingMesh> UploadScheduler::s_pending;
+
+void UploadScheduler::enqueue(CpuMesh&& mesh) {
+    PendingMesh& p = s_pending.emplace_back();
+    p.cpu = std::move(mesh);
+
+    // Only the GL objects this mesh creates are filled by it, once each. Those
+    // it shares are filled already, or by a mesh queued earlier and so completed earlier
+    std::unordered_set<uint64_t> created;
+    auto creates = [&created](uint64_t key) { return !ResourceCache::contains(key) && created.insert(key).second; };
+    std::vector<bool> new_objects;
+    for (const CpuDrawObject& c : p.cpu.objects) {
+        new_objects.push_back(creates(c.key));
+    }
+    std::vector<bool> new_textures;
+    for (const CpuTexture& t : p.cpu.textures) {
+        new_textures.push_back(creates(t.key));
+    }
+    bool new_set = p.cpu.textureSetKey != 0 && creates(p.cpu.textureSetKey);
+
+    p.data = Mesh::upload(p.cpu, false);
+
+    for (size_t i = 0; i < p.cpu.objects.size(); i++) {
+        const CpuDrawObject& c = p.cpu.objects[i];
+        const DrawObject& o = p.data.m_draw_objects[i];
+        if (o.vao == 0 || !new_objects[i]) continue;
+        p.items.push_back({o.vbo, static_cast<const unsigned char*>(c.vertex_data()), c.vertex_bytes()});
+        p.items.push_back({o.ebo, static_cast<const unsigned char*>(c.index_data()), c.index_bytes()});
+    }
+    // Streamed textures upload their own levels
+    if (p.cpu.textureSetKey == 0 && !p.cpu.streamTextures) {
+        for (size_t i = 0; i < p.cpu.textures.size(); i++) {
+            const CpuTexture& t = p.cpu.textures[i];
+            if (!new_textures[i]) continue;
+            p.items.push_back({p.data.textures.at(t.name), t.pixels.data(), t.pixels.size(), 0, &t});
+        }
+    }
+    for (size_t a = 0; new_set && a < p.cpu.textureArrays.size(); a++) {
+        const std::vector<uint32_t>& layers = p.cpu.textureArrays[a].layers;
+        for (size_t l = 0; l < layers.size(); l++) {
+            const CpuTexture& t = p.cpu.textures[layers[l]];
+            p.items.push_back({p.data.m_texture_arrays[a], t.pixels.data(), t.pixels.size(), 0, &t, 0,
+                               static_cast<int>(l)});
+        }
+    }
+
+    for (const UploadItem& item : p.items) {
+        queued_bytes += item.size;
+    }
+}
+
+size_t UploadScheduler::upload_slice(UploadItem& item, size_t max_bytes) {
+    size_t bytes = std::min(max_bytes, item.size - item.done);
+
+    if (!item.texture) {
+        // The copy binding point leaves the VAO's element buffer binding alone
+        glBindBuffer(GL_COPY_WRITE_BUFFER, item.target);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, item.done, bytes, item.data + item.done);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return bytes;
+    }
+
+    // Textures go in whole rows, or whole mip levels when compressed, at least one per slice
+    const CpuTexture& t = *item.texture;
+    size_t first_row = 0, rows = 0, first_level = 0, levels = 0;
+    if (t.compressed()) {
+        for (size_t offset = 0; offset < item.done; first_level++) {
+            offset += t.mipSizes[first_level];
+        }
+        bytes = 0;
+        for (; first_level + levels < t.mipSizes.size(); levels++) {
+            size_t level_bytes = t.mipSizes[first_level + levels];
+            if (levels > 0 && bytes + level_bytes > max_bytes) break;
+            bytes += level_bytes;
+        }
+    } else {
+        size_t row_bytes = static_cast<size_t>(t.width) * t.comp;
+        first_row = item.done / row_bytes;
+        rows = std::max<size_t>(1, bytes / row_bytes);
+        rows = std::min(rows, static_cast<size_t>(t.height) - first_row);
+        bytes = rows * row_bytes;
+    }
+
+    // The slice is written into the texture's pixel unpack buffer, and
+    // glTexSubImage2D then sources it from there without blocking on the copy
+    if (item.pbo == 0) {
+        glGenBuffers(1, &item.pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, item.pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, item.size, nullptr, GL_STREAM_DRAW);
+    } else {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, item.pbo);
+    }
+    void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, item.done, bytes,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    std::memcpy(staging, item.data + item.done, bytes);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // Layers of texture arrays go through the 3D calls, one layer deep
+    GLenum target = item.layer < 0 ? GL_TEXTURE_2D : GL_TEXTURE_2D_ARRAY;
+    GLint layer = std::max(item.layer, 0);
+    GLState::bind_texture(target, item.target);
+    if (t.compressed()) {
+        size_t offset = item.done;
+        for (size_t level = first_level; level < first_level + levels; level++) {
+            GLsizei w = std::max(1, t.width >> level), h = std::max(1, t.height >> level);
+            GLsizei size = static_cast<GLsizei>(t.mipSizes[level]);
+            const void* data = reinterpret_cast<const void*>(offset);
+            if (item.layer < 0) {
+                glCompressedTexSubImage2D(target, static_cast<GLint>(level), 0, 0, w, h, t.compressedFormat, size, data);
+            } else {
+                glCompressedTexSubImage3D(target, static_cast<GLint>(level), 0, 0, layer, w, h, 1,
+                                          t.compressedFormat, size, data);
+            }
+            offset += t.mipSizes[level];
+        }
+    } else {
+        GLint y = static_cast<GLint>(first_row);
+        GLsizei h = static_cast<GLsizei>(rows);
+        const void* data = reinterpret_cast<const void*>(item.done);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (item.layer < 0) {
+            glTexSubImage2D(target, 0, 0, y, t.width, h, t.format(), GL_UNSIGNED_BYTE, data);
+        } else {
+            glTexSubImage3D(target, 0, 0, y, layer, t.width, h, 1, t.format(), GL_UNSIGNED_BYTE, data);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (item.done + bytes == item.size) {
+        // Arrays get their mips once all layers are in, see run()
+        if (!t.compressed() && item.layer < 0) glGenerateMipmap(GL_TEXTURE_2D);
+        glDeleteBuffers(1, &item.pbo);
+        item.pbo = 0;
+    }
+    GLState::bind_texture(target, 0);
+    return bytes;
+}
+
+void UploadScheduler::run(std::vector<DataTex>& meshes) {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    size_t budget = static_cast<size_t>(budget_mb * 1024.0f * 1024.0f);
+    frame_bytes = 0;
+
+    // Always make some progress, however small the budget
+    for (auto it = s_pending.begin(); it != s_pending.end(); ) {
+        PendingMesh& p = *it;
+        while (p.next < p.items.size()) {
+            std::chrono::duration<float, std::milli> elapsed = clock::now() - start;
+            if (frame_bytes > 0 && (frame_bytes >= budget || elapsed.count() >= budget_ms)) break;
+
+            UploadItem& item = p.items[p.next];
+            size_t bytes = upload_slice(item, std::max<size_t>(budget - std::min(budget, frame_bytes), 1));
+            item.done += bytes;
+            frame_bytes += bytes;
+            queued_bytes -= bytes;
+            if (item.done == item.size) p.next++;
+        }
+
+        if (p.next < p.items.size()) break;
+
+        // Complete: hand it over, its CPU copy is no longer needed
+        TextureAtlas::generate_mipmaps(p.cpu, p.data);
+        meshes.push_back(std::move(p.data));
+        it = s_pending.erase(it);
+    }
+
+    frame_ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+}
+
+void UploadScheduler::draw_stats() {
+    ImGui::SliderFloat("Upload budget (MB/frame)", &budget_mb, 0.25f, 256.0f);
+    ImGui::SliderFloat("Upload budget (ms/frame)", &budget_ms, 0.1f, 16.0f);
+    ImGui::Text("Queued: %.1f MB in %d meshes", queued_bytes / 1048576.0, static_cast<int>(s_pending.size()));
+    ImGui::Text("Last frame: %.2f MB in %.2f ms", frame_bytes / 1048576.0, frame_ms);
+}
+
+void UploadScheduler::shutdown() {
+    for (PendingMesh& p : s_pending) {
+        for (UploadItem& item : p.items) {
+            if (item.pbo != 0) glDeleteBuffers(1, &item.pbo);
+        }
+        p.data.cleanup();
+    }
+    s_pending.clear();
+    queued_bytes = 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <list>
+#include <vector>
+
+// One buffer or texture whose contents are still to be uploaded
+struct UploadItem {
+    GLuint target = 0;                        // Buffer or texture name
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    size_t done = 0;                          // Bytes uploaded so far
+    const CpuTexture* texture = nullptr;      // Null for buffers
+    GLuint pbo = 0;                           // Pixel unpack buffer staging a texture
+    int layer = -1;                           // Into a GL_TEXTURE_2D_ARRAY target, -1 for GL_TEXTURE_2D
+};
+
+// A mesh whose GL objects exist but are not filled yet
+struct PendingMesh {
+    CpuMesh cpu;                              // Source of the items, kept alive until done
+    DataTex data;
+    std::vector<UploadItem> items;
+    size_t next = 0;                          // First unfinished item
+};
+
+// Spreads GPU uploads over frames: each frame uploads at most `budget_mb`
+// or for at most `budget_ms`, in glBufferSubData/glTexSubImage2D slices
+// (textures are staged through pixel unpack buffers).
+// Meshes are only handed out once all of their data is on the GPU
+class UploadScheduler {
+public:
+
+    // Creates the GL objects of `mesh` and queues their contents
+    static void enqueue(CpuMesh&& mesh);
+
+    // Uploads up to the frame budget, and appends the meshes it completed to `meshes`. GL thread only
+    static void run(std::vector<DataTex>& meshes);
+
+    // Budget sliders and counters
+    static void draw_stats();
+
+    // Deletes the GL objects of the meshes that never finished
+    static void shutdown();
+
+    static float budget_mb;           // Per frame
+    static float budget_ms;           // Per frame, CPU time spent issuing uploads
+
+    // Counters
+    static size_t queued_bytes;       // Not uploaded yet
+    static size_t frame_bytes;        // Uploaded in the last run()
+    static float frame_ms;
+
+private:
+    static size_t upload_slice(UploadItem& item, size_t max_bytes);
+
+    static std::list<PendingMesh> s_pending;
+};
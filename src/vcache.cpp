@@ -0,0 +1,133 @@
+#include "vcache.h"
+
+#include <algorithm>
+
+// Tipsify, from "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw" (Sander, Nehab, Barczak 2007). Fans around a vertex that is still
+// in the cache, and jumps to a recently used vertex with live triangles when
+// the fan is exhausted.
+void VertexCache::optimize(std::vector<uint32_t>& indices, size_t numVertices) {
+    const size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0 || numVertices == 0) return;
+
+    // Vertex -> triangle adjacency
+    std::vector<uint32_t> live(numVertices, 0);
+    for (uint32_t v : indices) live[v]++;
+
+    std::vector<uint32_t> offsets(numVertices + 1, 0);
+    for (size_t v = 0; v < numVertices; v++) offsets[v + 1] = offsets[v] + live[v];
+
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    std::vector<uint32_t> cacheTime(numVertices, 0);
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    uint32_t time = cache_size + 1;
+    size_t cursor = 0;
+    int64_t fanning = 0;
+
+    while (fanning >= 0) {
+        const uint32_t f = static_cast<uint32_t>(fanning);
+        candidates.clear();
+
+        for (uint32_t a = offsets[f]; a < offsets[f + 1]; a++) {
+            const uint32_t t = adjacency[a];
+            if (emitted[t]) continue;
+            emitted[t] = true;
+
+            for (int k = 0; k < 3; k++) {
+                const uint32_t v = indices[3 * t + k];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > cache_size) {
+                    cacheTime[v] = time++;
+                }
+            }
+        }
+
+        // Next fanning vertex: the oldest candidate that stays in the cache
+        // while its remaining triangles are emitted
+        fanning = -1;
+        uint32_t best = 0;
+        for (uint32_t v : candidates) {
+            if (live[v] == 0) continue;
+            uint32_t priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cache_size) {
+                priority = time - cacheTime[v];
+            }
+            if (fanning < 0 || priority > best) {
+                best = priority;
+                fanning = v;
+            }
+        }
+
+        // Dead end: back up to a recently used vertex, then scan for any left
+        while (fanning < 0 && !deadEnd.empty()) {
+            const uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0) fanning = v;
+        }
+        while (fanning < 0 && cursor < numVertices) {
+            if (live[cursor] > 0) fanning = static_cast<int64_t>(cursor);
+            cursor++;
+        }
+    }
+
+    indices.swap(output);
+}
+
+void VertexCache::reorder_vertices(std::vector<uint32_t>& indices, std::vector<float>& vertices, size_t stride) {
+    const size_t numVertices = vertices.size() / stride;
+    constexpr uint32_t unused = UINT32_MAX;
+
+    std::vector<uint32_t> remap(numVertices, unused);
+    uint32_t next = 0;
+    for (uint32_t& v : indices) {
+        if (remap[v] == unused) remap[v] = next++;
+        v = remap[v];
+    }
+
+    // Vertices no triangle refers to keep their relative order at the end
+    for (uint32_t& r : remap) {
+        if (r == unused) r = next++;
+    }
+
+    std::vector<float> reordered(vertices.size());
+    for (size_t v = 0; v < numVertices; v++) {
+        std::copy_n(vertices.begin() + v * stride, stride, reordered.begin() + remap[v] * stride);
+    }
+    vertices.swap(reordered);
+}
+
+size_t VertexCache::cache_misses(const std::vector<uint32_t>& indices, size_t numVertices) {
+    // FIFO cache: a vertex is in the cache if it was added within the last
+    // cache_size misses
+    std::vector<size_t> addedAt(numVertices, SIZE_MAX);
+    size_t misses = 0;
+    for (uint32_t v : indices) {
+        if (addedAt[v] == SIZE_MAX || misses - addedAt[v] >= cache_size) {
+            addedAt[v] = misses++;
+        }
+    }
+    return misses;
+}
+
+float VertexCache::acmr(const std::vector<uint32_t>& indices, size_t numVertices) {
+    if (indices.size() < 3) return 0.0f;
+    return static_cast<float>(cache_misses(indices, numVertices)) / static_cast<float>(indices.size() / 3);
+}
+
+float VertexCache::atvr(const std::vector<uint32_t>& indices, size_t numVertices) {
+    if (numVertices == 0) return 0.0f;
+    return static_cast<float>(cache_misses(indices, numVertices)) / static_cast<float>(numVertices);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Post-transform vertex cache optimization of indexed triangle lists.
+class VertexCache {
+public:
+
+    // FIFO cache size used for optimizing and for the reported metrics
+    static constexpr int cache_size = 16;
+
+    // Reorders the triangles of `indices` for vertex cache locality (Tipsify)
+    static void optimize(std::vector<uint32_t>& indices, size_t numVertices);
+
+    // Renumbers the vertices in order of first use and permutes `vertices`
+    // (`stride` floats per vertex) to match, so vertex fetch is linear
+    static void reorder_vertices(std::vector<uint32_t>& indices, std::vector<float>& vertices, size_t stride);
+
+    // Average cache miss ratio: transformed vertices per triangle
+    static float acmr(const std::vector<uint32_t>& indices, size_t numVertices);
+
+    // Average transform to vertex ratio: transformed vertices per unique vertex
+    static float atvr(const std::vector<uint32_t>& indices, size_t numVertices);
+
+private:
+    static size_t cache_misses(const std::vector<uint32_t>& indices, size_t numVertices);
+};
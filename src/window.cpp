@@ -3,6 +3,17 @@
 #include "shaders.h"
 #include "mesh.h"
 #include "camera.h"
+#include "loader.h"
+#include "upload.h"
+#include "texcache.h"
+#include "stream.h"
+#include "resources.h"
+#include "scene.h"
+#include "multidraw.h"
+#include "ubo.h"
+#include "glstate.h"
+#include "culling.h"
+#include "bvh.h"
 
 #include <vector>
 #include <GL/glew.h>
@@ -17,6 +28,7 @@ bool Window::cursorInsideWindow = true;
 bool Window::firstMouseAfterToggle = true;
 
 GLuint Window::shaderProgram = 0;
+Uniform<glm::mat4> Window::model_uniform;
 
 int Window::render_mode = 0;
 int Window::filter_mode = 1;  // 0 = None, 1 = Bilinear, 2 = Trilinear, 3 = Anisotropic
@@ -28,6 +40,16 @@ int Window::current_vp_width = window_width / 6;
 int Window::current_vp_height = window_height;
 float Window::aspect_ratio = 0.0f;
 
+int Window::instance_mesh = 0;
+int Window::instance_grid = 10;
+float Window::instance_spacing = 1.5f;
+glm::vec3 Window::instance_position = glm::vec3(0.0f);
+float Window::instance_yaw = 0.0f;
+float Window::instance_scale = 1.0f;
+
+RayHit Window::pick;
+RayHit Window::previous_pick;
+
 // =========== INITIALIZING LIGHTS ===========
 std::array<glm::vec4, Window::num_lights>  Window::m_lightPosn = {
     glm::vec4(0.f, 100.f, 200.f, 1.f),
@@ -46,6 +68,7 @@ std::array<glm::vec4, Window::num_lights> Window::m_lightCol = {
 };
 
 std::vector<DataTex> Window::m_data = std::vector<DataTex>();
+std::vector<glm::mat4> Window::m_models;
 GLFWwindow* Window::glfwWindow = nullptr;
 
 Window::~Window() {
@@ -53,6 +76,10 @@ Window::~Window() {
 }
 
 void Window::cleanup() {
+    // Stop the background loads and uploads before the GL context goes away
+    AsyncLoader::shutdown();
+    UploadScheduler::shutdown();
+
     // Cleanup ImGui
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -63,6 +90,10 @@ void Window::cleanup() {
         data.cleanup();
     }
     m_data.clear();
+    MultiDraw::shutdown();
+    UniformBlocks::shutdown();
+    ResourceCache::shutdown();
+    TextureStreamer::shutdown();
 
     // Cleanup shader program
     if (shaderProgram != 0) {
@@ -85,7 +116,7 @@ bool Window::isActive() {
 void Window::applyTextureFiltering() {
     for (auto& data : m_data) {
         for (auto& [name, texId] : data.textures) {
-            glBindTexture(GL_TEXTURE_2D, texId);
+            GLState::bind_texture(GL_TEXTURE_2D, texId);
 
             switch (filter_mode) {
                 case 0: // None (Nearest)
@@ -109,23 +140,22 @@ void Window::applyTextureFiltering() {
                     break;
             }
 
-            glBindTexture(GL_TEXTURE_2D, 0);
+            GLState::bind_texture(GL_TEXTURE_2D, 0);
         }
     }
 }
 
-void Window::updateMVP(const DataTex& data) {
+glm::mat4 Window::updateModel(const DataTex& data) {
     // Compute scaling factor
     glm::mat2x3 borders = {data.m_draw_objects[0].bmin, data.m_draw_objects[0].bmax};
     float maxExtent = std::max({0.5f * (borders[1][0] - borders[0][0]),
                                 0.5f * (borders[1][1] - borders[0][1]),
                                 0.5f * (borders[1][2] - borders[0][2])});
-    glm::mat4 view  = Camera::getViewMatrix();
-    glm::mat4 proj  = Camera::getProjection(aspect_ratio);
     glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / maxExtent));
-    glm::mat4 MVP   = proj * view * model;
 
-    glUniform4fv(glGetUniformLocation(shaderProgram, "uMVP"),1, glm::value_ptr(model));
+    // The camera is in its uniform block, only the model is per mesh
+    model_uniform.set(model);
+    return model;
 }
 
 void Window::resize_window(GLFWwindow* window, int width, int height) {
@@ -144,9 +174,9 @@ void Window::resize_window(GLFWwindow* window, int width, int height) {
     current_vp_height = height;
     current_vp_width = vp;
 
-    glViewport(vp, 0, width - vp, height);
+    GLState::viewport(vp, 0, width - vp, height);
 
-   // updateMVP();
+   // updateModel();
 }
 
 void Window::keyboard(GLFWwindow* window, int key, int scancode, int action, int mods) {
@@ -230,17 +260,43 @@ void Window::mouse(GLFWwindow * window, double xpos, double ypos) {
 
 void Window::mouseButton(GLFWwindow* window, int button, int action, int mods) {
     ImGui_ImplGlfw_MouseButtonCallback(window, button, action, mods);
+
+    // A left click picks the surface under the cursor, or at the centre of
+    // the view while the mouse turns the camera
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) return;
+    glm::vec2 ndc(0.0f);
+    if (!active_cursor) {
+        if (ImGui::GetIO().WantCaptureMouse) return;
+        double xpos, ypos;
+        glfwGetCursorPos(window, &xpos, &ypos);
+        ndc.x = 2.0f * static_cast<float>(xpos - current_vp_width) / (window_width - current_vp_width) - 1.0f;
+        ndc.y = 1.0f - 2.0f * static_cast<float>(ypos) / window_height;
+    }
+
+    // The ray from the near to the far plane through that point
+    glm::mat4 inverse = glm::inverse(Camera::getProjection(aspect_ratio) * Camera::getViewMatrix());
+    glm::vec4 near = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+    glm::vec4 far = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(near) / near.w;
+    RayHit hit = BVH::raycast(m_data, m_models, origin, glm::vec3(far) / far.w - origin);
+    if (hit.hit()) {
+        previous_pick = pick;
+        pick = hit;
+    }
 }
 
 void Window::drag_drop(GLFWwindow* window, int count, const char** paths) {
     std::cout << "Dropped files: " << count << std::endl;
     for (int i = 0; i < count; i++) {
         std::cout << "File " << i + 1 << ": " << paths[i] << std::endl;
-        DataTex obj = Mesh::load_obj(paths[i]);
-        if (!obj.m_draw_objects.empty()) {
-            m_data.push_back(std::move(obj));
+        // Parsed in the background, then uploaded over the next frames by update().
+        // A scene loads each of its meshes once, with all of its copies as instances
+        if (std::filesystem::path(paths[i]).extension() == ".scene") {
+            for (SceneMesh& mesh : Scene::load(paths[i])) {
+                AsyncLoader::load(mesh.filename, Mesh::load_options(), std::move(mesh.instances));
+            }
         } else {
-            std::cerr << "Warning: Failed to load mesh from " << paths[i] << std::endl;
+            AsyncLoader::load(paths[i], Mesh::load_options());
         }
     }
 }
@@ -287,6 +343,9 @@ int Window::initialize(const std::string& filename) {
 
     std::cout << "OpenGL Version: " << glGetString(GL_VERSION) << "\n";
 
+    // BC1/BC3 need S3TC, BC4/BC5 are core
+    TextureCache::supported = GLEW_EXT_texture_compression_s3tc;
+
     // =========== INITIALIZING IMGUI ===========
     ImGui::CreateContext();
     // Pass 'false' to prevent ImGui from installing its own callbacks
@@ -312,10 +371,18 @@ int Window::initialize(const std::string& filename) {
     aspect_ratio = static_cast<float>(window_width) / static_cast<float>(window_height);
 
     // =========== INITIALIZING SHADERS ===========
+    MultiDraw::initialize();
     GLuint vertexShader = Shader::init_shaders(GL_VERTEX_SHADER, "../res/shaders/vertex.glsl");
     GLuint fragmentShader = Shader::init_shaders(GL_FRAGMENT_SHADER, "../res/shaders/fragment.glsl");
     shaderProgram = Shader::init_program(vertexShader, fragmentShader);
-    glUseProgram(shaderProgram);
+    GLState::use_program(shaderProgram);
+    model_uniform = {shaderProgram, "uModel"};
+
+    // Camera and lights are shared by both programs through uniform buffers
+    UniformBlocks::initialize();
+    for (GLuint program : {shaderProgram, MultiDraw::program}) {
+        if (program != 0) UniformBlocks::bind(program);
+    }
 
     // =========== LOADING .OBJ ===========
     DataTex newObj = Mesh::load_obj(filename);
@@ -329,33 +396,63 @@ int Window::initialize(const std::string& filename) {
 }
 
 void Window::display() {
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    GLState::begin_frame();
+    FrustumCuller::begin_frame();
+    GLState::clear_color(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Send arrays (positions & colors)
-    glUniform4fv(glGetUniformLocation(shaderProgram, "light_posn"), num_lights, glm::value_ptr(m_lightPosn[0]));
-    glUniform4fv(glGetUniformLocation(shaderProgram, "light_col"), num_lights, glm::value_ptr(m_lightCol[0]));
-
-    for(DataTex& data : m_data) {
+    // Camera and lights (positions & colors), uploaded only where they changed
+    glm::mat4 view = Camera::getViewMatrix();
+    glm::mat4 proj = Camera::getProjection(aspect_ratio);
+    UniformBlocks::set_camera(view, proj);
+    for (int i = 0; i < num_lights; i++) {
+        UniformBlocks::set_light(i, m_lightPosn[i], m_lightCol[i]);
+    }
+    UniformBlocks::flush();
+    GLState::use_program(shaderProgram);
+
+    // Meshes the multi-draw path batched are drawn together after the others
+    std::vector<glm::mat4>& models = m_models;
+    models.clear();
+    for (size_t i = 0; i < m_data.size(); i++) {
+        DataTex& data = m_data[i];
         // Skip empty meshes
         if (data.m_draw_objects.empty()) {
+            models.push_back(glm::mat4(1.0f));
             continue;
         }
 
-        updateMVP(data);
+        glm::mat4 model = updateModel(data);
+        glm::mat4 mvp = proj * view * model;
+        models.push_back(model);
+        FrustumCuller::cull(data, mvp);
+        if (data.m_instances.transforms.empty()) {
+            TextureStreamer::request(data, mvp, static_cast<float>(current_vp_height));
+        }
+        for (const glm::mat4& transform : data.m_instances.transforms) {
+            TextureStreamer::request(data, mvp * transform, static_cast<float>(current_vp_height));
+        }
+        if (MultiDraw::batched(i)) continue;
 
         if (render_mode == 0){
             Mesh::draw(GL_FRONT_AND_BACK, GL_FILL, shaderProgram, data);
         }
         if (render_mode == 1){
-            glLineWidth(1);
+            GLState::line_width(1.0f);
             Mesh::draw(GL_FRONT_AND_BACK, GL_LINE, shaderProgram, data);
         }
         if (render_mode == 2){
-            glPointSize(5);
+            GLState::point_size(5.0f);
             Mesh::draw(GL_FRONT_AND_BACK, GL_POINT, shaderProgram, data);
         }
     }
+
+    GLState::line_width(1.0f);
+    GLState::point_size(5.0f);
+    const GLenum polygon_modes[] = {GL_FILL, GL_LINE, GL_POINT};
+    MultiDraw::draw(GL_FRONT_AND_BACK, polygon_modes[render_mode], m_data, models);
+    GLState::use_program(shaderProgram);
+    GLState::bind_vertex_array(0);
 }
 
 void Window::update() {
@@ -366,6 +463,9 @@ void Window::update() {
     float deltaTime = static_cast<float>(currentTime - lastTime);
     lastTime = currentTime;
 
+    // Queue the meshes whose background parse finished for upload
+    AsyncLoader::collect_finished();
+
     // Handle continuous movement (this needs to be polled each frame)
     ImGuiIO& io = ImGui::GetIO();
     if (!io.WantCaptureKeyboard) {
@@ -405,12 +505,106 @@ void Window::update() {
     ImGui::Button("Lines", ImVec2(75.0f, 25.0f)) ? render_mode = 1 : 0; ImGui::SameLine();
     ImGui::Button("Point Cloud", ImVec2(90.0f, 25.0f)) ? render_mode = 2 : 0; ImGui::SameLine();
     ImGui::Text(" ");
+    MultiDraw::draw_stats();
+    UniformBlocks::draw_stats();
+    GLState::draw_stats();
+    FrustumCuller::draw_stats();
+    ImGui::Checkbox("Low-memory streaming import", &Mesh::streaming_import);
+    ImGui::Checkbox("Optimize vertex cache on load", &Mesh::optimize_vertex_cache);
+    ImGui::Checkbox("Instance repeated shapes on load", &Mesh::instance_duplicates);
+    const char* vertex_formats[] = { "Float (32 B)", "Quantized (16 B)" };
+    int vertex_format = static_cast<int>(Mesh::vertex_format);
+    if (ImGui::Combo("Vertex format", &vertex_format, vertex_formats, 2)) {
+        Mesh::vertex_format = static_cast<VertexFormat>(vertex_format);
+    }
+    ImGui::Checkbox("Report quantization error", &Mesh::report_quantization_error);
+    ImGui::SliderInt("Texture decode threads", &Mesh::texture_decode_threads, 1, 16);
+    ImGui::Checkbox("Pack textures into arrays", &Mesh::texture_arrays);
+    ImGui::Checkbox("Stream texture mips (not packed)", &TextureStreamer::enabled);
+    ImGui::Checkbox("Resample odd-sized textures into arrays", &Mesh::resample_texture_arrays);
+    if (TextureCache::supported) {
+        ImGui::Checkbox("Use compressed texture cache", &TextureCache::enabled);
+        ImGui::Checkbox("Compress uncached textures on load", &TextureCache::bake_on_miss);
+    } else {
+        ImGui::Text("Compressed textures unsupported (no S3TC)");
+    }
+    ImGui::Text(" ");
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+
+    ImGui::Separator(); ImGui::TextColored({0.0f, 1.0f, 1.0f, 1.0f}, "Loading"); ImGui::Separator();
+    AsyncLoader::draw_progress();
+    UploadScheduler::draw_stats();
+    TextureStreamer::draw_stats();
+    ResourceCache::draw_stats();
+    ImGui::Text(" ");
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+
+    ImGui::Separator(); ImGui::TextColored({0.0f, 1.0f, 1.0f, 1.0f}, "Instancing"); ImGui::Separator();
+    if (m_data.empty()) {
+        ImGui::Text("No meshes loaded");
+    } else {
+        instance_mesh = std::clamp(instance_mesh, 0, static_cast<int>(m_data.size()) - 1);
+        ImGui::SliderInt("Mesh", &instance_mesh, 0, static_cast<int>(m_data.size()) - 1);
+        DataTex& data = m_data[instance_mesh];
+        ImGui::Text("%zu instances", std::max<size_t>(data.m_instances.transforms.size(), 1));
+
+        // Grid spacing is relative to the size of the mesh
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        for (const DrawObject& o : data.m_draw_objects) {
+            if (o.numVertices == 0) continue;
+            lo = glm::min(lo, o.bmin);
+            hi = glm::max(hi, o.bmax);
+        }
+        glm::vec3 extent = glm::max(hi - lo, glm::vec3(0.0f));
+        float size = std::max({extent.x, extent.y, extent.z, 1e-6f});
+
+        ImGui::SliderInt("Grid size", &instance_grid, 1, 200);
+        ImGui::SliderFloat("Grid spacing", &instance_spacing, 1.0f, 4.0f);
+        if (ImGui::Button("Place grid")) {
+            Mesh::set_instances(data, Scene::grid(instance_grid, instance_grid, instance_spacing * size));
+        }
+        ImGui::DragFloat3("Position", &instance_position.x, 0.05f * size);
+        ImGui::SliderFloat("Yaw", &instance_yaw, -180.0f, 180.0f);
+        ImGui::SliderFloat("Scale", &instance_scale, 0.1f, 10.0f);
+        if (ImGui::Button("Add instance")) {
+            // The mesh itself becomes the first instance
+            std::vector<glm::mat4> transforms = data.m_instances.transforms;
+            if (transforms.empty()) transforms.push_back(glm::mat4(1.0f));
+            transforms.push_back(Scene::placement(instance_position, instance_yaw, instance_scale));
+            Mesh::set_instances(data, std::move(transforms));
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Clear instances")) {
+            Mesh::set_instances(data, {});
+        }
+    }
+    ImGui::Text(" ");
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+
+    ImGui::Separator(); ImGui::TextColored({0.0f, 1.0f, 1.0f, 1.0f}, "Picking"); ImGui::Separator();
+    BVH::draw_stats();
+    if (!pick.hit() || pick.mesh >= m_data.size()) {
+        ImGui::Text("Click a surface to pick it");
+    } else {
+        ImGui::Text("Mesh %zu, object %zu, instance %zu, triangle %u", pick.mesh, pick.object, pick.instance, pick.triangle);
+        ImGui::Text("X: %.4f, Y: %.4f, Z: %.4f", pick.meshPoint.x, pick.meshPoint.y, pick.meshPoint.z);
+        ImGui::Text("Distance from camera: %.4f", glm::distance(pick.point, Camera::get_position()));
+        // Measured in the mesh's own units when both picks are on the same one
+        if (previous_pick.hit() && previous_pick.mesh == pick.mesh) {
+            ImGui::Text("Distance from previous pick: %.4f", glm::distance(pick.meshPoint, previous_pick.meshPoint));
+        } else if (previous_pick.hit()) {
+            ImGui::Text("Distance from previous pick: %.4f (view units)", glm::distance(pick.point, previous_pick.point));
+        }
+    }
     ImGui::Text(" ");
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
 
     ImGui::Separator(); ImGui::TextColored({0.0f, 1.0f, 1.0f, 1.0f}, "Control Instructions"); ImGui::Separator();
-    ImGui::Text("Drag & Drop Your .OBJ file!");
+    ImGui::Text("Drag & Drop Your .OBJ or .scene file!");
     ImGui::Text("");
     ImGui::Text("   Up : W | S : Down");
     ImGui::Text(" Left : A | D : Right");
@@ -418,6 +612,7 @@ void Window::update() {
     ImGui::Text("ESC to Close");
     ImGui::Text("SPACE to activate mouse");
     ImGui::Text("Mouse for camera rotations");
+    ImGui::Text("Left click to pick and measure");
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -456,6 +651,13 @@ void Window::update() {
     ImGui::Text("positions and color intensities.");
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Delete what no mesh uses anymore, upload within the frame budget, batch
+    // new meshes for multi-draw, stream the texture levels the last frame
+    // asked for, then draw
+    ResourceCache::collect();
+    UploadScheduler::run(m_data);
+    MultiDraw::update(m_data);
+    TextureStreamer::update();
     display();
     ////////////////////////////////////////////////////////////////////////////////////////////////
 
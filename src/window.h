@@ -1,6 +1,9 @@
 #pragma once
 
 #include "mesh.h"
+#include "bvh.h"
+#include "shaders.h"
+#include "ubo.h"
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <array>
@@ -22,7 +25,7 @@ public:
     static void update();
     static bool isActive();
     static void cleanup();
-    static void updateMVP(const DataTex& data);
+    static glm::mat4 updateModel(const DataTex& data);
     static void applyTextureFiltering();
 
 private:
@@ -33,6 +36,7 @@ private:
     static bool firstMouseAfterToggle;
 
     static GLuint shaderProgram;
+    static Uniform<glm::mat4> model_uniform;
     static int render_mode;
     static int filter_mode;  // 0 = Bilinear, 1 = Trilinear, 2 = Anisotropic
     static bool vsync_enabled;
@@ -41,11 +45,24 @@ private:
     static int current_vp_height, current_vp_width;
     static float aspect_ratio;
 
-    static const int num_lights = 5;
+    // Instancing panel: the mesh it edits, the grid it places and the next single instance
+    static int instance_mesh;
+    static int instance_grid;
+    static float instance_spacing;  // In sizes of the mesh
+    static glm::vec3 instance_position;
+    static float instance_yaw;
+    static float instance_scale;
+
+    // Picking: the surfaces of the last two clicks
+    static RayHit pick;
+    static RayHit previous_pick;
+
+    static const int num_lights = UniformBlocks::num_lights;
 
     static std::array<glm::vec4, num_lights> m_lightPosn;
     static std::array<glm::vec4, num_lights> m_lightCol;
 
     static GLFWwindow* glfwWindow;
     static std::vector<DataTex> m_data;
+    static std::vector<glm::mat4> m_models;    // Of m_data, as last drawn
 };
\ No newline at end of file
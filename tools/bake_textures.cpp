@@ -0,0 +1,105 @@
+// Offline baker for the compressed texture cache (src/texcache.h).
+//
+// Decodes every image given, or found in the directories given, and writes
+// its BC1/BC3/BC4/BC5 mip chain to the cache the viewer reads on load.
+// Images whose entry is still valid are skipped unless -f is passed. Needs
+// no window or GL context, so it can run headless on a build machine.
+//
+// Usage: bake_textures [-f] [-j threads] [-o cache_dir] image_or_dir...
+//        (e.g. bake_textures sponza/textures, from the viewer's working directory)
+
+#include "texcache.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+bool isImage(const std::filesystem::path &path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga" || ext == ".bmp";
+}
+
+// Returns the size of the cache entry written, 0 if `path` was skipped or failed
+size_t bake(const std::filesystem::path &path, bool force) {
+    CpuTexture texture;
+    if (!force && TextureCache::load(path, texture)) return 0;
+
+    int w, h, comp;
+    unsigned char *image = stbi_load(path.string().c_str(), &w, &h, &comp, STBI_default);
+    if (!image) {
+        fprintf(stderr, "cannot decode %s: %s\n", path.string().c_str(), stbi_failure_reason());
+        return 0;
+    }
+    texture.width = w;
+    texture.height = h;
+    texture.comp = comp;
+    texture.pixels.assign(image, image + static_cast<size_t>(w) * h * comp);
+    stbi_image_free(image);
+
+    TextureCache::compress(texture, TextureCache::is_normal_map(path));
+    if (!TextureCache::store(path, texture)) {
+        fprintf(stderr, "cannot write %s\n", TextureCache::entry_path(path).string().c_str());
+        return 0;
+    }
+    return texture.pixels.size();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    bool force = false;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::filesystem::path> images;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            force = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            TextureCache::directory = argv[++i];
+        } else if (std::filesystem::is_directory(argv[i])) {
+            for (const auto &entry : std::filesystem::recursive_directory_iterator(argv[i])) {
+                if (entry.is_regular_file() && isImage(entry.path())) images.push_back(entry.path());
+            }
+        } else {
+            images.push_back(argv[i]);
+        }
+    }
+    if (images.empty()) {
+        fprintf(stderr, "usage: %s [-f] [-j threads] [-o cache_dir] image_or_dir...\n", argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next{0}, baked{0}, bytes{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < images.size(); i = next++) {
+            if (size_t size = bake(images[i], force)) {
+                baked++;
+                bytes += size;
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) pool.emplace_back(worker);
+    worker();
+    for (std::thread &t : pool) t.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%zu of %zu images baked (%.1f MB) into %s in %.2f s\n", baked.load(), images.size(),
+           bytes / (1024.0 * 1024.0), TextureCache::directory.string().c_str(), seconds);
+    return 0;
+}